@@ -12,6 +12,8 @@
 // 2. It will not produce the same results on little-endian and big-endian
 //    machines.
 
+#include <string.h>
+
 unsigned int MurmurHash2 ( const void * key, int len, unsigned int seed )
 {
 	// 'm' and 'r' are mixing constants generated offline.
@@ -46,3 +48,200 @@ unsigned int MurmurHash2 ( const void * key, int len, unsigned int seed )
 
 	return h;
 } 
+
+//-----------------------------------------------------------------------------
+// MurmurHash64A, 64-bit version of MurmurHash2 for 64-bit platforms, by Austin Appleby
+// Used to hash strings and whole documents.
+
+unsigned long MurmurHash64A ( const void * key, int len, unsigned long seed )
+{
+	const unsigned long m = 0xc6a4a7935bd1e995UL;
+	const int r = 47;
+
+	unsigned long h = seed ^ (len * m);
+
+	const unsigned char * data = (const unsigned char *)key;
+	const unsigned char * end = data + (len/8)*8;
+
+	while(data != end)
+	{
+		unsigned long k;
+		memcpy(&k, data, sizeof(k));
+		data += 8;
+
+		k *= m; 
+		k ^= k >> r; 
+		k *= m; 
+		
+		h ^= k;
+		h *= m; 
+	}
+
+	switch(len & 7)
+	{
+	case 7: h ^= (unsigned long)data[6] << 48;
+	case 6: h ^= (unsigned long)data[5] << 40;
+	case 5: h ^= (unsigned long)data[4] << 32;
+	case 4: h ^= (unsigned long)data[3] << 24;
+	case 3: h ^= (unsigned long)data[2] << 16;
+	case 2: h ^= (unsigned long)data[1] << 8;
+	case 1: h ^= (unsigned long)data[0];
+	        h *= m;
+	};
+ 
+	h ^= h >> r;
+	h *= m;
+	h ^= h >> r;
+
+	return h;
+} 
+
+//-----------------------------------------------------------------------------
+// Batched variant used by the bloom filter code
+//
+// Every word_id is hashed twice with len=3, once with seed 1 and once with
+// seed 5. With only 3 bytes the "mix 4 bytes at a time" loop is never entered,
+// so both hashes reduce to
+//
+//   h = fmix( ((seed ^ 3) ^ (id & 0xffffff)) * m )
+//
+// which maps directly onto 32-bit SIMD lanes. murmur2_3byte_x2() computes both
+// seeds in one pass and picks the widest instruction set available at runtime.
+
+#include "common.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MURMUR2_X86 1
+#endif
+
+static const uint32_t murmur2_m     = 0x5bd1e995;
+static const uint32_t murmur2_seed1 = 1 ^ 3;
+static const uint32_t murmur2_seed2 = 5 ^ 3;
+
+static inline uint32_t murmur2_3byte_fmix ( uint32_t h )
+{
+	h *= murmur2_m;
+	h ^= h >> 13;
+	h *= murmur2_m;
+	h ^= h >> 15;
+	return h;
+}
+
+static void murmur2_3byte_x2_scalar ( const uint32_t * ids, size_t n, uint32_t * h1, uint32_t * h2 )
+{
+	for (size_t i = 0; i < n; i++) {
+		uint32_t k = ids[i] & 0xffffff;
+		h1[i] = murmur2_3byte_fmix(murmur2_seed1 ^ k);
+		h2[i] = murmur2_3byte_fmix(murmur2_seed2 ^ k);
+	}
+}
+
+#ifdef MURMUR2_X86
+
+__attribute__((target("sse4.1")))
+static void murmur2_3byte_x2_sse41 ( const uint32_t * ids, size_t n, uint32_t * h1, uint32_t * h2 )
+{
+	const __m128i m    = _mm_set1_epi32(murmur2_m);
+	const __m128i mask = _mm_set1_epi32(0xffffff);
+	const __m128i s1   = _mm_set1_epi32(murmur2_seed1);
+	const __m128i s2   = _mm_set1_epi32(murmur2_seed2);
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128i k = _mm_and_si128(_mm_loadu_si128((const __m128i *)(ids + i)), mask);
+		__m128i a = _mm_mullo_epi32(_mm_xor_si128(k, s1), m);
+		__m128i b = _mm_mullo_epi32(_mm_xor_si128(k, s2), m);
+		a = _mm_xor_si128(a, _mm_srli_epi32(a, 13));
+		b = _mm_xor_si128(b, _mm_srli_epi32(b, 13));
+		a = _mm_mullo_epi32(a, m);
+		b = _mm_mullo_epi32(b, m);
+		a = _mm_xor_si128(a, _mm_srli_epi32(a, 15));
+		b = _mm_xor_si128(b, _mm_srli_epi32(b, 15));
+		_mm_storeu_si128((__m128i *)(h1 + i), a);
+		_mm_storeu_si128((__m128i *)(h2 + i), b);
+	}
+	murmur2_3byte_x2_scalar(ids + i, n - i, h1 + i, h2 + i);
+}
+
+__attribute__((target("avx2")))
+static void murmur2_3byte_x2_avx2 ( const uint32_t * ids, size_t n, uint32_t * h1, uint32_t * h2 )
+{
+	const __m256i m    = _mm256_set1_epi32(murmur2_m);
+	const __m256i mask = _mm256_set1_epi32(0xffffff);
+	const __m256i s1   = _mm256_set1_epi32(murmur2_seed1);
+	const __m256i s2   = _mm256_set1_epi32(murmur2_seed2);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256i k = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(ids + i)), mask);
+		__m256i a = _mm256_mullo_epi32(_mm256_xor_si256(k, s1), m);
+		__m256i b = _mm256_mullo_epi32(_mm256_xor_si256(k, s2), m);
+		a = _mm256_xor_si256(a, _mm256_srli_epi32(a, 13));
+		b = _mm256_xor_si256(b, _mm256_srli_epi32(b, 13));
+		a = _mm256_mullo_epi32(a, m);
+		b = _mm256_mullo_epi32(b, m);
+		a = _mm256_xor_si256(a, _mm256_srli_epi32(a, 15));
+		b = _mm256_xor_si256(b, _mm256_srli_epi32(b, 15));
+		_mm256_storeu_si256((__m256i *)(h1 + i), a);
+		_mm256_storeu_si256((__m256i *)(h2 + i), b);
+	}
+	murmur2_3byte_x2_scalar(ids + i, n - i, h1 + i, h2 + i);
+}
+
+// GCC 12 reports a false uninitialized warning inside the AVX-512 shift intrinsics
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+__attribute__((target("avx512f")))
+static void murmur2_3byte_x2_avx512 ( const uint32_t * ids, size_t n, uint32_t * h1, uint32_t * h2 )
+{
+	const __m512i m    = _mm512_set1_epi32(murmur2_m);
+	const __m512i mask = _mm512_set1_epi32(0xffffff);
+	const __m512i s1   = _mm512_set1_epi32(murmur2_seed1);
+	const __m512i s2   = _mm512_set1_epi32(murmur2_seed2);
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m512i k = _mm512_and_si512(_mm512_loadu_si512((const void *)(ids + i)), mask);
+		__m512i a = _mm512_mullo_epi32(_mm512_xor_si512(k, s1), m);
+		__m512i b = _mm512_mullo_epi32(_mm512_xor_si512(k, s2), m);
+		a = _mm512_xor_si512(a, _mm512_srli_epi32(a, 13));
+		b = _mm512_xor_si512(b, _mm512_srli_epi32(b, 13));
+		a = _mm512_mullo_epi32(a, m);
+		b = _mm512_mullo_epi32(b, m);
+		a = _mm512_xor_si512(a, _mm512_srli_epi32(a, 15));
+		b = _mm512_xor_si512(b, _mm512_srli_epi32(b, 15));
+		_mm512_storeu_si512((void *)(h1 + i), a);
+		_mm512_storeu_si512((void *)(h2 + i), b);
+	}
+	murmur2_3byte_x2_scalar(ids + i, n - i, h1 + i, h2 + i);
+}
+#pragma GCC diagnostic pop
+
+#endif
+
+murmur2_x2_fn murmur2_3byte_x2_impl ( const char * isa )
+{
+	if (strcmp(isa, "scalar") == 0) return murmur2_3byte_x2_scalar;
+#ifdef MURMUR2_X86
+	__builtin_cpu_init();
+	if (strcmp(isa, "sse4.1") == 0 && __builtin_cpu_supports("sse4.1"))  return murmur2_3byte_x2_sse41;
+	if (strcmp(isa, "avx2") == 0 && __builtin_cpu_supports("avx2"))      return murmur2_3byte_x2_avx2;
+	if (strcmp(isa, "avx512") == 0 && __builtin_cpu_supports("avx512f")) return murmur2_3byte_x2_avx512;
+#endif
+	return NULL;
+}
+
+static murmur2_x2_fn murmur2_3byte_x2_select ()
+{
+	const char * isas[] = { "avx512", "avx2", "sse4.1" };
+	for (unsigned i = 0; i < sizeof(isas)/sizeof(isas[0]); i++) {
+		murmur2_x2_fn fn = murmur2_3byte_x2_impl(isas[i]);
+		if (fn) return fn;
+	}
+	return murmur2_3byte_x2_scalar;
+}
+
+void murmur2_3byte_x2 ( const uint32_t * ids, size_t n, uint32_t * h1, uint32_t * h2 )
+{
+	static const murmur2_x2_fn fn = murmur2_3byte_x2_select();
+	fn(ids, n, h1, h2);
+}
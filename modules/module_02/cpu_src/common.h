@@ -1,6 +1,26 @@
 #pragma once
 
+#include <stdint.h>
+#include <stddef.h>
+
 unsigned int MurmurHash2(const void* key ,int len,unsigned int seed);
+unsigned long MurmurHash64A(const void* key ,int len,unsigned long seed);
+
+// Hashes the low 3 bytes of n word ids with seeds 1 (h1) and 5 (h2), same as
+// two MurmurHash2(&id,3,seed) calls. Dispatches to the widest SIMD path the CPU supports.
+void murmur2_3byte_x2(const uint32_t* ids, size_t n, uint32_t* h1, uint32_t* h2);
+
+// Returns a specific implementation ("scalar", "sse4.1", "avx2", "avx512"),
+// or NULL if the CPU does not support it. Used by the benchmark.
+typedef void (*murmur2_x2_fn)(const uint32_t* ids, size_t n, uint32_t* h1, uint32_t* h2);
+murmur2_x2_fn murmur2_3byte_x2_impl(const char* isa);
+
+// Sets inh_flags[i] when word i passes the bloom filter test (0 for docTag)
+void computeInhFlags (
+    unsigned int*  input_doc_words,
+    unsigned char* inh_flags,
+    unsigned int*  bloom_filter,
+    unsigned long  count);
 
 void runOnCPU (
     unsigned int*  doc_sizes,
@@ -9,5 +29,105 @@ void runOnCPU (
     unsigned long* profile_weights,
     unsigned long* profile_score,
     unsigned int   total_num_docs,
-    unsigned int   total_size);
+    unsigned long  total_size);
+
+// CPU backend with the FPGA flow's chunks, commands and wait lists (run_cpu_backend.cpp)
+void runOnFPGA(
+    unsigned int*  doc_sizes,
+    unsigned int*  input_doc_words,
+    unsigned int*  bloom_filter,
+    unsigned long* profile_weights,
+    unsigned long* profile_score,
+    unsigned int   total_num_docs,
+    unsigned long  total_doc_size,
+    int            num_iter);
+
+// Device index of runOnFPGA, only printed by the CPU backend. runSharded
+// gives each worker its own index, like the FPGA hosts.
+extern unsigned int fpga_device;
+
+
+// Profile of num_entries word ids with a weight of 10 each: fills the
+// 1<<24 profile_weights and the bloom filter used to pre-screen words
+void buildProfile (
+    const unsigned int* entries,
+    unsigned int        num_entries,
+    unsigned long*      profile_weights,
+    unsigned int*       bloom_filter);
+
+// buildProfile() from num_entries word ids drawn from a fixed seed, so
+// separate processes can agree on the same profile
+void randomProfile (
+    unsigned int   seed,
+    unsigned int   num_entries,
+    unsigned long* profile_weights,
+    unsigned int*  bloom_filter);
+
+// Structure-of-arrays corpus: word_id and frequency in separate streams
+void packedToSoA (
+    unsigned int*  input_doc_words,
+    unsigned int*  word_ids,
+    unsigned char* frequencies,
+    unsigned long  total_size);
+
+void runOnCPU_SoA (
+    unsigned int*  doc_sizes,
+    unsigned int*  word_ids,
+    unsigned char* frequencies,
+    unsigned int*  bloom_filter,
+    unsigned long* profile_weights,
+    unsigned long* profile_score,
+    unsigned int   total_num_docs,
+    unsigned long  total_size);
+
+// Scores documents [first_doc, first_doc+num_docs), whose first word is at
+// word_offset, from the in-hash flags. Flagged words are looked up in
+// profile_weights in prefetched batches. Returns the number of lookups done.
+unsigned long scoreDocuments (
+    unsigned int*  doc_sizes,
+    unsigned int*  input_doc_words,
+    unsigned char* inh_flags,
+    unsigned long* profile_weights,
+    unsigned long* profile_score,
+    unsigned int   first_doc,
+    unsigned int   num_docs,
+    unsigned long  word_offset);
+
+// scoreDocuments on the structure-of-arrays layout of packedToSoA
+unsigned long scoreDocumentsSoA (
+    unsigned int*  doc_sizes,
+    unsigned int*  word_ids,
+    unsigned char* frequencies,
+    unsigned char* inh_flags,
+    unsigned long* profile_weights,
+    unsigned long* profile_score,
+    unsigned int   first_doc,
+    unsigned int   num_docs,
+    unsigned long  word_offset);
+
+// Any engine with the runOnCPU signature can score a shard
+typedef void (*score_engine_fn)(
+    unsigned int*  doc_sizes,
+    unsigned int*  input_doc_words,
+    unsigned int*  bloom_filter,
+    unsigned long* profile_weights,
+    unsigned long* profile_score,
+    unsigned int   total_num_docs,
+    unsigned long  total_size);
 
+// Coordinator: splits the corpus on document boundaries into num_workers
+// shards, scores each shard with engine in its own worker process and merges
+// the scores into profile_score through shared memory. Shards are padded with
+// docTag to a multiple of pad_words for engines that need whole blocks.
+// Worker s runs with fpga_device = s, so FPGA engines use one device each.
+void runSharded (
+    unsigned int*  doc_sizes,
+    unsigned int*  input_doc_words,
+    unsigned int*  bloom_filter,
+    unsigned long* profile_weights,
+    unsigned long* profile_score,
+    unsigned int   total_num_docs,
+    unsigned long  total_size,
+    unsigned int   num_workers,
+    unsigned int   pad_words,
+    score_engine_fn engine);
@@ -2,12 +2,49 @@
 host: $(SRCDIR)/*.cpp $(SRCDIR)/*.c $(SRCDIR)/*.h
 	g++ -D__USE_XOPEN2K8 -D__USE_XOPEN2K8 \
 		-I$(SRCDIR) \
-		-O3 -Wall -fmessage-length=0 -std=c++11\
+		-O3 -Wall -fmessage-length=0 -std=c++11 -pthread \
 		$(SRCDIR)/compute_score_host.cpp \
+		$(SRCDIR)/compute_score_soa.cpp \
+		$(SRCDIR)/compute_score_lookup.cpp \
+		$(SRCDIR)/compute_score_cache.cpp \
+		$(SRCDIR)/shard_coordinator.cpp \
+		$(SRCDIR)/cpu_device.cpp \
+		$(SRCDIR)/run_cpu_backend.cpp \
+		$(SRCDIR)/event_trace.cpp \
+		$(SRCDIR)/profile.cpp \
+		$(SRCDIR)/packed_corpus.cpp \
 		$(SRCDIR)/MurmurHash2.c \
 		$(SRCDIR)/main.cpp \
 		-o ./host
 
+murmur_bench: $(SRCDIR)/murmur_bench.cpp $(SRCDIR)/MurmurHash2.c $(SRCDIR)/*.h
+	g++ -I$(SRCDIR) -O3 -Wall -fmessage-length=0 -std=c++11 \
+		$(SRCDIR)/murmur_bench.cpp \
+		$(SRCDIR)/MurmurHash2.c \
+		-o ./murmur_bench
+
+ingest: $(SRCDIR)/ingest.cpp $(SRCDIR)/MurmurHash2.c $(SRCDIR)/*.h
+	g++ -I$(SRCDIR) -O3 -Wall -fmessage-length=0 -std=c++11 -pthread \
+		$(SRCDIR)/ingest.cpp \
+		$(SRCDIR)/MurmurHash2.c \
+		-o ./ingest
+
+SCORE_SERVICE_SRC := $(SRCDIR)/compute_score_host.cpp \
+		$(SRCDIR)/compute_score_lookup.cpp \
+		$(SRCDIR)/profile.cpp \
+		$(SRCDIR)/MurmurHash2.c
+
+score_daemon: $(SRCDIR)/score_daemon.cpp $(SRCDIR)/*.cpp $(SRCDIR)/*.c $(SRCDIR)/*.h
+	g++ -I$(SRCDIR) -O3 -Wall -fmessage-length=0 -std=c++11 -pthread \
+		$(SRCDIR)/score_daemon.cpp \
+		$(SCORE_SERVICE_SRC) \
+		-o ./score_daemon
+
+score_client: $(SRCDIR)/score_client.cpp $(SRCDIR)/*.cpp $(SRCDIR)/*.c $(SRCDIR)/*.h
+	g++ -I$(SRCDIR) -O3 -Wall -fmessage-length=0 -std=c++11 -pthread \
+		$(SRCDIR)/score_client.cpp \
+		$(SCORE_SERVICE_SRC) \
+		-o ./score_client
 
 clean:
-	rm -rf temp_dir log_dir report_dir *log host runOnfpga* *.csv *summary .run .Xil vitis* *jou xilinx*
+	rm -rf temp_dir log_dir report_dir *log host murmur_bench ingest score_daemon score_client event_trace.json runOnfpga* *.csv *summary .run .Xil vitis* *jou xilinx*
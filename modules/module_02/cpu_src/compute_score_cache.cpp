@@ -0,0 +1,125 @@
+#include<iostream>
+#include<ctime>
+#include<chrono>
+#include<vector>
+#include<utility>
+#include<cstdio>
+#include<cstdlib>
+
+#include"sizes.h"
+#include "common.h"
+#include "score_cache.h"
+
+using namespace std;
+using namespace std::chrono;
+
+ScoreCache::ScoreCache(unsigned log2_sets)
+    : hits(0), misses(0), bytes_skipped(0),
+      set_mask((1u << log2_sets) - 1),
+      entries((1ul << log2_sets) * ways),
+      clock(1ul << log2_sets, 0),
+      locks(new std::mutex[num_locks])
+{
+    for (unsigned long i = 0; i < entries.size(); i++) {
+        entries[i].key = 0;
+        entries[i].score = 0;
+        entries[i].version = 0;
+        entries[i].stamp = 0;
+    }
+}
+
+bool ScoreCache::lookup(unsigned long key, unsigned version, unsigned long& score)
+{
+    unsigned set = key & set_mask;
+    Entry* e = &entries[(unsigned long)set * ways];
+
+    std::lock_guard<std::mutex> guard(locks[set % num_locks]);
+    for (unsigned w = 0; w < ways; w++) {
+        if (e[w].key == key && e[w].version == version) {
+            e[w].stamp = ++clock[set];
+            score = e[w].score;
+            hits++;
+            return true;
+        }
+    }
+    misses++;
+    return false;
+}
+
+void ScoreCache::insert(unsigned long key, unsigned version, unsigned long score)
+{
+    unsigned set = key & set_mask;
+    Entry* e = &entries[(unsigned long)set * ways];
+
+    std::lock_guard<std::mutex> guard(locks[set % num_locks]);
+    // Reuse the entry of the same document (stale profile version), else evict the oldest
+    unsigned victim = 0;
+    for (unsigned w = 0; w < ways; w++) {
+        if (e[w].key == key) { victim = w; break; }
+        if (e[w].stamp < e[victim].stamp) victim = w;
+    }
+    e[victim].key = key;
+    e[victim].version = version;
+    e[victim].score = score;
+    e[victim].stamp = ++clock[set];
+}
+
+unsigned long docContentHash(const unsigned int* words, unsigned int num_words)
+{
+    // 0 marks an empty cache entry
+    unsigned long h = MurmurHash64A(words, num_words*sizeof(unsigned int), 0x9747b28c);
+    return h ? h : 1;
+}
+
+void runOnCPU_cached (
+    unsigned int*  doc_sizes,
+    unsigned int*  input_doc_words,
+    unsigned int*  bloom_filter,
+    unsigned long* profile_weights,
+    unsigned long* profile_score,
+    unsigned int   total_num_docs,
+    unsigned long  total_size,
+    ScoreCache*    cache,
+    unsigned       profile_version)
+{
+    unsigned long hits_before = cache->hits;
+    unsigned long misses_before = cache->misses;
+    unsigned long skipped_before = cache->bytes_skipped;
+    unsigned long lookups = 0;
+
+    chrono::high_resolution_clock::time_point t1 = chrono::high_resolution_clock::now();
+
+    unsigned char* inh_flags = (unsigned char*)aligned_alloc(4096, total_size*sizeof(char));
+
+    // Documents are handled one at a time so a duplicate is served by the
+    // cache even when its first copy is in the same corpus
+    unsigned long word_offset = 0;
+    for (unsigned int doc = 0; doc < total_num_docs; doc++)
+    {
+        unsigned int* words = &input_doc_words[word_offset];
+        unsigned long key = docContentHash(words, doc_sizes[doc]);
+
+        if (cache->lookup(key, profile_version, profile_score[doc])) {
+            cache->bytes_skipped += doc_sizes[doc]*sizeof(unsigned int);
+        } else {
+            computeInhFlags(words, &inh_flags[word_offset], bloom_filter, doc_sizes[doc]);
+            lookups += scoreDocuments(doc_sizes, input_doc_words, inh_flags, profile_weights, profile_score, doc, 1, word_offset);
+            cache->insert(key, profile_version, profile_score[doc]);
+        }
+        word_offset += doc_sizes[doc];
+    }
+
+    chrono::high_resolution_clock::time_point t2 = chrono::high_resolution_clock::now();
+    chrono::duration<double> time_span_cpu = (t2-t1);
+
+    free(inh_flags);
+
+    unsigned long hits = cache->hits - hits_before;
+    unsigned long misses = cache->misses - misses_before;
+    unsigned long skipped = cache->bytes_skipped - skipped_before;
+
+    printf(" Total execution time of CPU (cache)  | %10.4f ms\n", 1000*time_span_cpu.count());
+    printf(" Score cache hit rate                 | %10.2f %%  ( %lu hits, %lu misses )\n", 100.0*hits/(hits+misses ? hits+misses : 1), hits, misses);
+    printf(" Bytes skipped on cache hits          | %10.3f MBytes\n", skipped/1000000.0);
+    printf(" Profile weight lookups               | %10lu lookups\n", lookups);
+}
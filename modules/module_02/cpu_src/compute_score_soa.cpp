@@ -0,0 +1,93 @@
+#include<iostream>
+#include<ctime>
+#include<chrono>
+#include<vector>
+#include<utility>
+#include<cstdio>
+#include<cstdlib>
+
+#include"sizes.h"
+#include "common.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// Split the packed (word_id << 8 | frequency) corpus into a 32-bit word_id
+// stream and an 8-bit frequency stream. The loop has no dependencies and is
+// vectorized by the compiler.
+void packedToSoA (
+    unsigned int*  input_doc_words,
+    unsigned int*  word_ids,
+    unsigned char* frequencies,
+    unsigned long  total_size)
+{
+    for (unsigned long n = 0; n < total_size; n++)
+    {
+        unsigned curr_entry = input_doc_words[n];
+        word_ids[n]    = curr_entry >> 8;
+        frequencies[n] = curr_entry & 0x00ff;
+    }
+}
+
+// Same computation as runOnCPU, on the structure-of-arrays layout.
+// The hash stage reads only the word_id stream and feeds it straight to the
+// batched MurmurHash2; frequencies are read only for flagged words.
+void runOnCPU_SoA (
+    unsigned int*  doc_sizes,
+    unsigned int*  word_ids,
+    unsigned char* frequencies,
+    unsigned int*  bloom_filter,
+    unsigned long* profile_weights,
+    unsigned long* profile_score,
+    unsigned int   total_num_docs,
+    unsigned long  total_size)
+{
+    unsigned long size_offset=0;
+
+    chrono::high_resolution_clock::time_point t1 = chrono::high_resolution_clock::now();
+
+    unsigned char* inh_flags = (unsigned char*)aligned_alloc(4096, total_size*sizeof(char));
+
+    for(unsigned int doc=0;doc<total_num_docs;doc++) 
+    {
+        size_offset+=doc_sizes[doc];
+    }
+
+    const unsigned hash_block = 1024;
+    unsigned int hash_pu[hash_block];
+    unsigned int hash_lu[hash_block];
+
+    for (unsigned long n = 0; n < size_offset; n += hash_block)
+    {
+        unsigned count = (size_offset-n < hash_block) ? size_offset-n : hash_block;
+
+        murmur2_3byte_x2(word_ids+n, count, hash_pu, hash_lu);
+
+        for (unsigned i = 0; i < count; i++)
+        {
+            bool doc_end = (word_ids[n+i]==docTag);
+            unsigned hash1 = hash_pu[i]&hash_bloom;
+            bool inh1 = (!doc_end) && (bloom_filter[ hash1 >> 5 ] & ( 1 << (hash1 & 0x1f)));
+            unsigned hash2 = (hash_pu[i]+hash_lu[i])&hash_bloom;
+            bool inh2 = (!doc_end) && (bloom_filter[ hash2 >> 5 ] & ( 1 << (hash2 & 0x1f)));
+
+            inh_flags[n+i] = (inh1 && inh2) ? 1 : 0;
+        }
+    }
+
+    chrono::high_resolution_clock::time_point t2 = chrono::high_resolution_clock::now();
+
+    // Same skipping of zero flags and batched lookups as scoreDocuments
+    scoreDocumentsSoA(doc_sizes, word_ids, frequencies, inh_flags, profile_weights, profile_score, 0, total_num_docs, 0);
+
+    chrono::high_resolution_clock::time_point t3 = chrono::high_resolution_clock::now();
+    chrono::duration<double> time_span_cpu   = (t3-t1);
+    chrono::duration<double> hash_processing   = (t2-t1);
+    chrono::duration<double> cpu_post_processing   = (t3-t2);
+
+    free(inh_flags);
+
+    printf(" Total execution time of CPU (SoA)    | %10.4f ms\n", 1000*time_span_cpu.count());
+    printf(" Compute Hash processing time         | %10.4f ms\n", 1000*hash_processing.count());
+    printf(" Compute Score processing time        | %10.4f ms\n", 1000*cpu_post_processing.count());
+}
@@ -0,0 +1,169 @@
+#include<chrono>
+#include<atomic>
+
+#include "cpu_device.h"
+
+using namespace std;
+using namespace std::chrono;
+
+struct CpuEventState {
+    mutex lock;
+    condition_variable completed;
+    atomic<bool> done;
+    unsigned long queued;
+    unsigned long submitted;
+    unsigned long started;
+    unsigned long ended;
+};
+
+static unsigned long nowNs()
+{
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+void CpuEvent::wait() const
+{
+    unique_lock<mutex> guard(state->lock);
+    state->completed.wait(guard, [this]{ return state->done.load(); });
+}
+
+unsigned long CpuEvent::queued() const    { return state->queued; }
+unsigned long CpuEvent::submitted() const { return state->submitted; }
+unsigned long CpuEvent::started() const   { return state->started; }
+unsigned long CpuEvent::ended() const     { return state->ended; }
+
+CpuQueue::CpuQueue(unsigned int num_engines)
+    : running(0), stop(false)
+{
+    for (unsigned i = 0; i < num_engines; i++) {
+        engines.push_back(thread(&CpuQueue::engine, this, i));
+    }
+}
+
+CpuQueue::~CpuQueue()
+{
+    finish();
+    {
+        lock_guard<mutex> guard(lock);
+        stop = true;
+    }
+    changed.notify_all();
+    for (unsigned i = 0; i < engines.size(); i++) engines[i].join();
+}
+
+void CpuQueue::enqueue(unsigned int engine, function<void()> work, const vector<CpuEvent>* wait_list, CpuEvent* done)
+{
+    Command cmd;
+    cmd.engine = engine % engines.size();
+    cmd.work = work;
+    if (wait_list) cmd.wait_list = *wait_list;
+    cmd.done.state = make_shared<CpuEventState>();
+    cmd.done.state->done = false;
+    cmd.done.state->queued = nowNs();
+    cmd.done.state->submitted = cmd.done.state->started = cmd.done.state->ended = 0;
+    if (done) *done = cmd.done;
+
+    lock_guard<mutex> guard(lock);
+    pending.push_back(cmd);
+    changed.notify_all();
+}
+
+void CpuQueue::finish()
+{
+    unique_lock<mutex> guard(lock);
+    changed.wait(guard, [this]{ return pending.empty() && running == 0; });
+}
+
+void CpuQueue::engine(unsigned int id)
+{
+    unique_lock<mutex> guard(lock);
+    while (true) {
+        list<Command>::iterator cmd = pending.begin();
+        for (; cmd != pending.end(); ++cmd) {
+            if (cmd->engine != id) continue;
+            bool ready = true;
+            for (unsigned i = 0; i < cmd->wait_list.size() && ready; i++) {
+                ready = cmd->wait_list[i].state->done;
+            }
+            if (ready) break;
+        }
+        if (cmd == pending.end()) {
+            if (stop) return;
+            changed.wait(guard);
+            continue;
+        }
+
+        Command run = *cmd;
+        pending.erase(cmd);
+        running++;
+        run.done.state->submitted = nowNs();
+        guard.unlock();
+
+        run.done.state->started = nowNs();
+        run.work();
+        run.done.state->ended = nowNs();
+        {
+            lock_guard<mutex> event_guard(run.done.state->lock);
+            run.done.state->done = true;
+        }
+        run.done.state->completed.notify_all();
+
+        guard.lock();
+        running--;
+        changed.notify_all();
+    }
+}
+
+ThreadPool::ThreadPool(unsigned int num_threads)
+    : job(NULL), num_tasks(0), next(0), remaining(0), stop(false)
+{
+    // The thread calling parallelFor is one of the num_threads
+    for (unsigned i = 1; i < num_threads; i++) {
+        threads.push_back(thread(&ThreadPool::worker, this));
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> guard(lock);
+        stop = true;
+    }
+    start.notify_all();
+    for (unsigned i = 0; i < threads.size(); i++) threads[i].join();
+}
+
+void ThreadPool::parallelFor(unsigned int tasks, const function<void(unsigned int)>& fn)
+{
+    unique_lock<mutex> guard(lock);
+    job = &fn;
+    num_tasks = tasks;
+    next = 0;
+    remaining = tasks;
+    start.notify_all();
+
+    while (next < num_tasks) {
+        unsigned int t = next++;
+        guard.unlock();
+        fn(t);
+        guard.lock();
+        remaining--;
+    }
+    done.wait(guard, [this]{ return remaining == 0; });
+    job = NULL;
+}
+
+void ThreadPool::worker()
+{
+    unique_lock<mutex> guard(lock);
+    while (true) {
+        start.wait(guard, [this]{ return stop || (job && next < num_tasks); });
+        if (stop) return;
+        const function<void(unsigned int)>* fn = job;
+        unsigned int t = next++;
+        guard.unlock();
+        (*fn)(t);
+        guard.lock();
+        if (--remaining == 0) done.notify_all();
+    }
+}
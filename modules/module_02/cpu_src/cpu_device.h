@@ -0,0 +1,94 @@
+#pragma once
+
+#include <vector>
+#include <list>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+// Host-only stand-in for the parts of the OpenCL runtime used by the FPGA
+// flow: events with profiling times and an out-of-order command queue with
+// wait lists. Commands are plain functions run by host threads.
+
+struct CpuEventState;
+
+// Completion and QUEUED/SUBMIT/START/END times of one command, in nanoseconds
+// on the steady clock
+class CpuEvent
+{
+public:
+    void wait() const;
+    unsigned long queued() const;
+    unsigned long submitted() const;
+    unsigned long started() const;
+    unsigned long ended() const;
+
+private:
+    friend class CpuQueue;
+    std::shared_ptr<CpuEventState> state;
+};
+
+// Out-of-order queue (CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE) in front of
+// num_engines engines, e.g. one per DMA direction and one for the compute
+// unit. An engine runs one command at a time: the ready command enqueued
+// first, a command being ready when every event of its wait list is
+// complete. Like on the FPGA, the kernel runs are serialized by their engine
+// even when their wait lists do not order them, and transfers overlap them.
+class CpuQueue
+{
+public:
+    explicit CpuQueue(unsigned int num_engines = 3);
+    ~CpuQueue();
+
+    void enqueue(unsigned int engine, std::function<void()> work, const std::vector<CpuEvent>* wait_list, CpuEvent* done);
+
+    // Blocks until every enqueued command is complete
+    void finish();
+
+private:
+    struct Command {
+        unsigned int           engine;
+        std::function<void()>  work;
+        std::vector<CpuEvent>  wait_list;
+        CpuEvent               done;
+    };
+
+    void engine(unsigned int id);
+
+    std::mutex lock;
+    std::condition_variable changed;
+    std::list<Command> pending;
+    unsigned int running;
+    bool stop;
+    std::vector<std::thread> engines;
+};
+
+// Fixed set of threads running the tasks of parallelFor, the compute units of
+// the CPU kernel. parallelFor must not be called by two threads at once.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(unsigned int num_threads);
+    ~ThreadPool();
+
+    // Runs fn(0) .. fn(num_tasks-1) on the pool and the calling thread and
+    // returns when they are all done
+    void parallelFor(unsigned int num_tasks, const std::function<void(unsigned int)>& fn);
+
+    unsigned int size() const { return threads.size() + 1; }
+
+private:
+    void worker();
+
+    std::mutex lock;
+    std::condition_variable start;
+    std::condition_variable done;
+    const std::function<void(unsigned int)>* job;
+    unsigned int num_tasks;
+    unsigned int next;
+    unsigned int remaining;
+    bool stop;
+    std::vector<std::thread> threads;
+};
@@ -0,0 +1,420 @@
+#include<chrono>
+#include<cstdio>
+#include<cstdlib>
+#include<cstring>
+#include<string>
+#include<vector>
+#include<thread>
+#include<atomic>
+#include<algorithm>
+#include<unistd.h>
+
+#if defined(__SSE2__)
+#include<emmintrin.h>
+#endif
+
+#include"sizes.h"
+#include"common.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// Text ingestion front-end for the document scoring host.
+//
+// Reads raw text from files or stdin, one document per line, and writes the
+// corpus in the format used by the host:
+//
+//   <prefix>.words : packed (word_id << 8 | frequency) words, uint32 each,
+//                    documents stored back to back, terms sorted by word_id
+//   <prefix>.sizes : number of words of each document, uint32 each
+//   <prefix>.vocab : the vocabulary, one term per line, word_id = line number
+//
+// Tokens are runs of ASCII letters and digits (bytes >= 0x80 are kept so UTF-8
+// words stay whole), lowercased. Term frequencies saturate at 255.
+//
+// Documents are processed in batches on a pool of threads in three phases:
+//   A (parallel) tokenize, look tokens up in the vocabulary
+//   B (serial)   give ids to the new terms, in document order
+//   C (parallel) aggregate term frequencies and pack the words
+// so the word ids do not depend on the number of threads.
+
+static const unsigned batch_docs = 4096;
+static const unsigned max_word_id = (docTag >> 8) - 1;   // docTag >> 8 marks padding
+
+static void usage()
+{
+    printf(" Usage: ingest [-t threads] [-v vocab_in] -o prefix [files...]\n");
+    printf("   One document per line. Reads stdin when no file is given.\n");
+    printf("   -v loads an existing vocabulary so ids match a previous run\n");
+}
+
+//-----------------------------------------------------------------------------
+// Vocabulary: open addressing hash table, terms stored in one string arena
+
+class Vocabulary
+{
+public:
+    Vocabulary() : mask(0), count(0) { grow(1 << 16); }
+
+    static unsigned long hash(const char* str, unsigned len) { return MurmurHash64A(str, len, 0x2545f491); }
+
+    // Returns the id of the term or -1 if it is not in the vocabulary
+    long find(unsigned long h, const char* str, unsigned len) const
+    {
+        for (unsigned long i = h & mask; ; i = (i+1) & mask) {
+            const Entry& e = table[i];
+            if (e.len == 0) return -1;
+            if (e.hash == h && e.len == len && memcmp(&arena[e.offset], str, len) == 0) return e.id;
+        }
+    }
+
+    unsigned insert(unsigned long h, const char* str, unsigned len)
+    {
+        long id = find(h, str, len);
+        if (id >= 0) return id;
+        if (count > max_word_id) {
+            printf("ERROR: More than %u distinct terms, word ids do not fit in 24 bits\n", max_word_id+1);
+            exit(-1);
+        }
+        if (2*(count+1) > mask) grow(2*(mask+1));
+        place(Entry{h, (unsigned long)arena.size(), len, count});
+        arena.append(str, len);
+        return count++;
+    }
+
+    unsigned size() const { return count; }
+
+    bool load(const char* filename)
+    {
+        FILE* f = fopen(filename, "r");
+        if (!f) return false;
+        char* line = NULL;
+        size_t cap = 0;
+        ssize_t n;
+        while ((n = getline(&line, &cap, f)) > 0) {
+            if (line[n-1] == '\n') n--;
+            if (n > 0) insert(hash(line, n), line, n);
+        }
+        free(line);
+        fclose(f);
+        return true;
+    }
+
+    bool save(const char* filename) const
+    {
+        FILE* f = fopen(filename, "w");
+        if (!f) return false;
+        vector<const Entry*> by_id(count);
+        for (const Entry& e : table) {
+            if (e.len) by_id[e.id] = &e;
+        }
+        for (const Entry* e : by_id) {
+            fwrite(&arena[e->offset], 1, e->len, f);
+            fputc('\n', f);
+        }
+        fclose(f);
+        return true;
+    }
+
+private:
+    struct Entry {
+        unsigned long hash;
+        unsigned long offset;
+        unsigned int  len;
+        unsigned int  id;
+    };
+
+    void place(const Entry& entry)
+    {
+        unsigned long i = entry.hash & mask;
+        while (table[i].len) i = (i+1) & mask;
+        table[i] = entry;
+    }
+
+    void grow(unsigned long capacity)
+    {
+        vector<Entry> old;
+        old.swap(table);
+        table.assign(capacity, Entry{0, 0, 0, 0});
+        mask = capacity-1;
+        for (const Entry& e : old) {
+            if (e.len) place(e);
+        }
+    }
+
+    vector<Entry> table;
+    string        arena;
+    unsigned long mask;
+    unsigned      count;
+};
+
+//-----------------------------------------------------------------------------
+// Tokenizer
+
+static inline bool isTokenChar(unsigned char c)
+{
+    return (unsigned char)(c-'0') < 10 || (unsigned char)((c|0x20)-'a') < 26 || c >= 0x80;
+}
+
+// Lowercases [begin,end) in place and sets bit i of mask[i/64] when byte i is
+// part of a token. 16 bytes are classified per SSE2 step.
+static void classifyBytes(char* begin, char* end, vector<unsigned long>& mask)
+{
+    size_t len = end-begin;
+    mask.assign((len+63)/64, 0);
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128i bias     = _mm_set1_epi8((char)0x80);
+    const __m128i zero     = _mm_set1_epi8('0');
+    const __m128i lower_a  = _mm_set1_epi8('a');
+    const __m128i case_bit = _mm_set1_epi8(0x20);
+    const __m128i digits   = _mm_set1_epi8((char)(0x80+10));
+    const __m128i letters  = _mm_set1_epi8((char)(0x80+26));
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i c     = _mm_loadu_si128((const __m128i*)(begin+i));
+        __m128i lower = _mm_or_si128(c, case_bit);
+        // Unsigned range checks done as signed compares on biased values
+        __m128i is_digit  = _mm_cmplt_epi8(_mm_add_epi8(_mm_sub_epi8(c, zero), bias), digits);
+        __m128i is_letter = _mm_cmplt_epi8(_mm_add_epi8(_mm_sub_epi8(lower, lower_a), bias), letters);
+        __m128i is_high   = _mm_cmplt_epi8(c, _mm_setzero_si128());
+        __m128i is_token  = _mm_or_si128(_mm_or_si128(is_digit, is_letter), is_high);
+
+        _mm_storeu_si128((__m128i*)(begin+i), _mm_or_si128(_mm_andnot_si128(is_letter, c), _mm_and_si128(is_letter, lower)));
+        unsigned long bits = (unsigned)_mm_movemask_epi8(is_token);
+        mask[i/64] |= bits << (i%64);
+    }
+#endif
+
+    for (; i < len; i++) {
+        unsigned char c = begin[i];
+        if (isTokenChar(c)) {
+            if ((unsigned char)((c|0x20)-'a') < 26) begin[i] = c|0x20;
+            mask[i/64] |= 1UL << (i%64);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Batch processing
+
+static const unsigned pending_bit = 1u << 31;
+
+struct Batch {
+    vector<char*>    doc_begin;      // documents of the batch, as [begin,end) lines
+    vector<char*>    doc_end;
+    vector<unsigned> token_ids;      // vocabulary id, or pending_bit | index in pending
+    vector<unsigned> doc_tokens;     // offset of each document in token_ids
+    vector<pair<const char*,unsigned>> pending;   // new terms, in first-seen order
+    vector<unsigned> pending_ids;
+    vector<unsigned> words;          // packed output
+    vector<unsigned> sizes;
+    unsigned long    num_tokens;
+};
+
+static void tokenizeBatch(Batch& b, const Vocabulary& vocab)
+{
+    Vocabulary local;   // new terms of this batch, ids are indexes in b.pending
+    vector<unsigned long> mask;
+
+    b.token_ids.clear();
+    b.doc_tokens.clear();
+    b.pending.clear();
+    b.num_tokens = 0;
+
+    for (size_t d = 0; d < b.doc_begin.size(); d++)
+    {
+        b.doc_tokens.push_back(b.token_ids.size());
+        char* begin = b.doc_begin[d];
+        size_t len = b.doc_end[d]-begin;
+        classifyBytes(begin, b.doc_end[d], mask);
+
+        size_t i = 0;
+        while (i < len) {
+            // Find the next token start and end by scanning the bit mask
+            unsigned long bits = mask[i/64] & (~0UL << (i%64));
+            while (!bits && (i = (i/64+1)*64) < len) bits = mask[i/64];
+            if (!bits) break;
+            size_t start = (i/64)*64 + __builtin_ctzl(bits);
+            if (start >= len) break;
+
+            size_t stop = start;
+            unsigned long inv = ~mask[stop/64] & (~0UL << (stop%64));
+            while (!inv && (stop = (stop/64+1)*64) < len) inv = ~mask[stop/64];
+            stop = inv ? min((stop/64)*64 + __builtin_ctzl(inv), len) : len;
+
+            const char* str = begin+start;
+            unsigned tlen = stop-start;
+            unsigned long h = Vocabulary::hash(str, tlen);
+            long id = vocab.find(h, str, tlen);
+            if (id < 0) {
+                unsigned before = local.size();
+                id = local.insert(h, str, tlen);
+                if (local.size() != before) b.pending.push_back(make_pair(str, tlen));
+                id |= pending_bit;
+            }
+            b.token_ids.push_back(id);
+            b.num_tokens++;
+            i = stop;
+        }
+    }
+    b.doc_tokens.push_back(b.token_ids.size());
+}
+
+static void packBatch(Batch& b)
+{
+    b.words.clear();
+    b.sizes.clear();
+    vector<unsigned> ids;
+
+    for (size_t d = 0; d+1 < b.doc_tokens.size(); d++)
+    {
+        ids.assign(b.token_ids.begin()+b.doc_tokens[d], b.token_ids.begin()+b.doc_tokens[d+1]);
+        for (unsigned& id : ids) {
+            if (id & pending_bit) id = b.pending_ids[id & ~pending_bit];
+        }
+        sort(ids.begin(), ids.end());
+
+        unsigned doc_size = 0;
+        for (size_t i = 0; i < ids.size(); ) {
+            size_t j = i;
+            while (j < ids.size() && ids[j] == ids[i]) j++;
+            unsigned freq = min<size_t>(j-i, 255);
+            b.words.push_back((ids[i] << 8) | freq);
+            doc_size++;
+            i = j;
+        }
+        b.sizes.push_back(doc_size);
+    }
+}
+
+template<typename F>
+static void parallelFor(size_t n, unsigned num_threads, F fn)
+{
+    atomic<size_t> next(0);
+    vector<thread> pool;
+    for (unsigned t = 0; t < num_threads; t++) {
+        pool.push_back(thread([&]() {
+            for (size_t i; (i = next++) < n; ) fn(i);
+        }));
+    }
+    for (thread& t : pool) t.join();
+}
+
+static bool readAll(FILE* f, vector<char>& data)
+{
+    data.clear();
+    size_t n = 0;
+    do {
+        data.resize(n + (1 << 24));
+        n += fread(&data[n], 1, 1 << 24, f);
+    } while (!feof(f) && !ferror(f));
+    data.resize(n);
+    return !ferror(f);
+}
+
+int main(int argc, char** argv)
+{
+    unsigned num_threads = thread::hardware_concurrency();
+    const char* vocab_in = NULL;
+    string prefix;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:v:o:h")) != -1) {
+        switch (opt) {
+          case 't': num_threads = atoi(optarg); break;
+          case 'v': vocab_in = optarg; break;
+          case 'o': prefix = optarg; break;
+          default:  usage(); return 0;
+        }
+    }
+    if (prefix.empty()) {
+        usage();
+        return 0;
+    }
+    if (num_threads == 0) num_threads = 1;
+
+    Vocabulary vocab;
+    if (vocab_in && !vocab.load(vocab_in)) {
+        printf("ERROR: Cannot read vocabulary %s\n", vocab_in);
+        return -1;
+    }
+
+    FILE* fwords = fopen((prefix + ".words").c_str(), "wb");
+    FILE* fsizes = fopen((prefix + ".sizes").c_str(), "wb");
+    if (!fwords || !fsizes) {
+        printf("ERROR: Cannot create output files %s.words/.sizes\n", prefix.c_str());
+        return -1;
+    }
+
+    vector<const char*> inputs(argv+optind, argv+argc);
+    if (inputs.empty()) inputs.push_back(NULL);
+
+    unsigned long total_bytes = 0, total_docs = 0, total_tokens = 0, total_words = 0;
+    high_resolution_clock::time_point t1 = high_resolution_clock::now();
+
+    for (const char* input : inputs)
+    {
+        FILE* f = input ? fopen(input, "rb") : stdin;
+        vector<char> text;
+        if (!f || !readAll(f, text)) {
+            printf("ERROR: Cannot read %s\n", input ? input : "stdin");
+            return -1;
+        }
+        if (input) fclose(f);
+        total_bytes += text.size();
+
+        // Split the input in lines and the lines in batches
+        vector<Batch> batches;
+        char* p = text.data();
+        char* end = p + text.size();
+        while (p < end) {
+            if (batches.empty() || batches.back().doc_begin.size() == batch_docs) batches.push_back(Batch());
+            char* nl = (char*)memchr(p, '\n', end-p);
+            if (!nl) nl = end;
+            batches.back().doc_begin.push_back(p);
+            batches.back().doc_end.push_back(nl);
+            p = nl+1;
+        }
+
+        parallelFor(batches.size(), num_threads, [&](size_t i) { tokenizeBatch(batches[i], vocab); });
+
+        for (Batch& b : batches) {
+            b.pending_ids.resize(b.pending.size());
+            for (size_t i = 0; i < b.pending.size(); i++) {
+                const char* str = b.pending[i].first;
+                unsigned len = b.pending[i].second;
+                b.pending_ids[i] = vocab.insert(Vocabulary::hash(str, len), str, len);
+            }
+        }
+
+        parallelFor(batches.size(), num_threads, [&](size_t i) { packBatch(batches[i]); });
+
+        for (Batch& b : batches) {
+            fwrite(b.words.data(), sizeof(unsigned), b.words.size(), fwords);
+            fwrite(b.sizes.data(), sizeof(unsigned), b.sizes.size(), fsizes);
+            total_docs   += b.sizes.size();
+            total_words  += b.words.size();
+            total_tokens += b.num_tokens;
+        }
+    }
+
+    fclose(fwords);
+    fclose(fsizes);
+    if (!vocab.save((prefix + ".vocab").c_str())) {
+        printf("ERROR: Cannot write vocabulary %s.vocab\n", prefix.c_str());
+        return -1;
+    }
+
+    high_resolution_clock::time_point t2 = high_resolution_clock::now();
+    double sec = duration<double>(t2-t1).count();
+
+    printf(" Documents                            | %10lu\n", total_docs);
+    printf(" Tokens                               | %10lu\n", total_tokens);
+    printf(" Packed words (distinct per document) | %10lu\n", total_words);
+    printf(" Vocabulary size                      | %10u\n", vocab.size());
+    printf(" Ingestion time (%2u threads)          | %10.4f ms  ( %.1f MBytes/s )\n", num_threads, 1000*sec, total_bytes/sec/1e6);
+
+    return 0;
+}
@@ -6,11 +6,17 @@
 #include<cmath>
 #include<iostream>
 #include<vector>
+#include<algorithm>
 #include<utility>
 #include<random>
+#include<string>
+#include<cstring>
+#include<unistd.h>
 #include"xcl2.hpp"
 #include"sizes.h"
 #include"common.h"
+#include"score_cache.h"
+#include"packed_corpus.h"
 
 using namespace std;
 using namespace std::chrono;
@@ -19,8 +25,7 @@ using namespace std::chrono;
 vector<unsigned int,aligned_allocator<unsigned int>> input_doc_words;
 vector<unsigned long,aligned_allocator<unsigned long>> profile_weights;
 vector<unsigned int,aligned_allocator<unsigned int>> bloom_filter;
-vector<unsigned int,aligned_allocator<unsigned int>> starting_doc_id;
-vector<unsigned long,aligned_allocator<unsigned long>> fpga_profileScore;
+vector<unsigned long,aligned_allocator<unsigned long>> starting_doc_id;
 vector<unsigned int,aligned_allocator<unsigned int>> doc_sizes;
 vector<unsigned long,aligned_allocator<unsigned long>> cpu_profileScore;
 
@@ -28,7 +33,7 @@ default_random_engine generator;
 normal_distribution<double> distribution(3500,500);
 
 unsigned int total_num_docs;
-unsigned size=0;
+unsigned long size=0;
 unsigned block_size;
 
 unsigned doc_len()
@@ -40,16 +45,17 @@ unsigned doc_len()
 }
 
 
+void setupProfile();
+
 void setupData()
 {
     starting_doc_id.reserve( total_num_docs );
-    fpga_profileScore.reserve( total_num_docs );
     cpu_profileScore.reserve(total_num_docs);
 
     //  h_docInfo.reserve( total_num_docs );
 
     doc_sizes.reserve( total_num_docs );
-    unsigned unpadded_size=0;
+    unsigned long unpadded_size=0;
 
     for (unsigned i=0; i<total_num_docs; i++) {
         unsigned len_doc = doc_len();
@@ -58,22 +64,21 @@ void setupData()
         doc_sizes[i] = len_doc;
     }
     
-    size = unpadded_size&(~(block_size-1));
+    size = unpadded_size&(~((unsigned long)block_size-1));
     if(unpadded_size & (block_size-1)) size+=block_size;
-    bloom_filter.reserve( (1L << bloom_size) );
     input_doc_words.reserve( size );
 
     // double mbytes = size*sizeof(int)/(1000000.0);
 
-    printf("Creating documents - total size : %.3f MBytes (%d words)\n", size*sizeof(int)/1000000.0, size);
+    printf("Creating documents - total size : %.3f MBytes (%lu words)\n", size*sizeof(int)/1000000.0, size);
     // std::cout << "Creating documents of total size = "<< size  << " words" << endl;
 
-    for (unsigned i=0; i<size; i++) {
+    for (unsigned long i=0; i<size; i++) {
         input_doc_words[i] = docTag;
     }
     for (unsigned doci=0; doci < total_num_docs; doci++)
     {
-        unsigned start_dimm1 = starting_doc_id[doci];
+        unsigned long start_dimm1 = starting_doc_id[doci];
         unsigned size_1 = doc_sizes[doci];
         unsigned term;
         unsigned freq;
@@ -86,54 +91,362 @@ void setupData()
         }
     }
 
+    setupProfile();
+}
+
+void setupProfile()
+{
+    bloom_filter.reserve( (1L << bloom_size) );
     profile_weights.reserve( (1L << 24) );
-    for (unsigned i=0; i<(1L << bloom_size); i++) {
-        bloom_filter[i] = 0x0;
-    }
     std::cout << "Creating profile weights" << endl;
     std::cout << endl;
- 
-    for (unsigned i=0; i<(1L << 24); i++) {
-        profile_weights[i] = 0;
+
+    const unsigned num_entries = 16384;
+    vector<unsigned int> entry(num_entries);
+    for (unsigned i=0; i<num_entries; i++) {
+        entry[i] = (rand()%(1<<24));	
     }
+    buildProfile(entry.data(), num_entries, profile_weights.data(), bloom_filter.data());
+}
 
-    for (unsigned i=0; i<16384; i++) {
-        unsigned entry = (rand()%(1<<24));	
+// Load a corpus written by the ingest tool: <prefix>.sizes holds the number of
+// words of each document, <prefix>.words the packed words of all documents
+bool loadData(const char* prefix)
+{
+    string sizes_file = string(prefix) + ".sizes";
+    string words_file = string(prefix) + ".words";
+    FILE* fsizes = fopen(sizes_file.c_str(), "rb");
+    FILE* fwords = fopen(words_file.c_str(), "rb");
+    if (!fsizes || !fwords) {
+        printf("ERROR: Cannot open %s and %s\n", sizes_file.c_str(), words_file.c_str());
+        if (fsizes) fclose(fsizes);
+        if (fwords) fclose(fwords);
+        return false;
+    }
 
-        profile_weights[entry] = 10;
-        unsigned hash_pu = MurmurHash2(&entry,3,1);
-        unsigned hash_lu = MurmurHash2(&entry,3,5);
+    fseek(fsizes, 0, SEEK_END);
+    total_num_docs = ftell(fsizes)/sizeof(unsigned int);
+    rewind(fsizes);
 
-        unsigned hash1 = hash_pu&hash_bloom; 
-        unsigned hash2 = (hash_pu+hash_lu)&hash_bloom;
+    doc_sizes.resize( total_num_docs );
+    starting_doc_id.resize( total_num_docs );
+    cpu_profileScore.resize( total_num_docs );
+    if (fread(doc_sizes.data(), sizeof(unsigned int), total_num_docs, fsizes) != total_num_docs) {
+        printf("ERROR: Cannot read %s\n", sizes_file.c_str());
+        fclose(fsizes);
+        fclose(fwords);
+        return false;
+    }
 
-        bloom_filter[ hash1 >> 5 ] |= 1 << (hash1 & 0x1f);
-        bloom_filter[ hash2 >> 5 ] |= 1 << (hash2 & 0x1f);
+    unsigned long unpadded_size=0;
+    for (unsigned i=0; i<total_num_docs; i++) {
+        starting_doc_id[i] = unpadded_size;
+        unpadded_size+=doc_sizes[i];
     }
 
+    size = unpadded_size&(~((unsigned long)block_size-1));
+    if(unpadded_size & (block_size-1)) size+=block_size;
+    input_doc_words.resize( size, docTag );
+
+    printf("Loading documents - total size : %.3f MBytes (%lu words, %u documents)\n", size*sizeof(int)/1000000.0, size, total_num_docs);
+
+    if (fread(input_doc_words.data(), sizeof(unsigned int), unpadded_size, fwords) != unpadded_size) {
+        printf("ERROR: Cannot read %lu words from %s\n", unpadded_size, words_file.c_str());
+        fclose(fsizes);
+        fclose(fwords);
+        return false;
+    }
+    fclose(fsizes);
+    fclose(fwords);
+
+    setupProfile();
+    return true;
+}
+
+// Compares the scores of an engine with the runOnCPU ones
+bool verifyScores(const unsigned long* scores, const char* engine)
+{
+    for (unsigned doci = 0; doci < total_num_docs; doci++)
+    {
+        if (cpu_profileScore[doci] != scores[doci]) {
+            std::cout << " Verification: FAILED "<< endl  << " : doc[" << doci << "]" << " score: CPU = " << cpu_profileScore[doci]<< ", " << engine << " = "<< scores[doci] <<  endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Chunked FPGA flow on the CPU backend, num_iter chunks
+bool runBackendPass(int num_iter)
+{
+    vector<unsigned long,aligned_allocator<unsigned long>> fpga_profileScore(total_num_docs);
+
+    runOnFPGA(
+        doc_sizes.data(),
+        input_doc_words.data(),
+        bloom_filter.data(),
+        profile_weights.data(),
+        fpga_profileScore.data(),
+        total_num_docs,
+        size,
+        num_iter) ;
+
+    printf("--------------------------------------------------------------------\n");
+
+    return verifyScores(fpga_profileScore.data(), "CPU backend");
+}
+
+// runOnFPGA with the num_iter of the command line, as the engine of the
+// sharded workers
+static int shard_num_iter;
+
+static void runOnFPGA_shard(
+    unsigned int*  doc_sizes,
+    unsigned int*  input_doc_words,
+    unsigned int*  bloom_filter,
+    unsigned long* profile_weights,
+    unsigned long* profile_score,
+    unsigned int   total_num_docs,
+    unsigned long  total_size)
+{
+    runOnFPGA(doc_sizes, input_doc_words, bloom_filter, profile_weights, profile_score, total_num_docs, total_size, shard_num_iter);
+}
+
+// Workers run runOnCPU, or the FPGA flow on one device each when fpga_workers
+bool runShardedPass(unsigned num_workers, bool fpga_workers, int num_iter)
+{
+    shard_num_iter = num_iter;
+    vector<unsigned long,aligned_allocator<unsigned long>> sharded_profileScore(total_num_docs);
+
+    runSharded(
+        doc_sizes.data(),
+        input_doc_words.data(),
+        bloom_filter.data(),
+        profile_weights.data(),
+        sharded_profileScore.data(),
+        total_num_docs,
+        size,
+        num_workers,
+        fpga_workers ? block_size : 1,
+        fpga_workers ? runOnFPGA_shard : runOnCPU) ;
+
+    printf("--------------------------------------------------------------------\n");
+
+    return verifyScores(sharded_profileScore.data(), "sharded");
+}
+
+// Same corpus in structure-of-arrays layout
+bool runSoAPass()
+{
+    vector<unsigned int,aligned_allocator<unsigned int>> soa_word_ids(size);
+    vector<unsigned char,aligned_allocator<unsigned char>> soa_frequencies(size);
+    vector<unsigned long,aligned_allocator<unsigned long>> soa_profileScore(total_num_docs);
+
+    chrono::high_resolution_clock::time_point t1 = chrono::high_resolution_clock::now();
+    packedToSoA(input_doc_words.data(), soa_word_ids.data(), soa_frequencies.data(), size);
+    chrono::high_resolution_clock::time_point t2 = chrono::high_resolution_clock::now();
+    printf(" Packed to SoA conversion time        | %10.4f ms\n", 1000*chrono::duration<double>(t2-t1).count());
+
+    runOnCPU_SoA(
+        doc_sizes.data(),
+        soa_word_ids.data(),
+        soa_frequencies.data(),
+        bloom_filter.data(),
+        profile_weights.data(),
+        soa_profileScore.data(),
+        total_num_docs,
+        size) ;
+
+    printf("--------------------------------------------------------------------\n");
+
+    return verifyScores(soa_profileScore.data(), "SoA");
+}
+
+// Score cache: the first pass only hits on duplicate documents, the
+// second pass rescans the same corpus with the cache warm
+bool runCachePasses()
+{
+    ScoreCache cache;
+    const unsigned profile_version = 1;
+    vector<unsigned long,aligned_allocator<unsigned long>> cached_profileScore(total_num_docs);
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        runOnCPU_cached(
+            doc_sizes.data(),
+            input_doc_words.data(),
+            bloom_filter.data(),
+            profile_weights.data(),
+            cached_profileScore.data(),
+            total_num_docs,
+            size,
+            &cache,
+            profile_version) ;
+
+        printf("--------------------------------------------------------------------\n");
+
+        if (!verifyScores(cached_profileScore.data(), "cached")) return false;
+    }
+    return true;
+}
+
+// Words of the documents encoded, decoded and checked at a time
+#define packed_slice_words (1UL << 22)
+
+// Compressed corpus: sort and encode a copy of the documents, decode it
+// with each decoder and score the decoded words. This is done a slice of
+// documents at a time, so only the decoded corpus and one slice of sorted
+// and packed words are held on top of the input.
+bool runPackedPass()
+{
+    unsigned long num_words = 0;
+    for (unsigned doci = 0; doci < total_num_docs; doci++) num_words += doc_sizes[doci];
+
+    vector<unsigned int,aligned_allocator<unsigned int>> decoded_doc_words(size);
+    vector<unsigned int,aligned_allocator<unsigned int>> sorted_words;
+    vector<unsigned int,aligned_allocator<unsigned int>> packed_words;
+
+    const char* decoders[] = { "scalar", "avx2" };
+    const unsigned num_decoders = sizeof(decoders)/sizeof(decoders[0]);
+    double encode_sec = 0;
+    double decode_sec[num_decoders] = { 0, 0 };
+    unsigned long packed_size = 0;
+
+    unsigned long first_word = 0;
+    for (unsigned first_doc = 0; first_word < size; )
+    {
+        unsigned doc = first_doc;
+        unsigned long words = 0;
+        while (doc < total_num_docs && (doc == first_doc || words + doc_sizes[doc] <= packed_slice_words)) {
+            words += doc_sizes[doc++];
+        }
+        // The last slice also covers the padding after the documents
+        unsigned long slice_size = doc < total_num_docs ? words : size - first_word;
+
+        sorted_words.assign(input_doc_words.data() + first_word, input_doc_words.data() + first_word + slice_size);
+        packed_words.resize(packedCorpusBound(words, doc - first_doc));
+
+        chrono::high_resolution_clock::time_point t1 = chrono::high_resolution_clock::now();
+        unsigned long slice_packed = encodeCorpus(doc_sizes.data() + first_doc, sorted_words.data(), doc - first_doc, packed_words.data());
+        chrono::high_resolution_clock::time_point t2 = chrono::high_resolution_clock::now();
+        encode_sec += chrono::duration<double>(t2-t1).count();
+        packed_size += slice_packed;
+
+        unsigned int* decoded = decoded_doc_words.data() + first_word;
+        for (unsigned d = 0; d < num_decoders; d++)
+        {
+            decode_corpus_fn decode = decodeCorpus_impl(decoders[d]);
+            if (!decode) continue;
+            fill(decoded, decoded + slice_size, 0);
+            t1 = chrono::high_resolution_clock::now();
+            decode(packed_words.data(), slice_packed, decoded, slice_size);
+            t2 = chrono::high_resolution_clock::now();
+            decode_sec[d] += chrono::duration<double>(t2-t1).count();
+            if (!equal(decoded, decoded + slice_size, sorted_words.begin())) {
+                printf("--------------------------------------------------------------------\n");
+                std::cout << " Verification: FAILED "<< endl  << " : " << decoders[d] << " decoder output differs from the sorted corpus" << endl;
+                return false;
+            }
+        }
+
+        first_doc = doc;
+        first_word += slice_size;
+    }
+
+    printf(" Corpus encoding time                 | %10.4f ms\n", 1000*encode_sec);
+    printf(" Compression ratio                    | %10.2f     ( %.2f bits per word, %.3f MBytes )\n",
+           (double)num_words/packed_size, 32.0*packed_size/num_words, packed_size*sizeof(int)/1000000.0);
+    for (unsigned d = 0; d < num_decoders; d++)
+    {
+        if (!decodeCorpus_impl(decoders[d])) continue;
+        // A link moving compressed words delivers ratio times more words per second,
+        // as long as the decoder keeps up
+        printf(" Corpus decoding time ( %-6s )      | %10.4f ms   ( %.1f M words/s )\n", decoders[d], 1000*decode_sec[d], num_words/decode_sec[d]/1e6);
+    }
+
+    vector<unsigned long,aligned_allocator<unsigned long>> packed_profileScore(total_num_docs);
+
+    runOnCPU(
+        doc_sizes.data(),
+        decoded_doc_words.data(),
+        bloom_filter.data(),
+        profile_weights.data(),
+        packed_profileScore.data(),
+        total_num_docs,
+        size) ;
+
+    printf("--------------------------------------------------------------------\n");
+
+    return verifyScores(packed_profileScore.data(), "compressed");
 }
 
 int main(int argc, char** argv)
 {
-    int num_iter;
-
-    switch(argc) {
-      case 2: 
-         total_num_docs=atoi(argv[1]);
-         num_iter = 2;
-         break;
-      case 3:
-         total_num_docs=atoi(argv[1]);
-         num_iter = atoi(argv[2]);
-         break;      
-      default:
-         cout << "Incorrect number of arguments"<<endl;
-         return 0;
-    } 
+    int num_iter = 2;
+    const char* corpus = NULL;
+    unsigned num_workers = 0;
+    bool run_backend = false, run_soa = false, run_cache = false, run_packed = false;
+    bool fpga_workers = false;
+
+    // ./host [options] <num_docs> [num_iter] generates random documents,
+    // ./host [options] -f <prefix> [num_iter] loads documents written by the ingest tool.
+    // The corpus is scored by runOnCPU, each option adds a pass checked against it:
+    //   -b          chunked FPGA flow on the CPU backend, num_iter chunks
+    //   -w workers  that many worker processes
+    //   -F          the workers run the FPGA flow on the CPU backend, worker s
+    //               as device s, instead of runOnCPU
+    //   -s          structure-of-arrays layout
+    //   -c          score cache, cold then warm
+    //   -p          compressed corpus
+    // Each pass allocates its own copies of the corpus and frees them when it ends.
+    int opt;
+    while ((opt = getopt(argc, argv, "f:w:Fbscp")) != -1) {
+        switch (opt) {
+          case 'f':
+             corpus = optarg;
+             break;
+          case 'w':
+             num_workers = atoi(optarg);
+             break;
+          case 'F':
+             fpga_workers = true;
+             break;
+          case 'b':
+             run_backend = true;
+             break;
+          case 's':
+             run_soa = true;
+             break;
+          case 'c':
+             run_cache = true;
+             break;
+          case 'p':
+             run_packed = true;
+             break;
+          default:
+             cout << "Incorrect arguments"<<endl;
+             return 0;
+        }
+    }
+
+    int num_args = argc - optind;
+    if (corpus && num_args <= 1) {
+        if (num_args == 1) num_iter = atoi(argv[optind]);
+    } else if (!corpus && (num_args == 1 || num_args == 2)) {
+        total_num_docs = atoi(argv[optind]);
+        if (num_args == 2) num_iter = atoi(argv[optind+1]);
+    } else {
+        cout << "Incorrect number of arguments"<<endl;
+        return 0;
+    }
 
     std::cout << "Initializing data"<< endl;
     block_size = num_iter*64;
-    setupData();
+    if (corpus) {
+        if (!loadData(corpus)) return 1;
+    } else {
+        setupData();
+    }
 
     runOnCPU(
         doc_sizes.data(),
@@ -145,10 +458,18 @@ int main(int argc, char** argv)
         size) ;
     
     printf("--------------------------------------------------------------------\n");
-    
+
+    if (run_backend && !runBackendPass(num_iter)) return 0;
+    if (num_workers && !runShardedPass(num_workers, fpga_workers, num_iter)) return 0;
+    if (run_soa && !runSoAPass()) return 0;
+    if (run_cache && !runCachePasses()) return 0;
+    if (run_packed && !runPackedPass()) return 0;
+
+    if (run_backend || num_workers || run_soa || run_cache || run_packed) {
+        cout << " Verification: PASS" << endl;
+    }
     cout << " Execution COMPLETE" << endl;
     cout << endl;
 
     return 0;
 }
-
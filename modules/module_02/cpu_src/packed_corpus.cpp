@@ -0,0 +1,192 @@
+#include <algorithm>
+#include <cstring>
+
+#include "sizes.h"
+#include "packed_corpus.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PACKED_X86 1
+#endif
+
+using namespace std;
+
+unsigned long packedCorpusBound(unsigned long num_words, unsigned int num_docs)
+{
+	// A block of n words takes at most 2 + (24*(n-1)+31)/32 + (n-1+3)/4 <= n + 3 words
+	unsigned long num_blocks = num_words/packed_block_words + num_docs;
+	return num_words + 3*num_blocks;
+}
+
+static unsigned int bitWidth(unsigned int v)
+{
+	unsigned int b = 0;
+	while (v >> b) b++;
+	return b;
+}
+
+unsigned long encodeCorpus(
+	unsigned int*  doc_sizes,
+	unsigned int*  input_doc_words,
+	unsigned int   total_num_docs,
+	unsigned int*  packed)
+{
+	unsigned long out = 0;
+	unsigned long offset = 0;
+	for (unsigned doc = 0; doc < total_num_docs; doc++) {
+		unsigned int* words = input_doc_words + offset;
+		unsigned int  size  = doc_sizes[doc];
+		offset += size;
+
+		// Sorting the packed words sorts by word_id, ties by frequency
+		sort(words, words + size);
+
+		for (unsigned first = 0; first < size; first += packed_block_words) {
+			unsigned count = min(size - first, (unsigned)packed_block_words);
+
+			unsigned max_delta = 0;
+			for (unsigned i = 1; i < count; i++) {
+				max_delta = max(max_delta, (words[first+i] >> 8) - (words[first+i-1] >> 8));
+			}
+			unsigned bits = bitWidth(max_delta);
+
+			packed[out++] = words[first];
+			packed[out++] = count | (bits << 8);
+
+			unsigned long acc = 0;
+			unsigned avail = 0;
+			for (unsigned i = 1; i < count; i++) {
+				acc |= (unsigned long)((words[first+i] >> 8) - (words[first+i-1] >> 8)) << avail;
+				avail += bits;
+				if (avail >= 32) {
+					packed[out++] = (unsigned int)acc;
+					acc >>= 32;
+					avail -= 32;
+				}
+			}
+			if (avail) packed[out++] = (unsigned int)acc;
+
+			for (unsigned i = 1; i < count; i += 4) {
+				unsigned int f = 0;
+				for (unsigned j = 0; j < 4 && i+j < count; j++) {
+					f |= (words[first+i+j] & 0xff) << (8*j);
+				}
+				packed[out++] = f;
+			}
+		}
+	}
+	return out;
+}
+
+static void decodeCorpus_scalar(
+	const unsigned int* packed,
+	unsigned long       packed_size,
+	unsigned int*       words,
+	unsigned long       total_size)
+{
+	unsigned long in = 0;
+	unsigned long out = 0;
+	while (in < packed_size && out < total_size) {
+		if (packed[in] == docTag) { in++; continue; }
+		unsigned int first = packed[in];
+		unsigned int count = packed[in+1] & 0x7f;
+		unsigned int bits  = (packed[in+1] >> 8) & 0x1f;
+		const unsigned int* deltas = packed + in + 2;
+		const unsigned int* freqs  = deltas + ((count-1)*bits + 31)/32;
+		in = freqs - packed + (count-1+3)/4;
+
+		unsigned int id = first >> 8;
+		unsigned int mask = (1u << bits) - 1;
+		words[out++] = first;
+		for (unsigned i = 0; i < count-1; i++) {
+			unsigned pos = i*bits;
+			unsigned long v = deltas[pos/32];
+			if (pos%32 + bits > 32) v |= (unsigned long)deltas[pos/32+1] << 32;
+			id += (v >> (pos%32)) & mask;
+			words[out++] = (id << 8) | ((freqs[i/4] >> (8*(i%4))) & 0xff);
+		}
+	}
+	while (out < total_size) words[out++] = docTag;
+}
+
+#ifdef PACKED_X86
+
+// 8 deltas per step: gather the 32 bits starting at the byte holding each
+// delta, shift and mask (widths are at most 24 bits so a delta always fits),
+// then prefix sum the deltas on top of the previous word_id
+__attribute__((target("avx2")))
+static void decodeCorpus_avx2(
+	const unsigned int* packed,
+	unsigned long       packed_size,
+	unsigned int*       words,
+	unsigned long       total_size)
+{
+	const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	unsigned long in = 0;
+	unsigned long out = 0;
+	while (in < packed_size && out < total_size) {
+		if (packed[in] == docTag) { in++; continue; }
+		unsigned int first = packed[in];
+		unsigned int count = packed[in+1] & 0x7f;
+		unsigned int bits  = (packed[in+1] >> 8) & 0x1f;
+		const unsigned int* deltas = packed + in + 2;
+		const unsigned int* freqs  = deltas + ((count-1)*bits + 31)/32;
+		const unsigned char* delta_bytes = (const unsigned char*)deltas;
+		const unsigned char* freq_bytes  = (const unsigned char*)freqs;
+		in = freqs - packed + (count-1+3)/4;
+
+		unsigned int id = first >> 8;
+		unsigned int mask = (1u << bits) - 1;
+		words[out++] = first;
+
+		const __m256i vmask = _mm256_set1_epi32(mask);
+		const __m256i vbits = _mm256_set1_epi32(bits);
+		unsigned i = 0;
+		for (; i + 8 <= count-1; i += 8) {
+			__m256i pos   = _mm256_mullo_epi32(_mm256_add_epi32(_mm256_set1_epi32(i), lane), vbits);
+			__m256i v     = _mm256_i32gather_epi32((const int*)delta_bytes, _mm256_srli_epi32(pos, 3), 1);
+			__m256i delta = _mm256_and_si256(_mm256_srlv_epi32(v, _mm256_and_si256(pos, _mm256_set1_epi32(7))), vmask);
+
+			delta = _mm256_add_epi32(delta, _mm256_slli_si256(delta, 4));
+			delta = _mm256_add_epi32(delta, _mm256_slli_si256(delta, 8));
+			__m256i carry = _mm256_shuffle_epi32(delta, 0xff);
+			delta = _mm256_add_epi32(delta, _mm256_permute2x128_si256(carry, carry, 0x08));
+			__m256i ids = _mm256_add_epi32(delta, _mm256_set1_epi32(id));
+
+			__m256i freq = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(freq_bytes + i)));
+			_mm256_storeu_si256((__m256i*)(words + out), _mm256_or_si256(_mm256_slli_epi32(ids, 8), freq));
+			id = _mm256_extract_epi32(ids, 7);
+			out += 8;
+		}
+		for (; i < count-1; i++) {
+			unsigned pos = i*bits;
+			unsigned long v = deltas[pos/32];
+			if (pos%32 + bits > 32) v |= (unsigned long)deltas[pos/32+1] << 32;
+			id += (v >> (pos%32)) & mask;
+			words[out++] = (id << 8) | freq_bytes[i];
+		}
+	}
+	while (out < total_size) words[out++] = docTag;
+}
+
+#endif
+
+decode_corpus_fn decodeCorpus_impl(const char* isa)
+{
+	if (strcmp(isa, "scalar") == 0) return decodeCorpus_scalar;
+#ifdef PACKED_X86
+	__builtin_cpu_init();
+	if (strcmp(isa, "avx2") == 0 && __builtin_cpu_supports("avx2")) return decodeCorpus_avx2;
+#endif
+	return NULL;
+}
+
+void decodeCorpus(
+	const unsigned int* packed,
+	unsigned long       packed_size,
+	unsigned int*       words,
+	unsigned long       total_size)
+{
+	static const decode_corpus_fn fn = decodeCorpus_impl("avx2") ? decodeCorpus_impl("avx2") : decodeCorpus_scalar;
+	fn(packed, packed_size, words, total_size);
+}
@@ -0,0 +1,51 @@
+#include<vector>
+#include<random>
+
+#include"sizes.h"
+#include "common.h"
+
+using namespace std;
+
+void buildProfile (
+    const unsigned int* entries,
+    unsigned int        num_entries,
+    unsigned long*      profile_weights,
+    unsigned int*       bloom_filter)
+{
+    for (unsigned i=0; i<(1L << bloom_size); i++) {
+        bloom_filter[i] = 0x0;
+    }
+    for (unsigned i=0; i<(1L << 24); i++) {
+        profile_weights[i] = 0;
+    }
+
+    vector<unsigned int> entry(entries, entries+num_entries), hash_pu(num_entries), hash_lu(num_entries);
+
+    for (unsigned i=0; i<num_entries; i++) {
+        entry[i] &= (1<<24)-1;
+        profile_weights[entry[i]] = 10;
+    }
+    murmur2_3byte_x2(entry.data(), num_entries, hash_pu.data(), hash_lu.data());
+
+    for (unsigned i=0; i<num_entries; i++) {
+        unsigned hash1 = hash_pu[i]&hash_bloom; 
+        unsigned hash2 = (hash_pu[i]+hash_lu[i])&hash_bloom;
+
+        bloom_filter[ hash1 >> 5 ] |= 1 << (hash1 & 0x1f);
+        bloom_filter[ hash2 >> 5 ] |= 1 << (hash2 & 0x1f);
+    }
+}
+
+void randomProfile (
+    unsigned int   seed,
+    unsigned int   num_entries,
+    unsigned long* profile_weights,
+    unsigned int*  bloom_filter)
+{
+    mt19937 generator(seed);
+    vector<unsigned int> entry(num_entries);
+    for (unsigned i=0; i<num_entries; i++) {
+        entry[i] = generator()%(1<<24);
+    }
+    buildProfile(entry.data(), num_entries, profile_weights, bloom_filter);
+}
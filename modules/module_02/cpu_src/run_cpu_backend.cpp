@@ -0,0 +1,195 @@
+#include<iostream>
+#include<ctime>
+#include<chrono>
+#include<vector>
+#include<algorithm>
+#include<cstdio>
+#include<cstdlib>
+#include<cstring>
+
+#include"xcl2.hpp"
+#include"sizes.h"
+#include "common.h"
+#include "cpu_device.h"
+#include "event_trace.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// CPU backend of runOnFPGA. The commands and wait lists are the ones of the
+// sw_overlap FPGA step: bloom filter load, then per chunk a transfer of the
+// words, a kernel run and a transfer of the flags back, with the scoring of
+// each chunk on the host as soon as its flags are back. The transfers copy
+// between the host buffers and separate device buffers, and the kernel
+// computes the in-hash flags of its chunk (computeInhFlags) on a thread pool,
+// so scheduling and ordering changes can be run at native speed without the
+// Xilinx runtime.
+
+unsigned int fpga_device = 0;
+
+static const unsigned int bloom_filter_words = 1L<<bloom_size;
+
+// Engines of the CPU device
+enum { to_device, compute_unit, to_host, num_engines };
+
+// Words per kernel task, a multiple of 64 like the FPGA bursts
+static const unsigned long kernel_task_words = 64*1024;
+
+// Kernel: flags of total_size words, with the bloom filter kept across calls
+// like the on-chip copy of the FPGA kernel
+static void runKernel(
+    ThreadPool&    compute_units,
+    unsigned char* output_inh_flags,
+    unsigned int*  input_doc_words,
+    unsigned int*  bloom_filter,
+    unsigned long  total_size,
+    bool           load_filter)
+{
+    static vector<unsigned int> bloom_filter_local(bloom_filter_words);
+    if (load_filter) {
+        memcpy(bloom_filter_local.data(), bloom_filter, bloom_filter_words*sizeof(unsigned int));
+    }
+
+    unsigned int num_tasks = (total_size + kernel_task_words - 1)/kernel_task_words;
+    compute_units.parallelFor(num_tasks, [&](unsigned int t) {
+        unsigned long first = t*kernel_task_words;
+        unsigned long count = min(kernel_task_words, total_size - first);
+        computeInhFlags(input_doc_words + first, output_inh_flags + first, bloom_filter_local.data(), count);
+    });
+}
+
+// Times of the commands, for the event trace of the FPGA flow
+static vector<EventTimes> eventTimes(const vector<CpuEvent>& events)
+{
+    vector<EventTimes> times(events.size());
+    for (unsigned i = 0; i < events.size(); i++) {
+        EventTimes e = { events[i].queued(), events[i].submitted(), events[i].started(), events[i].ended() };
+        times[i] = e;
+    }
+    return times;
+}
+
+void runOnFPGA(
+    unsigned int*  doc_sizes,
+    unsigned int*  input_doc_words,
+    unsigned int*  bloom_filter,
+    unsigned long* profile_weights,
+    unsigned long* profile_score,
+    unsigned int   total_num_docs,
+    unsigned long  total_doc_size,
+    int            num_iter)
+{
+    if (total_doc_size%64!=0) {
+        printf("--------------------------------------------------------------------\n");
+        printf("ERROR: The number of words must be a multiple of 64\n");
+        printf("       Total words = %lu\n", total_doc_size);
+        printf("       Skipping CPU backend execution\n");
+        exit(-1);
+    }
+    if (total_doc_size == 0) {
+        // No chunk to run, and no event to time: every document is empty and scores 0
+        fill(profile_score, profile_score + total_num_docs, 0);
+        printf(" CPU backend %u: no words to score\n", fpga_device);
+        return;
+    }
+
+    // Same chunks as the FPGA flow: multiples of 64 words, at most max_iter_size
+    unsigned long words_per_iter = ((total_doc_size + num_iter - 1)/num_iter + 63) & ~63UL;
+    if (words_per_iter > max_iter_size) {
+        words_per_iter = max_iter_size;
+    }
+    int requested_iter = num_iter;
+    num_iter = (total_doc_size + words_per_iter - 1)/words_per_iter;
+
+    // Host and device buffers
+    unsigned char* output_inh_flags = (unsigned char*)aligned_alloc(4096, total_doc_size*sizeof(char));
+    vector<unsigned int,aligned_allocator<unsigned int>>   device_bloom_filter(bloom_filter_words);
+    vector<unsigned int,aligned_allocator<unsigned int>>   device_doc_words(total_doc_size);
+    vector<unsigned char,aligned_allocator<unsigned char>> device_inh_flags(total_doc_size);
+
+    unsigned int num_threads = max(1u, thread::hardware_concurrency());
+    ThreadPool compute_units(num_threads);
+    CpuQueue q(num_engines);
+
+    printf(" CPU backend %u: %d chunks of %.3f MBytes, kernel on %u threads\n", fpga_device, num_iter, words_per_iter*sizeof(int)/1e6, compute_units.size());
+    if (num_iter != requested_iter) {
+        printf(" Using %d chunks instead of %d ( %lu words per chunk )\n", num_iter, requested_iter, words_per_iter);
+    }
+
+    vector<CpuEvent> wordWait;
+    vector<CpuEvent> krnlWait;
+    vector<CpuEvent> flagWait;
+
+    chrono::high_resolution_clock::time_point t1, t2;
+    t1 = chrono::high_resolution_clock::now();
+
+    // Load the bloom filter coefficients
+    CpuEvent buffDone, krnlDone;
+    q.enqueue(to_device, [&]{ memcpy(device_bloom_filter.data(), bloom_filter, bloom_filter_words*sizeof(unsigned int)); }, NULL, &buffDone);
+    wordWait.push_back(buffDone);
+    q.enqueue(compute_unit, [&]{ runKernel(compute_units, NULL, NULL, device_bloom_filter.data(), 0, true); }, &wordWait, &krnlDone);
+    krnlWait.push_back(krnlDone);
+
+    // Transfer, kernel and transfer back of each chunk, with the wait lists of
+    // the FPGA flow: the transfers and kernel runs wait for all the previous
+    // transfers, the flag transfers for all the previous kernel runs
+    for (int i = 0; i < num_iter; i++)
+    {
+        CpuEvent buffDone, krnlDone, flagDone;
+        unsigned long offset = i*words_per_iter;
+        unsigned long words  = min(words_per_iter, total_doc_size-offset);
+        q.enqueue(to_device, [=, &device_doc_words]{
+            memcpy(device_doc_words.data() + offset, input_doc_words + offset, words*sizeof(unsigned int));
+        }, &wordWait, &buffDone);
+        wordWait.push_back(buffDone);
+        q.enqueue(compute_unit, [=, &compute_units, &device_doc_words, &device_inh_flags]{
+            runKernel(compute_units, device_inh_flags.data() + offset, device_doc_words.data() + offset, NULL, words, false);
+        }, &wordWait, &krnlDone);
+        krnlWait.push_back(krnlDone);
+        q.enqueue(to_host, [=, &device_inh_flags]{
+            memcpy(output_inh_flags + offset, device_inh_flags.data() + offset, words*sizeof(char));
+        }, &krnlWait, &flagDone);
+        flagWait.push_back(flagDone);
+    }
+
+    // Score the documents as soon as the flags covering them are back
+    unsigned long available = 0;
+    unsigned int  iter = 0;
+    unsigned long lookups = 0;
+    chrono::duration<double> score_sec(0);
+    vector<HostSpan> host_spans;
+
+    unsigned long n = 0;
+    for (unsigned int doc = 0; doc < total_num_docs; )
+    {
+        flagWait[iter].wait();
+        available = min(available + words_per_iter, total_doc_size);
+        iter++;
+
+        unsigned int  first_doc  = doc;
+        unsigned long first_word = n;
+        while (doc < total_num_docs && n+doc_sizes[doc] <= available) {
+            n += doc_sizes[doc];
+            doc++;
+        }
+
+        chrono::high_resolution_clock::time_point s1 = chrono::high_resolution_clock::now();
+        lookups += scoreDocuments(doc_sizes, input_doc_words, output_inh_flags, profile_weights, profile_score, first_doc, doc-first_doc, first_word);
+        chrono::high_resolution_clock::time_point s2 = chrono::high_resolution_clock::now();
+        score_sec += s2-s1;
+        host_spans.push_back(HostSpan{iter-1, s1, s2});
+    }
+    q.finish();
+
+    t2 = chrono::high_resolution_clock::now();
+    chrono::duration<double> perf_all_sec = chrono::duration_cast<duration<double>>(t2-t1);
+    double perf_device_ms = (flagWait.back().ended() - wordWait.front().queued())/1e6;
+
+    printf(" Executed CPU backend                 | %10.4f ms   ( device %.3f ms )\n", 1000*perf_all_sec.count(), perf_device_ms);
+    printf(" Profile weight lookups               | %10.1f M lookups/s ( %lu lookups )\n", lookups/score_sec.count()/1e6, lookups);
+
+    // Per-event timeline of this run and latency summary
+    writeEventTrace("event_trace.json", eventTimes(wordWait), eventTimes(krnlWait), eventTimes(flagWait), host_spans, t1);
+
+    free(output_inh_flags);
+}
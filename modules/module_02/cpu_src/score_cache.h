@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Bounded cache of document scores keyed by a 64-bit hash of the document's
+// packed words. Entries are tagged with the profile version they were computed
+// for, so a new profile invalidates them without flushing the cache.
+// The table is 4-way set associative with the oldest entry of a set evicted
+// on insert; sets are protected by striped locks so several scoring threads
+// can share one cache.
+class ScoreCache
+{
+public:
+    explicit ScoreCache(unsigned log2_sets = 16);
+
+    bool lookup(unsigned long key, unsigned version, unsigned long& score);
+    void insert(unsigned long key, unsigned version, unsigned long score);
+
+    std::atomic<unsigned long> hits;
+    std::atomic<unsigned long> misses;
+    std::atomic<unsigned long> bytes_skipped;
+
+private:
+    static const unsigned ways = 4;
+    static const unsigned num_locks = 64;
+
+    struct Entry {
+        unsigned long key;
+        unsigned long score;
+        unsigned      version;
+        unsigned      stamp;
+    };
+
+    unsigned           set_mask;
+    std::vector<Entry> entries;
+    std::vector<unsigned> clock;
+    std::unique_ptr<std::mutex[]> locks;
+};
+
+// Hash of the packed words of a document, used as the cache key
+unsigned long docContentHash(const unsigned int* words, unsigned int num_words);
+
+// runOnCPU with the score cache in front: documents whose content hash is
+// cached for profile_version skip both the bloom filter test and the weight
+// accumulation; the others are scored and inserted.
+void runOnCPU_cached (
+    unsigned int*  doc_sizes,
+    unsigned int*  input_doc_words,
+    unsigned int*  bloom_filter,
+    unsigned long* profile_weights,
+    unsigned long* profile_score,
+    unsigned int   total_num_docs,
+    unsigned long  total_size,
+    ScoreCache*    cache,
+    unsigned       profile_version);
@@ -0,0 +1,230 @@
+#include<iostream>
+#include<chrono>
+#include<vector>
+#include<string>
+#include<random>
+#include<thread>
+#include<atomic>
+#include<algorithm>
+#include<cstdio>
+#include<cstdlib>
+#include<cstring>
+#include<cerrno>
+#include<unistd.h>
+#include<sys/socket.h>
+#include<sys/un.h>
+
+#include"xcl2.hpp"
+#include"sizes.h"
+#include"common.h"
+#include"score_protocol.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// Load generator and checker for score_daemon: each connection sends its
+// requests from one thread and reads the replies from another, so several
+// requests are in flight and the daemon can batch them. Scores are checked
+// against a local computation with the same profile.
+//
+//   score_client [-s socket] [-c connections] [-n requests] [-d docs_per_request] [-m]
+
+vector<unsigned long,aligned_allocator<unsigned long>> profile_weights;
+vector<unsigned int,aligned_allocator<unsigned int>>   bloom_filter;
+
+struct ClientRequest {
+    vector<unsigned int,aligned_allocator<unsigned int>>   doc_sizes;
+    vector<unsigned int,aligned_allocator<unsigned int>>   words;
+    vector<unsigned long,aligned_allocator<unsigned long>> expected;
+    chrono::steady_clock::time_point sent;
+    double latency_us;
+};
+
+static bool readFull(int fd, void* buf, size_t n)
+{
+    char* p = (char*)buf;
+    while (n) {
+        ssize_t r = read(fd, p, n);
+        if (r <= 0) return false;
+        p += r;
+        n -= r;
+    }
+    return true;
+}
+
+static bool writeFull(int fd, const void* buf, size_t n)
+{
+    const char* p = (const char*)buf;
+    while (n) {
+        ssize_t r = write(fd, p, n);
+        if (r <= 0) return false;
+        p += r;
+        n -= r;
+    }
+    return true;
+}
+
+static int connectTo(const string& socket_path)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path)-1);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        printf("--------------------------------------------------------------------\n");
+        printf("ERROR: Cannot connect to %s: %s\n", socket_path.c_str(), strerror(errno));
+        printf("--------------------------------------------------------------------\n");
+        exit(-1);
+    }
+    return fd;
+}
+
+// Random documents as in the host, with the expected scores computed locally
+static void createRequest(ClientRequest& req, unsigned num_docs, mt19937& generator)
+{
+    normal_distribution<double> distribution(3500,500);
+    unsigned long size = 0;
+    req.doc_sizes.resize(num_docs);
+    for (unsigned d = 0; d < num_docs; d++) {
+        double len = distribution(generator);
+        req.doc_sizes[d] = len < 100 ? 100 : (unsigned)len;
+        size += req.doc_sizes[d];
+    }
+    req.words.resize(size);
+    req.latency_us = 0;
+    for (unsigned long i = 0; i < size; i++) {
+        unsigned term = generator()%((1L << 24)-1);
+        unsigned freq = (generator()%254)+1;
+        req.words[i] = (term << 8) | freq;
+    }
+
+    vector<unsigned char> inh_flags(size);
+    req.expected.resize(num_docs);
+    computeInhFlags(req.words.data(), inh_flags.data(), bloom_filter.data(), size);
+    scoreDocuments(req.doc_sizes.data(), req.words.data(), inh_flags.data(), profile_weights.data(), req.expected.data(), 0, num_docs, 0);
+}
+
+static void runConnection(const string& socket_path, vector<ClientRequest>* requests, atomic<unsigned long>* failures)
+{
+    int fd = connectTo(socket_path);
+
+    thread sender([&]{
+        for (unsigned r = 0; r < requests->size(); r++) {
+            ClientRequest& req = (*requests)[r];
+            ScoreRequestHeader hdr = { SCORE_MAGIC, SCORE_REQUEST_SCORE, (uint32_t)req.doc_sizes.size(), 0, req.words.size() };
+            req.sent = chrono::steady_clock::now();
+            if (!writeFull(fd, &hdr, sizeof(hdr)) ||
+                !writeFull(fd, req.doc_sizes.data(), req.doc_sizes.size()*sizeof(unsigned int)) ||
+                !writeFull(fd, req.words.data(), req.words.size()*sizeof(unsigned int))) {
+                break;
+            }
+        }
+    });
+
+    for (unsigned r = 0; r < requests->size(); r++) {
+        ClientRequest& req = (*requests)[r];
+        ScoreReplyHeader rep;
+        vector<unsigned long> scores(req.doc_sizes.size());
+        if (!readFull(fd, &rep, sizeof(rep)) || rep.status != SCORE_STATUS_OK || rep.num_docs != scores.size() ||
+            !readFull(fd, scores.data(), scores.size()*sizeof(unsigned long))) {
+            (*failures) += requests->size() - r;
+            break;
+        }
+        req.latency_us = chrono::duration<double, micro>(chrono::steady_clock::now() - req.sent).count();
+        if (!equal(scores.begin(), scores.end(), req.expected.begin())) {
+            (*failures)++;
+        }
+    }
+
+    sender.join();
+    close(fd);
+}
+
+static string fetchMetrics(const string& socket_path)
+{
+    int fd = connectTo(socket_path);
+    ScoreRequestHeader hdr = { SCORE_MAGIC, SCORE_REQUEST_METRICS, 0, 0, 0 };
+    ScoreReplyHeader rep;
+    string text;
+    if (writeFull(fd, &hdr, sizeof(hdr)) && readFull(fd, &rep, sizeof(rep)) && rep.status == SCORE_STATUS_OK) {
+        text.resize(rep.length);
+        if (!readFull(fd, &text[0], rep.length)) text.clear();
+    }
+    close(fd);
+    return text;
+}
+
+int main(int argc, char** argv)
+{
+    string socket_path = SCORE_DEFAULT_SOCKET;
+    unsigned connections = 4;
+    unsigned num_requests = 64;
+    unsigned docs_per_request = 4;
+    bool show_metrics = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:c:n:d:m")) != -1) {
+        switch (opt) {
+          case 's': socket_path = optarg; break;
+          case 'c': connections = atoi(optarg); break;
+          case 'n': num_requests = atoi(optarg); break;
+          case 'd': docs_per_request = atoi(optarg); break;
+          case 'm': show_metrics = true; break;
+          default:
+             cout << "Usage: score_client [-s socket] [-c connections] [-n requests] [-d docs_per_request] [-m]" << endl;
+             return 0;
+        }
+    }
+
+    printf("Creating profile weights\n");
+    profile_weights.resize(1L << 24);
+    bloom_filter.resize(1L << bloom_size);
+    randomProfile(SCORE_PROFILE_SEED, SCORE_PROFILE_ENTRIES, profile_weights.data(), bloom_filter.data());
+
+    printf("Creating %u requests of %u documents on %u connections\n", num_requests*connections, docs_per_request, connections);
+    vector<vector<ClientRequest>> requests(connections, vector<ClientRequest>(num_requests));
+    for (unsigned c = 0; c < connections; c++) {
+        mt19937 generator(c+1);
+        for (unsigned r = 0; r < num_requests; r++) {
+            createRequest(requests[c][r], docs_per_request, generator);
+        }
+    }
+
+    atomic<unsigned long> failures(0);
+    chrono::high_resolution_clock::time_point t1 = chrono::high_resolution_clock::now();
+    vector<thread> clients;
+    for (unsigned c = 0; c < connections; c++) {
+        clients.push_back(thread(runConnection, socket_path, &requests[c], &failures));
+    }
+    for (unsigned c = 0; c < connections; c++) {
+        clients[c].join();
+    }
+    chrono::high_resolution_clock::time_point t2 = chrono::high_resolution_clock::now();
+    double seconds = chrono::duration<double>(t2-t1).count();
+
+    vector<double> latency;
+    for (unsigned c = 0; c < connections; c++) {
+        for (unsigned r = 0; r < num_requests; r++) {
+            latency.push_back(requests[c][r].latency_us);
+        }
+    }
+    sort(latency.begin(), latency.end());
+
+    printf("--------------------------------------------------------------------\n");
+    printf(" Total time of %6lu requests         | %10.4f ms  ( %.1f documents/s )\n", (unsigned long)latency.size(), 1000*seconds, latency.size()*docs_per_request/seconds);
+    if (!latency.empty()) {
+        printf(" Client latency p50 / p99             | %10.0f / %.0f us\n", latency[latency.size()/2], latency[latency.size()*99/100]);
+    }
+    if (show_metrics) {
+        printf("--------------------------------------------------------------------\n");
+        printf("%s", fetchMetrics(socket_path).c_str());
+    }
+    printf("--------------------------------------------------------------------\n");
+    if (failures) {
+        cout << " Verification: FAILED ( " << failures << " requests )" << endl;
+        return 1;
+    }
+    cout << " Verification: PASS" << endl;
+    return 0;
+}
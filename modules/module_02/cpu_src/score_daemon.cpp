@@ -0,0 +1,469 @@
+#include<iostream>
+#include<chrono>
+#include<vector>
+#include<deque>
+#include<string>
+#include<memory>
+#include<thread>
+#include<mutex>
+#include<condition_variable>
+#include<algorithm>
+#include<cstdio>
+#include<cstdlib>
+#include<cstring>
+#include<csignal>
+#include<cerrno>
+#include<unistd.h>
+#include<poll.h>
+#include<sys/socket.h>
+#include<sys/un.h>
+
+#include"xcl2.hpp"
+#include"sizes.h"
+#include"common.h"
+#include"score_protocol.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// Long-running scoring service: reads document batches from clients over a
+// Unix-domain socket, groups small requests into micro-batches of about
+// batch_words words and scores each micro-batch with one engine call. The
+// profile and bloom filter stay resident for the lifetime of the daemon.
+// The engine is the CPU one, or with -e fpga the ScoringPipeline of
+// reference_files, which keeps the FPGA binary and bloom filter loaded too
+// (only in the build of ../makefile, make score_daemon).
+//
+//   score_daemon [-s socket] [-e cpu|fpga] [-b batch_words] [-l linger_us] [-q max_queued_words]
+
+typedef chrono::steady_clock::time_point time_point_t;
+
+struct Connection {
+    int   fd;
+    mutex write_lock;
+    Connection(int fd) : fd(fd) {}
+    ~Connection() { close(fd); }
+};
+
+struct Request {
+    shared_ptr<Connection> conn;
+    unsigned int           type;
+    vector<unsigned int>   doc_sizes;
+    vector<unsigned int>   words;
+    time_point_t           arrival;
+};
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void onSignal(int)
+{
+    stop_requested = 1;
+}
+
+static bool readFull(int fd, void* buf, size_t n)
+{
+    char* p = (char*)buf;
+    while (n) {
+        ssize_t r = read(fd, p, n);
+        if (r <= 0) return false;
+        p += r;
+        n -= r;
+    }
+    return true;
+}
+
+static bool writeFull(int fd, const void* buf, size_t n)
+{
+    const char* p = (const char*)buf;
+    while (n) {
+        ssize_t r = write(fd, p, n);
+        if (r <= 0) return false;
+        p += r;
+        n -= r;
+    }
+    return true;
+}
+
+// CPU engine: same computation as runOnCPU without the timing report
+static void scoreOnCPU(
+    unsigned int*  doc_sizes,
+    unsigned int*  input_doc_words,
+    unsigned int*  bloom_filter,
+    unsigned long* profile_weights,
+    unsigned long* profile_score,
+    unsigned int   total_num_docs,
+    unsigned long  total_size)
+{
+    unsigned char* inh_flags = (unsigned char*)aligned_alloc(4096, (total_size + 4095) & ~4095UL);
+    computeInhFlags(input_doc_words, inh_flags, bloom_filter, total_size);
+    scoreDocuments(doc_sizes, input_doc_words, inh_flags, profile_weights, profile_score, 0, total_num_docs, 0);
+    free(inh_flags);
+}
+
+#ifdef SCORE_FPGA_ENGINE
+// Resident FPGA engine, reference_files/score_engine_fpga.cpp
+void scoreOnFPGAPipeline(
+    unsigned int*  doc_sizes,
+    unsigned int*  input_doc_words,
+    unsigned int*  bloom_filter,
+    unsigned long* profile_weights,
+    unsigned long* profile_score,
+    unsigned int   total_num_docs,
+    unsigned long  total_size);
+#endif
+
+// Request latencies are kept in a log-linear histogram: the values below 8 us
+// have a bucket each, then every power of two is split into 8 buckets, so a
+// bucket is at most 1/8 of its lower bound wide
+static const unsigned int latency_buckets = 8 + 8*30;
+
+static unsigned int latencyBucket(unsigned long us)
+{
+    if (us < 8) return us;
+    us = min(us, 0xffffffffUL);
+    unsigned int e = 63 - __builtin_clzl(us);    // 2^e <= us < 2^(e+1)
+    return (e - 2)*8 + ((us >> (e - 3)) & 7);
+}
+
+static unsigned long latencyBucketLow(unsigned int bucket)
+{
+    if (bucket < 8) return bucket;
+    return (8UL + bucket%8) << (bucket/8 - 1);
+}
+
+static unsigned long latencyBucketWidth(unsigned int bucket)
+{
+    if (bucket < 8) return 1;
+    return 1UL << (bucket/8 - 1);
+}
+
+class ScoreDaemon
+{
+public:
+    ScoreDaemon(score_engine_fn engine, unsigned long batch_words, unsigned long linger_us, unsigned long max_queued_words)
+        : engine(engine), batch_words(batch_words), linger(linger_us), max_queued_words(max_queued_words),
+          queued_words(0), max_queue_depth(0), stopping(false),
+          requests(0), docs(0), batches(0), batch_words_total(0), engine_sec(0), latency_max_us(0)
+    {
+        profile_weights.resize(1L << 24);
+        bloom_filter.resize(1L << bloom_size);
+        randomProfile(SCORE_PROFILE_SEED, SCORE_PROFILE_ENTRIES, profile_weights.data(), bloom_filter.data());
+        for (unsigned i = 0; i < latency_buckets; i++) latency_hist[i] = 0;
+
+        // An empty call lets a resident engine load before the first request
+        engine(NULL, NULL, bloom_filter.data(), profile_weights.data(), NULL, 0, 0);
+    }
+
+    void serve(int listen_fd);
+    string metrics();
+
+private:
+    void readLoop(shared_ptr<Connection> conn);
+    void batchLoop();
+    void runBatch(vector<Request*>& batch);
+    void reply(Request* req, const unsigned long* scores);
+
+    score_engine_fn  engine;
+    unsigned long    batch_words;
+    microseconds     linger;
+    unsigned long    max_queued_words;
+
+    vector<unsigned long,aligned_allocator<unsigned long>> profile_weights;
+    vector<unsigned int,aligned_allocator<unsigned int>>   bloom_filter;
+
+    mutex                   lock;
+    condition_variable      queued;   // request added or daemon stopping
+    condition_variable      room;     // queued words released
+    deque<Request*>         queue;
+    unsigned long           queued_words;
+    unsigned long           max_queue_depth;
+    bool                    stopping;
+
+    // Metrics, protected by lock
+    unsigned long           requests;
+    unsigned long           docs;
+    unsigned long           batches;
+    unsigned long           batch_words_total;
+    double                  engine_sec;
+    unsigned long           latency_hist[latency_buckets];  // see latencyBucket
+    unsigned long           latency_max_us;
+};
+
+void ScoreDaemon::serve(int listen_fd)
+{
+    thread batcher(&ScoreDaemon::batchLoop, this);
+
+    while (!stop_requested) {
+        struct pollfd pfd = { listen_fd, POLLIN, 0 };
+        if (poll(&pfd, 1, 200) <= 0) continue;
+
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) continue;
+        // Readers blocked on idle clients are not waited for on shutdown
+        thread(&ScoreDaemon::readLoop, this, make_shared<Connection>(fd)).detach();
+    }
+
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    queued.notify_all();
+    room.notify_all();
+    batcher.join();
+}
+
+// One thread per client: parses requests and queues them for the batcher.
+// Blocks when the queue holds max_queued_words, which stops reading from the
+// socket and pushes back on the client.
+void ScoreDaemon::readLoop(shared_ptr<Connection> conn)
+{
+    while (true) {
+        ScoreRequestHeader hdr;
+        if (!readFull(conn->fd, &hdr, sizeof(hdr))) break;
+
+        bool valid = hdr.magic == SCORE_MAGIC &&
+                     (hdr.type == SCORE_REQUEST_SCORE || hdr.type == SCORE_REQUEST_METRICS) &&
+                     hdr.num_words <= max_iter_size && hdr.num_docs <= hdr.num_words;
+
+        Request* req = new Request;
+        req->conn = conn;
+        req->type = hdr.type;
+        if (valid && hdr.type == SCORE_REQUEST_SCORE) {
+            req->doc_sizes.resize(hdr.num_docs);
+            req->words.resize(hdr.num_words);
+            if (!readFull(conn->fd, req->doc_sizes.data(), hdr.num_docs*sizeof(unsigned int)) ||
+                !readFull(conn->fd, req->words.data(), hdr.num_words*sizeof(unsigned int))) {
+                delete req;
+                break;
+            }
+            unsigned long total = 0;
+            for (unsigned i = 0; i < hdr.num_docs; i++) total += req->doc_sizes[i];
+            valid = (total == hdr.num_words);
+        }
+        if (!valid) {
+            // The stream cannot be resynchronised after a bad request
+            ScoreReplyHeader rep = { SCORE_MAGIC, SCORE_STATUS_INVALID, 0, 0 };
+            lock_guard<mutex> guard(conn->write_lock);
+            writeFull(conn->fd, &rep, sizeof(rep));
+            delete req;
+            break;
+        }
+        req->arrival = chrono::steady_clock::now();
+
+        unique_lock<mutex> guard(lock);
+        room.wait(guard, [&]{ return stopping || queue.empty() || queued_words + req->words.size() <= max_queued_words; });
+        if (stopping) {
+            delete req;
+            break;
+        }
+        queue.push_back(req);
+        queued_words += req->words.size();
+        if (queue.size() > max_queue_depth) max_queue_depth = queue.size();
+        queued.notify_all();
+    }
+}
+
+// Takes the oldest request and waits up to linger for more, until batch_words
+// are queued, then scores everything taken as one batch
+void ScoreDaemon::batchLoop()
+{
+    unique_lock<mutex> guard(lock);
+    while (true) {
+        queued.wait(guard, [&]{ return stopping || !queue.empty(); });
+        if (queue.empty()) break;
+
+        time_point_t deadline = queue.front()->arrival + linger;
+        queued.wait_until(guard, deadline, [&]{ return stopping || queued_words >= batch_words; });
+
+        vector<Request*> batch;
+        unsigned long words = 0;
+        while (!queue.empty() && (batch.empty() || words + queue.front()->words.size() <= batch_words)) {
+            words += queue.front()->words.size();
+            batch.push_back(queue.front());
+            queue.pop_front();
+        }
+        queued_words -= words;
+        room.notify_all();
+
+        guard.unlock();
+        runBatch(batch);
+        guard.lock();
+    }
+}
+
+void ScoreDaemon::runBatch(vector<Request*>& batch)
+{
+    // Concatenate the requests into one corpus padded to a multiple of 64 words
+    unsigned long num_words = 0;
+    unsigned int  num_docs = 0;
+    for (unsigned r = 0; r < batch.size(); r++) {
+        num_words += batch[r]->words.size();
+        num_docs += batch[r]->doc_sizes.size();
+    }
+
+    vector<unsigned int,aligned_allocator<unsigned int>>   doc_sizes(num_docs);
+    vector<unsigned int,aligned_allocator<unsigned int>>   words((num_words + 63) & ~63UL, docTag);
+    vector<unsigned long,aligned_allocator<unsigned long>> scores(num_docs);
+
+    unsigned long w = 0;
+    unsigned int  d = 0;
+    for (unsigned r = 0; r < batch.size(); r++) {
+        copy(batch[r]->doc_sizes.begin(), batch[r]->doc_sizes.end(), &doc_sizes[d]);
+        copy(batch[r]->words.begin(), batch[r]->words.end(), &words[w]);
+        d += batch[r]->doc_sizes.size();
+        w += batch[r]->words.size();
+    }
+
+    time_point_t t1 = chrono::steady_clock::now();
+    if (num_docs) {
+        engine(doc_sizes.data(), words.data(), bloom_filter.data(), profile_weights.data(), scores.data(), num_docs, words.size());
+    }
+    time_point_t t2 = chrono::steady_clock::now();
+
+    {
+        lock_guard<mutex> guard(lock);
+        batches++;
+        batch_words_total += num_words;
+        engine_sec += chrono::duration<double>(t2-t1).count();
+    }
+
+    d = 0;
+    for (unsigned r = 0; r < batch.size(); r++) {
+        reply(batch[r], &scores[d]);
+        d += batch[r]->doc_sizes.size();
+        delete batch[r];
+    }
+}
+
+void ScoreDaemon::reply(Request* req, const unsigned long* scores)
+{
+    if (req->type == SCORE_REQUEST_METRICS) {
+        string text = metrics();
+        ScoreReplyHeader rep = { SCORE_MAGIC, SCORE_STATUS_OK, 0, (uint32_t)text.size() };
+        lock_guard<mutex> guard(req->conn->write_lock);
+        writeFull(req->conn->fd, &rep, sizeof(rep));
+        writeFull(req->conn->fd, text.data(), text.size());
+        return;
+    }
+
+    ScoreReplyHeader rep = { SCORE_MAGIC, SCORE_STATUS_OK, (uint32_t)req->doc_sizes.size(), 0 };
+    {
+        lock_guard<mutex> guard(req->conn->write_lock);
+        writeFull(req->conn->fd, &rep, sizeof(rep));
+        writeFull(req->conn->fd, scores, req->doc_sizes.size()*sizeof(unsigned long));
+    }
+
+    unsigned long us = chrono::duration_cast<microseconds>(chrono::steady_clock::now() - req->arrival).count();
+
+    lock_guard<mutex> guard(lock);
+    requests++;
+    docs += req->doc_sizes.size();
+    latency_hist[latencyBucket(us)]++;
+    if (us > latency_max_us) latency_max_us = us;
+}
+
+string ScoreDaemon::metrics()
+{
+    lock_guard<mutex> guard(lock);
+
+    // Percentiles are interpolated linearly within their histogram bucket
+    unsigned long pct[3] = { 0, 0, 0 };
+    const double  pct_rank[3] = { 0.50, 0.90, 0.99 };
+    for (int p = 0; p < 3; p++) {
+        double rank = pct_rank[p]*requests;
+        unsigned long seen = 0;
+        for (unsigned i = 0; requests && i < latency_buckets; i++) {
+            if (latency_hist[i] && seen + latency_hist[i] >= rank) {
+                double value = latencyBucketLow(i) + latencyBucketWidth(i)*(rank - seen)/latency_hist[i];
+                pct[p] = min((unsigned long)(value + 0.5), latency_max_us);
+                break;
+            }
+            seen += latency_hist[i];
+        }
+    }
+
+    char text[1024];
+    snprintf(text, sizeof(text),
+        " Queue depth                          | %10lu requests ( %lu words, max %lu requests )\n"
+        " Requests served                      | %10lu requests ( %lu documents )\n"
+        " Micro-batches                        | %10lu batches  ( %.1f requests, %.0f words per batch )\n"
+        " Engine time                          | %10.4f ms\n"
+        " Request latency p50 / p90 / p99      | %10lu / %lu / %lu us ( max %lu us )\n",
+        (unsigned long)queue.size(), queued_words, max_queue_depth,
+        requests, docs,
+        batches, batches ? (double)requests/batches : 0.0, batches ? (double)batch_words_total/batches : 0.0,
+        1000*engine_sec,
+        pct[0], pct[1], pct[2], latency_max_us);
+    return text;
+}
+
+int main(int argc, char** argv)
+{
+    string socket_path = SCORE_DEFAULT_SOCKET;
+    unsigned long batch_words = 1L << 20;
+    unsigned long linger_us = 2000;
+    unsigned long max_queued_words = 1L << 24;
+    string engine_name = "cpu";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:e:b:l:q:")) != -1) {
+        switch (opt) {
+          case 's': socket_path = optarg; break;
+          case 'e': engine_name = optarg; break;
+          case 'b': batch_words = strtoul(optarg, NULL, 0); break;
+          case 'l': linger_us = strtoul(optarg, NULL, 0); break;
+          case 'q': max_queued_words = strtoul(optarg, NULL, 0); break;
+          default:
+             cout << "Usage: score_daemon [-s socket] [-e cpu|fpga] [-b batch_words] [-l linger_us] [-q max_queued_words]" << endl;
+             return 0;
+        }
+    }
+
+    score_engine_fn engine = NULL;
+    if (engine_name == "cpu") engine = scoreOnCPU;
+#ifdef SCORE_FPGA_ENGINE
+    if (engine_name == "fpga") engine = scoreOnFPGAPipeline;
+#endif
+    if (!engine) {
+        printf("--------------------------------------------------------------------\n");
+        printf("ERROR: Unknown scoring engine %s\n", engine_name.c_str());
+#ifndef SCORE_FPGA_ENGINE
+        if (engine_name == "fpga") printf("       The FPGA engine is built by make score_daemon in ../makefile\n");
+#endif
+        printf("--------------------------------------------------------------------\n");
+        return 1;
+    }
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    signal(SIGPIPE, SIG_IGN);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path)-1);
+    unlink(socket_path.c_str());
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(listen_fd, 64) < 0) {
+        printf("--------------------------------------------------------------------\n");
+        printf("ERROR: Cannot listen on %s: %s\n", socket_path.c_str(), strerror(errno));
+        printf("--------------------------------------------------------------------\n");
+        exit(-1);
+    }
+
+    printf("Creating profile weights\n");
+    ScoreDaemon daemon(engine, batch_words, linger_us, max_queued_words);
+
+    printf(" Scoring daemon listening on %s ( %s engine, %lu words per batch, %lu us linger )\n",
+           socket_path.c_str(), engine == scoreOnCPU ? "CPU" : "FPGA", batch_words, linger_us);
+    fflush(stdout);
+
+    daemon.serve(listen_fd);
+
+    close(listen_fd);
+    unlink(socket_path.c_str());
+
+    printf("--------------------------------------------------------------------\n");
+    printf("%s", daemon.metrics().c_str());
+    return 0;
+}
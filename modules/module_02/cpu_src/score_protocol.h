@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+
+// Wire format of the scoring daemon (Unix-domain stream socket, host byte order).
+//
+// Score request : ScoreRequestHeader, num_docs uint32 document sizes, then
+//                 num_words uint32 packed words ((word_id<<8)|freq), with
+//                 num_words equal to the sum of the document sizes.
+// Score reply   : ScoreReplyHeader, then num_docs uint64 scores.
+// Metrics reply : ScoreReplyHeader, then length bytes of text.
+//
+// Requests on one connection are answered in order.
+
+#define SCORE_MAGIC           0x45524f43u  // "CORE"
+#define SCORE_REQUEST_SCORE   0
+#define SCORE_REQUEST_METRICS 1
+
+#define SCORE_STATUS_OK       0
+#define SCORE_STATUS_INVALID  1
+
+#define SCORE_DEFAULT_SOCKET  "/tmp/score_daemon.sock"
+
+struct ScoreRequestHeader {
+    uint32_t magic;
+    uint32_t type;
+    uint32_t num_docs;
+    uint32_t reserved;
+    uint64_t num_words;
+};
+
+struct ScoreReplyHeader {
+    uint32_t magic;
+    uint32_t status;
+    uint32_t num_docs;
+    uint32_t length;
+};
+
+// Profile shared by the daemon and the test client (see randomProfile)
+#define SCORE_PROFILE_SEED    1
+#define SCORE_PROFILE_ENTRIES 16384
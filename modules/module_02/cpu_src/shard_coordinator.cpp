@@ -0,0 +1,162 @@
+#include<iostream>
+#include<ctime>
+#include<chrono>
+#include<vector>
+#include<utility>
+#include<cstdio>
+#include<cstdlib>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/wait.h>
+
+#include"xcl2.hpp"
+#include"sizes.h"
+#include "common.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// Splits the corpus on document boundaries into num_workers shards of about
+// the same number of words. shard_doc[s] is the first document of shard s.
+static void planShards(
+    unsigned int*  doc_sizes,
+    unsigned int   total_num_docs,
+    unsigned long  words,
+    unsigned int   num_workers,
+    vector<unsigned int>&  shard_doc,
+    vector<unsigned long>& shard_word)
+{
+    shard_doc.assign(num_workers+1, total_num_docs);
+    shard_word.assign(num_workers+1, words);
+    shard_doc[0] = 0;
+    shard_word[0] = 0;
+
+    unsigned int  doc = 0;
+    unsigned long offset = 0;
+    for (unsigned s = 1; s < num_workers; s++) {
+        unsigned long target = words*s/num_workers;
+        while (doc < total_num_docs && offset + doc_sizes[doc] <= target) {
+            offset += doc_sizes[doc];
+            doc++;
+        }
+        shard_doc[s] = doc;
+        shard_word[s] = offset;
+    }
+}
+
+// Body of a worker process: scores its shard into the shared score array.
+// The shard is copied and padded with docTag to a multiple of pad_words when
+// the engine needs it (runOnFPGA works on whole blocks).
+static int runWorker(
+    unsigned int*  doc_sizes,
+    unsigned int*  input_doc_words,
+    unsigned int*  bloom_filter,
+    unsigned long* profile_weights,
+    unsigned long* shared_score,
+    unsigned int   first_doc,
+    unsigned int   num_docs,
+    unsigned long  word_offset,
+    unsigned long  num_words,
+    unsigned int   pad_words,
+    score_engine_fn engine)
+{
+    unsigned long padded = num_words;
+    if (pad_words > 1 && (num_words % pad_words)) padded += pad_words - num_words % pad_words;
+
+    if (padded == num_words) {
+        engine(&doc_sizes[first_doc], &input_doc_words[word_offset], bloom_filter, profile_weights,
+               &shared_score[first_doc], num_docs, num_words);
+    } else {
+        vector<unsigned int,aligned_allocator<unsigned int>> words(padded, docTag);
+        copy(&input_doc_words[word_offset], &input_doc_words[word_offset+num_words], words.begin());
+        engine(&doc_sizes[first_doc], words.data(), bloom_filter, profile_weights,
+               &shared_score[first_doc], num_docs, padded);
+    }
+    return 0;
+}
+
+void runSharded (
+    unsigned int*  doc_sizes,
+    unsigned int*  input_doc_words,
+    unsigned int*  bloom_filter,
+    unsigned long* profile_weights,
+    unsigned long* profile_score,
+    unsigned int   total_num_docs,
+    unsigned long  total_size,
+    unsigned int   num_workers,
+    unsigned int   pad_words,
+    score_engine_fn engine)
+{
+    chrono::high_resolution_clock::time_point t1 = chrono::high_resolution_clock::now();
+
+    unsigned long words = 0;
+    for (unsigned int doc = 0; doc < total_num_docs; doc++) {
+        words += doc_sizes[doc];
+    }
+    if (num_workers > total_num_docs) num_workers = total_num_docs;
+    if (num_workers == 0) num_workers = 1;
+
+    vector<unsigned int>  shard_doc;
+    vector<unsigned long> shard_word;
+    planShards(doc_sizes, total_num_docs, words, num_workers, shard_doc, shard_word);
+
+    // Workers write the scores of their documents straight into this mapping;
+    // shards do not overlap so no further synchronisation is needed
+    size_t score_bytes = (total_num_docs ? total_num_docs : 1)*sizeof(unsigned long);
+    unsigned long* shared_score = (unsigned long*)mmap(NULL, score_bytes, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    if (shared_score == MAP_FAILED) {
+        printf("--------------------------------------------------------------------\n");
+        printf("ERROR: Cannot map %lu bytes of shared memory for the scores\n", (unsigned long)score_bytes);
+        printf("--------------------------------------------------------------------\n");
+        exit(-1);
+    }
+
+    // Anything still buffered would be printed again by every worker
+    fflush(stdout);
+
+    vector<pid_t> workers(num_workers);
+    for (unsigned s = 0; s < num_workers; s++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            printf("--------------------------------------------------------------------\n");
+            printf("ERROR: Cannot start worker %u\n", s);
+            printf("--------------------------------------------------------------------\n");
+            exit(-1);
+        }
+        if (pid == 0) {
+            fpga_device = s;
+            int status = runWorker(doc_sizes, input_doc_words, bloom_filter, profile_weights, shared_score,
+                                   shard_doc[s], shard_doc[s+1]-shard_doc[s], shard_word[s], shard_word[s+1]-shard_word[s],
+                                   pad_words, engine);
+            fflush(stdout);
+            _exit(status);
+        }
+        workers[s] = pid;
+    }
+
+    bool failed = false;
+    for (unsigned s = 0; s < num_workers; s++) {
+        int status;
+        if (waitpid(workers[s], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            printf("ERROR: Worker %u (documents %u to %u) failed\n", s, shard_doc[s], shard_doc[s+1]);
+            failed = true;
+        }
+    }
+    if (failed) {
+        munmap(shared_score, score_bytes);
+        printf("--------------------------------------------------------------------\n");
+        exit(-1);
+    }
+
+    copy(shared_score, shared_score+total_num_docs, profile_score);
+    munmap(shared_score, score_bytes);
+
+    chrono::high_resolution_clock::time_point t2 = chrono::high_resolution_clock::now();
+    chrono::duration<double> time_span = (t2-t1);
+
+    printf("--------------------------------------------------------------------\n");
+    for (unsigned s = 0; s < num_workers; s++) {
+        printf(" Shard %-3u                            | %10u docs ( %lu words )\n", s, shard_doc[s+1]-shard_doc[s], shard_word[s+1]-shard_word[s]);
+    }
+    printf(" Total execution time of %3u workers  | %10.4f ms\n", num_workers, 1000*time_span.count());
+}
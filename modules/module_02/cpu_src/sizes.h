@@ -4,3 +4,6 @@
 #define bloom_size 14
 #define docTag 0xffffffff
 
+// Maximum number of words processed by one kernel call (1 GByte of words).
+// Keeps the 32-bit total_size kernel argument and each sub-buffer within device limits.
+#define max_iter_size (1UL << 28)
@@ -7,6 +7,24 @@ host: $(SRCDIR)/*.cpp $(SRCDIR)/*.c $(SRCDIR)/*.h
 	-lxilinxopencl -lpthread -lrt \
 	-o $(BUILDDIR)/host
 
+# Scoring daemon of ../cpu_src with the resident FPGA engine (score_daemon -e fpga).
+# Each file takes the headers of its own directory.
+score_daemon: ../cpu_src/*.cpp ../cpu_src/*.h ../reference_files/*.cpp ../reference_files/*.h
+	mkdir -p $(BUILDDIR)
+	g++ -D__USE_XOPEN2K8 -DSCORE_FPGA_ENGINE -I$(XILINX_XRT)/include -O3 -Wall -fmessage-length=0 -std=c++11 -pthread \
+	../cpu_src/score_daemon.cpp \
+	../cpu_src/compute_score_host.cpp \
+	../cpu_src/compute_score_lookup.cpp \
+	../cpu_src/profile.cpp \
+	../cpu_src/MurmurHash2.c \
+	../reference_files/score_engine_fpga.cpp \
+	../reference_files/fpga_pipeline.cpp \
+	../reference_files/fpga_kernels.cpp \
+	../reference_files/xcl2.cpp \
+	-L$(XILINX_XRT)/lib/ \
+	-lxilinxopencl -lpthread -lrt \
+	-o $(BUILDDIR)/score_daemon
+
 emconfig.json:
 	cp $(SRCDIR)/emconfig.json .
 
@@ -15,4 +33,4 @@ xclbin: runOnfpga_$(TARGET).xclbin
 xo: runOnfpga_$(TARGET).xo
 
 clean:
-	rm -rf temp_dir log_dir ../build report_dir *log host *.csv *summary .run .Xil vitis* *jou xilinx*
+	rm -rf temp_dir log_dir ../build report_dir *log host *.csv *summary event_trace.json .run .Xil vitis* *jou xilinx*
@@ -0,0 +1,152 @@
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "xcl2.hpp"
+#include "fpga_kernels.h"
+#include "buffer_pool.h"
+
+using namespace std;
+
+static const unsigned int min_size_class = 16;  // 64 KBytes
+
+static unsigned int sizeClass(size_t bytes)
+{
+	unsigned int c = min_size_class;
+	while (((size_t)1 << c) < bytes) c++;
+	return c;
+}
+
+BufferPool::BufferPool(const cl::Context& context)
+	: context(context), allocations(0), reuses(0), wraps(0), cached_reuses(0), pinned_bytes(0)
+{
+}
+
+BufferPool::~BufferPool()
+{
+	for (unsigned i = 0; i < buffers.size(); i++) {
+		// Release the device buffer before the host memory it uses
+		buffers[i]->buffer = cl::Buffer();
+		free(buffers[i]->host);
+		delete buffers[i];
+	}
+	for (CachedWraps::iterator it = cached_wraps.begin(); it != cached_wraps.end(); ++it) {
+		delete it->second;
+	}
+}
+
+PooledBuffer* BufferPool::acquire(size_t bytes, cl_mem_flags flags)
+{
+	unsigned int c = sizeClass(bytes);
+
+	lock_guard<mutex> guard(lock);
+	for (unsigned int k = c; k <= c+1; k++) {
+		vector<PooledBuffer*>& list = free_buffers[make_pair(k, flags)];
+		if (!list.empty()) {
+			PooledBuffer* pooled = list.back();
+			list.pop_back();
+			reuses++;
+			return pooled;
+		}
+	}
+
+	PooledBuffer* pooled = new PooledBuffer;
+	pooled->capacity   = (size_t)1 << c;
+	pooled->flags      = flags;
+	pooled->size_class = c;
+	pooled->owned      = true;
+	pooled->cached     = false;
+	pooled->host       = aligned_alloc(4096, pooled->capacity);
+	if (!pooled->host) {
+		printf("--------------------------------------------------------------------\n");
+		printf("ERROR: Cannot allocate a buffer of %lu bytes\n", (unsigned long)pooled->capacity);
+		printf("--------------------------------------------------------------------\n");
+		exit(-1);
+	}
+	pooled->buffer = cl::Buffer(context, CL_MEM_USE_HOST_PTR | flags, pooled->capacity, pooled->host);
+	buffers.push_back(pooled);
+	allocations++;
+	pinned_bytes += pooled->capacity;
+	return pooled;
+}
+
+PooledBuffer* BufferPool::wrap(void* host, size_t bytes, cl_mem_flags flags)
+{
+	PooledBuffer* pooled = new PooledBuffer;
+	pooled->capacity   = bytes;
+	pooled->flags      = flags;
+	pooled->size_class = 0;
+	pooled->owned      = false;
+	pooled->cached     = false;
+	pooled->host       = host;
+	pooled->buffer     = cl::Buffer(context, CL_MEM_USE_HOST_PTR | flags, bytes, host);
+
+	lock_guard<mutex> guard(lock);
+	wraps++;
+	return pooled;
+}
+
+PooledBuffer* BufferPool::wrapCached(void* host, size_t bytes, cl_mem_flags flags)
+{
+	lock_guard<mutex> guard(lock);
+	PooledBuffer*& pooled = cached_wraps[make_pair(make_pair(host, bytes), flags)];
+	if (pooled) {
+		cached_reuses++;
+		return pooled;
+	}
+
+	pooled = new PooledBuffer;
+	pooled->capacity   = bytes;
+	pooled->flags      = flags;
+	pooled->size_class = 0;
+	pooled->owned      = false;
+	pooled->cached     = true;
+	pooled->host       = host;
+	pooled->buffer     = cl::Buffer(context, CL_MEM_USE_HOST_PTR | flags, bytes, host);
+	wraps++;
+	return pooled;
+}
+
+void BufferPool::release(PooledBuffer* pooled)
+{
+	if (pooled->cached) return;
+	if (!pooled->owned) {
+		delete pooled;
+		return;
+	}
+	lock_guard<mutex> guard(lock);
+	free_buffers[make_pair(pooled->size_class, pooled->flags)].push_back(pooled);
+}
+
+void BufferPool::printStats() const
+{
+	const char* stats = getenv("POOL_STATS");
+	if (!stats || !*stats || !strcmp(stats, "0")) return;
+
+	lock_guard<mutex> guard(lock);
+	printf(" Buffer pool                        | %10lu allocated, %lu reused, %lu wrapped, %lu wraps reused ( %.3f MBytes pinned )\n",
+		   allocations, reuses, wraps, cached_reuses, pinned_bytes/1e6);
+}
+
+cl::Buffer subBuffer(PooledBuffer* pooled, size_t offset, size_t bytes)
+{
+	cl_buffer_region region = { offset, bytes };
+	return pooled->buffer.createSubBuffer(pooled->flags, CL_BUFFER_CREATE_TYPE_REGION, &region);
+}
+
+FpgaSession& fpgaSession(const string& binary_file)
+{
+	static FpgaSession* session = NULL;
+	if (!session) {
+		vector<cl::Device> devices = xcl::get_xil_devices();
+		session = new FpgaSession;
+		session->device  = selectDevice(devices);
+		session->context = cl::Context(session->device);
+		cl::Program::Binaries bins = xcl::import_binary_file(binary_file);
+		devices.resize(1);
+		session->program = cl::Program(session->context, devices, bins);
+		session->pool    = new BufferPool(session->context);
+	}
+	return *session;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+
+#include "xcl2.hpp"
+
+// Device buffer using page-aligned host memory (CL_MEM_USE_HOST_PTR), either
+// memory of the pool or memory of the caller
+struct PooledBuffer {
+    cl::Buffer    buffer;
+    void*         host;
+    size_t        capacity;
+    cl_mem_flags  flags;
+    unsigned int  size_class;
+    bool          owned;
+    bool          cached;
+};
+
+// Pool of device buffers of one context.
+// acquire() hands out buffers over memory of the pool, in power of two size
+// classes from 64 KBytes: it returns a free buffer of the size class of the
+// request, or of the next one, before allocating and registering a new one,
+// so outputs of corpora of different sizes reuse the same memory. A buffer is
+// often larger than requested: use subBuffer() for transfers of the used part.
+// wrap() registers memory of the caller, which must be page aligned, without
+// copying it; the buffer is dropped by release(), the memory stays the caller's.
+// wrapCached() does the same for memory used by every call, e.g. the bloom
+// filter: the buffer is created by the first call and kept by release(), so
+// the memory must stay valid as long as the pool.
+class BufferPool {
+public:
+    explicit BufferPool(const cl::Context& context);
+    ~BufferPool();
+
+    PooledBuffer* acquire(size_t bytes, cl_mem_flags flags);
+    PooledBuffer* wrap(void* host, size_t bytes, cl_mem_flags flags);
+    PooledBuffer* wrapCached(void* host, size_t bytes, cl_mem_flags flags);
+    void release(PooledBuffer* buffer);
+
+    // Does nothing unless the POOL_STATS environment variable is set
+    void printStats() const;
+
+private:
+    cl::Context context;
+    mutable std::mutex lock;
+    std::map<std::pair<unsigned int, cl_mem_flags>, std::vector<PooledBuffer*>> free_buffers;
+    std::vector<PooledBuffer*> buffers;
+    typedef std::map<std::pair<std::pair<void*, size_t>, cl_mem_flags>, PooledBuffer*> CachedWraps;
+    CachedWraps cached_wraps;
+    unsigned long allocations;
+    unsigned long reuses;
+    unsigned long wraps;
+    unsigned long cached_reuses;
+    size_t pinned_bytes;
+};
+
+// Region [offset, offset+bytes) of a pooled buffer
+cl::Buffer subBuffer(PooledBuffer* pooled, size_t offset, size_t bytes);
+
+// Device, context, program and buffer pool created by the first runOnFPGA call
+// and kept for the whole process
+struct FpgaSession {
+    cl::Device  device;
+    cl::Context context;
+    cl::Program program;
+    BufferPool* pool;
+};
+
+FpgaSession& fpgaSession(const std::string& binary_file);
@@ -0,0 +1,271 @@
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+
+#include "xcl2.hpp"
+#include "sizes.h"
+#include "common.h"
+#include "fpga_pipeline.h"
+#include "fpga_kernels.h"
+
+using namespace std;
+
+static const char* pipeline_kernel_name = "runOnfpga";
+
+ScoringPipeline::ScoringPipeline(
+    unsigned int*  bloom_filter,
+    unsigned long* profile_weights,
+    unsigned long  chunk_words,
+    unsigned int   max_in_flight,
+    unsigned long  max_words_in_flight)
+    : profile_weights(profile_weights),
+      chunk_words(min(max((chunk_words + 63) & ~63UL, 64UL), (unsigned long)max_iter_size)),
+      max_in_flight(max(max_in_flight, 1u)),
+      max_words_in_flight(max_words_in_flight),
+      in_flight(0),
+      words_in_flight(0),
+      stopping(false),
+      filter_loaded(false),
+      total_lookups(0)
+{
+	// Boilerplate code to load the FPGA binary, create the kernel and command queue
+	vector<cl::Device> devices = xcl::get_xil_devices();
+	cl::Device device = selectDevice(devices);
+	context = cl::Context(device);
+	q = cl::CommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE | CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE);
+
+	string run_type = xcl::is_emulation()?(xcl::is_hw_emulation()?"hw_emu":"sw_emu"):"hw";
+	string binary_file = string(pipeline_kernel_name) + "_" + run_type + ".awsxclbin";
+	cl::Program::Binaries bins = xcl::import_binary_file(binary_file);
+	program = cl::Program(context, devices, bins);
+	kernel = cl::Kernel(program, selectKernel(program).c_str(), NULL);
+
+	// The bloom filter coefficients are loaded with the first corpus
+	buffer_bloom_filter = cl::Buffer(context, CL_MEM_USE_HOST_PTR | CL_MEM_READ_ONLY, (1L<<bloom_size)*sizeof(uint), bloom_filter);
+	kernel.setArg(2, buffer_bloom_filter);
+
+	device_thread = thread(&ScoringPipeline::deviceLoop, this);
+	score_thread = thread(&ScoringPipeline::scoreLoop, this);
+}
+
+ScoringPipeline::~ScoringPipeline()
+{
+	drain();
+	{
+		lock_guard<mutex> guard(lock);
+		stopping = true;
+	}
+	pending.notify_all();
+	device_thread.join();
+	score_thread.join();
+}
+
+future<Scores> ScoringPipeline::submit(const Corpus& corpus)
+{
+	if (corpus.num_words%64!=0) {
+		printf("--------------------------------------------------------------------\n");
+		printf("ERROR: The number of words must be a multiple of 64\n");
+		printf("       Total words = %lu\n", corpus.num_words);
+		exit(-1);
+	}
+
+	if (corpus.num_words == 0) {
+		promise<Scores> empty;
+		empty.set_value(Scores(corpus.num_docs, 0));
+		return empty.get_future();
+	}
+
+	Job* job = new Job;
+	job->corpus = corpus;
+	job->inh_flags = NULL;
+	future<Scores> scores = job->promise.get_future();
+
+	// Backpressure: wait for earlier corpora to be scored before taking this one
+	unique_lock<mutex> guard(lock);
+	room.wait(guard, [&]{
+		return in_flight == 0 ||
+		       (in_flight < max_in_flight && words_in_flight + corpus.num_words <= max_words_in_flight);
+	});
+	in_flight++;
+	words_in_flight += corpus.num_words;
+	to_device.push_back(job);
+	pending.notify_all();
+
+	return scores;
+}
+
+void ScoringPipeline::drain()
+{
+	unique_lock<mutex> guard(lock);
+	room.wait(guard, [&]{ return in_flight == 0; });
+}
+
+unsigned long ScoringPipeline::lookups()
+{
+	lock_guard<mutex> guard(lock);
+	return total_lookups;
+}
+
+double ScoringPipeline::fpgaSpanMs()
+{
+	if (!filter_loaded) return 0;
+
+	cl_ulong f1 = 0;
+	cl_ulong f2 = 0;
+	firstEvent.getProfilingInfo(CL_PROFILING_COMMAND_QUEUED, &f1);
+	lastFlag.getProfilingInfo(CL_PROFILING_COMMAND_END, &f2);
+	return (f2 - f1)/1000000.0;
+}
+
+void ScoringPipeline::deviceLoop()
+{
+	unique_lock<mutex> guard(lock);
+	while (true) {
+		pending.wait(guard, [&]{ return stopping || !to_device.empty(); });
+		if (to_device.empty()) break;
+
+		Job* job = to_device.front();
+		to_device.pop_front();
+		guard.unlock();
+		enqueueJob(job);
+		guard.lock();
+		to_score.push_back(job);
+		pending.notify_all();
+	}
+}
+
+void ScoringPipeline::scoreLoop()
+{
+	unique_lock<mutex> guard(lock);
+	while (true) {
+		pending.wait(guard, [&]{ return stopping || !to_score.empty(); });
+		if (to_score.empty()) break;
+
+		Job* job = to_score.front();
+		to_score.pop_front();
+		guard.unlock();
+		scoreJob(job);
+		guard.lock();
+	}
+}
+
+// Creates the buffers of a corpus and enqueues its transfers, kernel runs and
+// flag reads in chunks of chunk_words
+void ScoringPipeline::enqueueJob(Job* job)
+{
+	unsigned long total_doc_size = job->corpus.num_words;
+	unsigned int num_iter = (total_doc_size + chunk_words - 1)/chunk_words;
+
+	job->inh_flags = (unsigned char*)aligned_alloc(4096, (total_doc_size*sizeof(char) + 4095) & ~4095UL);
+	job->buffer_doc_words = cl::Buffer(context, CL_MEM_USE_HOST_PTR | CL_MEM_READ_ONLY, total_doc_size*sizeof(uint), job->corpus.input_doc_words);
+	job->buffer_inh_flags = cl::Buffer(context, CL_MEM_USE_HOST_PTR | CL_MEM_WRITE_ONLY, total_doc_size*sizeof(char), job->inh_flags);
+
+	// Set buffer kernel arguments (needed to migrate the buffers in the correct memory)
+	kernel.setArg(0, job->buffer_inh_flags);
+	kernel.setArg(1, job->buffer_doc_words);
+	q.enqueueMigrateMemObjects({job->buffer_doc_words, job->buffer_inh_flags}, CL_MIGRATE_MEM_OBJECT_CONTENT_UNDEFINED);
+
+	// Load the bloom filter coefficients once, every corpus is chained on this
+	if (!filter_loaded) {
+		unsigned int total_size = 0;
+		bool load_filter = true;
+		kernel.setArg(3, total_size);
+		kernel.setArg(4, load_filter);
+		q.enqueueMigrateMemObjects({buffer_bloom_filter}, 0, NULL, &lastWord);
+		vector<cl::Event> krnlDeps(1, lastWord);
+		q.enqueueTask(kernel, &krnlDeps, &lastKrnl);
+		firstEvent = lastWord;
+		filter_loaded = true;
+	}
+
+	job->subbuf_doc_words.resize(num_iter);
+	job->subbuf_inh_flags.resize(num_iter);
+	job->chunk_size.resize(num_iter);
+	for (unsigned int i=0; i<num_iter; i++) {
+		unsigned long offset = i*chunk_words;
+		unsigned long words  = min(chunk_words, total_doc_size-offset);
+		cl_buffer_region inh_info = {offset*sizeof(char), words*sizeof(char)};
+		cl_buffer_region doc_info = {offset*sizeof(uint), words*sizeof(uint)};
+		job->subbuf_inh_flags[i] = job->buffer_inh_flags.createSubBuffer(CL_MEM_WRITE_ONLY, CL_BUFFER_CREATE_TYPE_REGION, &inh_info);
+		job->subbuf_doc_words[i] = job->buffer_doc_words.createSubBuffer(CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION, &doc_info);
+		job->chunk_size[i] = words;
+	}
+
+	// Each transfer follows the previous one and each kernel run the previous
+	// run, across corpora, so the FPGA keeps going while earlier flags are scored
+	for (unsigned int i=0; i<num_iter; i++)
+	{
+		cl::Event buffDone, krnlDone, flagDone;
+		unsigned int total_size = job->chunk_size[i];
+		bool load_filter = false;
+		kernel.setArg(0, job->subbuf_inh_flags[i]);
+		kernel.setArg(1, job->subbuf_doc_words[i]);
+		kernel.setArg(3, total_size);
+		kernel.setArg(4, load_filter);
+
+		vector<cl::Event> wordDeps(1, lastWord);
+		q.enqueueMigrateMemObjects({job->subbuf_doc_words[i]}, 0, &wordDeps, &buffDone);
+		vector<cl::Event> krnlDeps;
+		krnlDeps.push_back(buffDone);
+		krnlDeps.push_back(lastKrnl);
+		q.enqueueTask(kernel, &krnlDeps, &krnlDone);
+		vector<cl::Event> flagDeps(1, krnlDone);
+		q.enqueueMigrateMemObjects({job->subbuf_inh_flags[i]}, CL_MIGRATE_MEM_OBJECT_HOST, &flagDeps, &flagDone);
+
+		lastWord = buffDone;
+		lastKrnl = krnlDone;
+		lastFlag = flagDone;
+		job->flagWait.push_back(flagDone);
+	}
+	q.flush();
+}
+
+// Scores the documents of a corpus as the flags covering them come back,
+// then fulfills its future and releases its share of the in-flight budget
+void ScoringPipeline::scoreJob(Job* job)
+{
+	Corpus& corpus = job->corpus;
+	Scores scores(corpus.num_docs);
+
+	unsigned long available = 0;
+	unsigned long lookups = 0;
+	unsigned long n = 0;
+	unsigned int  iter = 0;
+	for (unsigned int doc=0; doc<corpus.num_docs; )
+	{
+		job->flagWait[iter].wait();
+		available += job->chunk_size[iter];
+		iter++;
+
+		unsigned int first_doc  = doc;
+		unsigned long first_word = n;
+		while (doc<corpus.num_docs && n+corpus.doc_sizes[doc] <= available) {
+			n += corpus.doc_sizes[doc];
+			doc++;
+		}
+		lookups += scoreDocuments(corpus.doc_sizes, corpus.input_doc_words, job->inh_flags, profile_weights, scores.data(), first_doc, doc-first_doc, first_word);
+	}
+	// Padding after the last document: the remaining reads must complete before the flags are freed
+	for (; iter<job->flagWait.size(); iter++) {
+		job->flagWait[iter].wait();
+	}
+
+	// Release the buffers before the host memory they use
+	unsigned char* inh_flags = job->inh_flags;
+	unsigned long num_words = corpus.num_words;
+	promise<Scores> result = move(job->promise);
+	delete job;
+	free(inh_flags);
+
+	{
+		lock_guard<mutex> guard(lock);
+		total_lookups += lookups;
+	}
+	result.set_value(move(scores));
+
+	lock_guard<mutex> guard(lock);
+	in_flight--;
+	words_in_flight -= num_words;
+	room.notify_all();
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include "xcl2.hpp"
+#include "sizes.h"
+
+// One corpus to score. The words must stay valid until the future returned by
+// submit() is ready; they are used in place by the FPGA (CL_MEM_USE_HOST_PTR),
+// so they must be 4K aligned and padded with docTag to a multiple of 64 words.
+struct Corpus {
+    unsigned int*  doc_sizes;
+    unsigned int*  input_doc_words;
+    unsigned int   num_docs;
+    unsigned long  num_words;
+};
+
+typedef std::vector<unsigned long> Scores;
+
+// Persistent scoring pipeline: the FPGA binary, kernel, command queue and
+// bloom filter are set up once and shared by every corpus. A device thread
+// enqueues the transfers and kernel runs of each corpus in chunks, chained
+// on the previous corpus so the FPGA never waits on a request boundary, and
+// a scoring thread accumulates the profile weights of each chunk as soon as
+// its flags are back.
+//
+// At most max_in_flight corpora, and max_words_in_flight words, are between
+// submit() and their scores being ready; submit() blocks until there is room.
+// A corpus larger than max_words_in_flight is accepted when nothing else is
+// in flight.
+class ScoringPipeline
+{
+public:
+    ScoringPipeline(
+        unsigned int*  bloom_filter,
+        unsigned long* profile_weights,
+        unsigned long  chunk_words = 512*1024,
+        unsigned int   max_in_flight = 4,
+        unsigned long  max_words_in_flight = max_iter_size);
+    ~ScoringPipeline();
+
+    std::future<Scores> submit(const Corpus& corpus);
+
+    // Blocks until every submitted corpus is scored
+    void drain();
+
+    // Device time from the bloom filter load to the last flags read back
+    double fpgaSpanMs();
+    unsigned long lookups();
+
+private:
+    struct Job {
+        Corpus                 corpus;
+        std::promise<Scores>   promise;
+        unsigned char*         inh_flags;
+        cl::Buffer             buffer_doc_words;
+        cl::Buffer             buffer_inh_flags;
+        std::vector<cl::Buffer>    subbuf_doc_words;
+        std::vector<cl::Buffer>    subbuf_inh_flags;
+        std::vector<unsigned long> chunk_size;
+        std::vector<cl::Event>     flagWait;
+    };
+
+    void deviceLoop();
+    void scoreLoop();
+    void enqueueJob(Job* job);
+    void scoreJob(Job* job);
+
+    unsigned long* profile_weights;
+    unsigned long  chunk_words;
+    unsigned int   max_in_flight;
+    unsigned long  max_words_in_flight;
+
+    cl::Context      context;
+    cl::CommandQueue q;
+    cl::Program      program;
+    cl::Kernel       kernel;
+    cl::Buffer       buffer_bloom_filter;
+
+    // Last transfer and kernel run enqueued, the next corpus is chained on them.
+    // Only used by the device thread once the constructor returns.
+    cl::Event        lastWord;
+    cl::Event        lastKrnl;
+    cl::Event        firstEvent;
+    cl::Event        lastFlag;
+
+    std::mutex              lock;
+    std::condition_variable room;      // in-flight budget released
+    std::condition_variable pending;   // work for the device or scoring thread
+    std::deque<Job*>        to_device;
+    std::deque<Job*>        to_score;
+    unsigned int            in_flight;
+    unsigned long           words_in_flight;
+    bool                    stopping;
+    bool                    filter_loaded;
+    unsigned long           total_lookups;
+
+    std::thread device_thread;
+    std::thread score_thread;
+};
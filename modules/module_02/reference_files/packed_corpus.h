@@ -0,0 +1,45 @@
+#pragma once
+
+// Compressed corpus: the words of each document are sorted by word_id and
+// split in blocks of up to packed_block_words words, blocks never span two
+// documents. A block is a sequence of 32-bit words:
+//
+//   word 0   : first packed word of the block ((word_id<<8)|freq)
+//   word 1   : bits 0-6 number of words in the block (1..64),
+//              bits 8-12 width b of the word_id deltas (0..24)
+//   deltas   : the count-1 word_id deltas, b bits each, packed LSB first,
+//              padded to a 32-bit boundary
+//   freqs    : the count-1 frequencies, one byte each, padded to a 32-bit boundary
+//
+// A docTag word where a block is expected is padding and is skipped. Decoding
+// yields the sorted words of all the documents followed by docTag up to the
+// requested total size. Scores do not depend on the order of the words within
+// a document, so the sorted corpus scores the same as the original one.
+
+#define packed_block_words 64
+
+// Upper bound of the encoded size, in 32-bit words, of num_words words in
+// num_docs documents. With 24-bit deltas a block is as large as its words plus
+// up to 3, so the bound exceeds num_words: it sizes the scratch of one slice or
+// chunk of the corpus, the encoded words are then kept at their actual size.
+unsigned long packedCorpusBound(unsigned long num_words, unsigned int num_docs);
+
+// Sorts the words of each document by word_id, in place, and encodes them into
+// packed. Returns the number of 32-bit words written.
+unsigned long encodeCorpus(
+    unsigned int*  doc_sizes,
+    unsigned int*  input_doc_words,
+    unsigned int   total_num_docs,
+    unsigned int*  packed);
+
+// Decodes packed_size words of packed into total_size words, padding with
+// docTag. Dispatches to the widest SIMD path the CPU supports.
+void decodeCorpus(
+    const unsigned int* packed,
+    unsigned long       packed_size,
+    unsigned int*       words,
+    unsigned long       total_size);
+
+// Returns a specific decoder ("scalar", "avx2"), or NULL if the CPU does not support it
+typedef void (*decode_corpus_fn)(const unsigned int* packed, unsigned long packed_size, unsigned int* words, unsigned long total_size);
+decode_corpus_fn decodeCorpus_impl(const char* isa);
@@ -0,0 +1,107 @@
+#include <vector>
+#include <algorithm>
+#include <future>
+#include <cstdio>
+#include <ctime>
+
+#include "xcl2.hpp"
+#include "sizes.h"
+#include "common.h"
+#include "fpga_pipeline.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// Uses the data as a stream of num_iter corpora submitted back to back to a
+// persistent ScoringPipeline, the way a service would receive requests.
+void runOnFPGA(
+	unsigned int*  doc_sizes,
+	unsigned int*  input_doc_words,
+	unsigned int*  bloom_filter,
+	unsigned long* profile_weights,
+	unsigned long* profile_score,
+	unsigned int   total_num_docs,
+	unsigned long  total_doc_size,
+	int            num_iter)
+{
+	if (total_doc_size%64!=0) {
+		printf("--------------------------------------------------------------------\n");
+		printf("ERROR: The number of words must be a multiple of 64\n");
+		printf("       Total words = %lu\n", total_doc_size);
+		printf("       Skipping FPGA kernel execution\n");
+		exit(-1);
+	}
+	if (num_iter < 1) num_iter = 1;
+	if ((unsigned)num_iter > total_num_docs) num_iter = total_num_docs;
+
+	// Split the documents in num_iter corpora of about the same number of words.
+	// Each corpus gets its own 4K aligned copy padded to a multiple of 64 words.
+	vector<unsigned int> corpus_doc(num_iter+1, total_num_docs);
+	vector<vector<unsigned int,aligned_allocator<unsigned int>>> corpus_words(num_iter);
+	vector<Corpus> corpora(num_iter);
+
+	unsigned long unpadded_size = 0;
+	for (unsigned int doc=0; doc<total_num_docs; doc++) {
+		unpadded_size += doc_sizes[doc];
+	}
+
+	unsigned int  doc = 0;
+	unsigned long offset = 0;
+	corpus_doc[0] = 0;
+	for (int c=0; c<num_iter; c++) {
+		unsigned long first_word = offset;
+		unsigned long target = (c == num_iter-1) ? unpadded_size : unpadded_size*(c+1)/num_iter;
+		while (doc<total_num_docs && offset+doc_sizes[doc] <= target) {
+			offset += doc_sizes[doc];
+			doc++;
+		}
+		corpus_doc[c+1] = doc;
+
+		unsigned long words = offset-first_word;
+		corpus_words[c].assign((words + 63) & ~63UL, docTag);
+		copy(&input_doc_words[first_word], &input_doc_words[offset], corpus_words[c].begin());
+
+		corpora[c].doc_sizes       = &doc_sizes[corpus_doc[c]];
+		corpora[c].input_doc_words = corpus_words[c].data();
+		corpora[c].num_docs        = corpus_doc[c+1]-corpus_doc[c];
+		corpora[c].num_words       = corpus_words[c].size();
+	}
+
+	ScoringPipeline pipeline(bloom_filter, profile_weights);
+
+	printf("\n");
+    double mbytes_total  = (double)(total_doc_size * sizeof(int)) / (double)(1000*1000);
+    printf(" Processing %.3f MBytes of data\n", mbytes_total);
+    printf(" Submitting %d corpora to the scoring pipeline\n", num_iter);
+    printf("--------------------------------------------------------------------\n");
+
+	chrono::high_resolution_clock::time_point t1, t2;
+	t1 = chrono::high_resolution_clock::now();
+
+	// submit() only blocks when the in-flight budget is used up
+	vector<future<Scores>> results;
+	for (int c=0; c<num_iter; c++) {
+		results.push_back(pipeline.submit(corpora[c]));
+	}
+	for (int c=0; c<num_iter; c++) {
+		Scores scores = results[c].get();
+		copy(scores.begin(), scores.end(), &profile_score[corpus_doc[c]]);
+	}
+
+	t2 = chrono::high_resolution_clock::now();
+	chrono::duration<double> perf_all_sec  = chrono::duration_cast<duration<double>>(t2-t1);
+
+    double perf_hw_ms = pipeline.fpgaSpanMs();
+
+    if (xcl::is_emulation()) {
+    	if (xcl::is_hw_emulation()) {
+		    printf(" Emulated FPGA accelerated version  | run 'vitis_analyzer xclbin.run_summary' for performance estimates");
+    	} else {
+		    printf(" Emulated FPGA accelerated version  | (performance not relevant in SW emulation)");
+		}
+    } else {
+		    printf(" Executed FPGA accelerated version  | %10.4f ms   ( FPGA %.3f ms )", 1000*perf_all_sec.count(), perf_hw_ms);
+    }
+	printf("\n");
+	printf(" Profile weight lookups on CPU      | %10lu lookups\n", pipeline.lookups());
+}
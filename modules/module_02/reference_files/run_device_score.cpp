@@ -0,0 +1,196 @@
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+
+#include "xcl2.hpp"
+#include "fpga_kernels.h"
+#include "sizes.h"
+#include "common.h"
+#include "event_trace.h"
+
+using namespace std;
+using namespace std::chrono;
+
+string kernel_name = "runOnfpga_score";
+const char* kernel_name_charptr = kernel_name.c_str();
+unsigned int bloom_filter_size = 1L<<bloom_size;
+unsigned int profile_size = 1L<<24;
+unsigned size_per_iter_const=512*1024;
+unsigned size_per_iter;
+
+
+// Compact profile table for the scoring kernel: the non-zero weights with
+// their word_id as key, at MurmurHash2(word_id,3,1) with linear probing.
+// Uses at most half of the slots so probes stay short. Returns the number
+// of slots, 0 if the profile does not fit in profile_table_max slots.
+static unsigned int buildProfileTable(
+	unsigned long*  profile_weights,
+	vector<unsigned int,aligned_allocator<unsigned int>>&   table_keys,
+	vector<unsigned long,aligned_allocator<unsigned long>>& table_weights)
+{
+	unsigned long num_entries = 0;
+	for (unsigned int id = 0; id < profile_size; id++) {
+		if (profile_weights[id]) num_entries++;
+	}
+
+	unsigned int table_size = 1024;
+	while (table_size < 2*num_entries) table_size *= 2;
+	if (table_size > profile_table_max) return 0;
+
+	table_keys.assign(table_size, docTag);
+	table_weights.assign(table_size, 0);
+	for (unsigned int id = 0; id < profile_size; id++) {
+		if (!profile_weights[id]) continue;
+		unsigned int slot = MurmurHash2(&id, 3, 1) & (table_size-1);
+		while (table_keys[slot] != docTag) slot = (slot+1) & (table_size-1);
+		table_keys[slot] = id;
+		table_weights[slot] = profile_weights[id];
+	}
+	return table_size;
+}
+
+// Single buffer version scoring the documents on the FPGA: the kernel walks
+// the document sizes and accumulates the profile weights itself, so 8 bytes
+// per document come back instead of one flag per word. The binary must be
+// built with the runOnfpga_score kernel.
+void runOnFPGA(
+	unsigned int*  doc_sizes,
+	unsigned int*  input_doc_words,
+	unsigned int*  bloom_filter,
+	unsigned long* profile_weights,
+	unsigned long* profile_score,
+	unsigned int   total_num_docs,
+	unsigned long  total_doc_size,
+	int            num_iter)
+{
+	if ((total_doc_size)%64!=0) {
+		printf("--------------------------------------------------------------------\n");
+		printf("ERROR: The number of word per iterations must be a multiple of 64\n");
+		printf("       Total words = %lu, Number of iterations = 1, Word per iterations = %lu\n", total_doc_size, total_doc_size);
+		printf("       Skipping FPGA kernel execution\n");
+		exit(-1);
+	}
+	if (total_doc_size > max_iter_size) {
+		printf("--------------------------------------------------------------------\n");
+		printf("ERROR: The number of word per iterations must not exceed %lu\n", max_iter_size);
+		printf("       Total words = %lu, Number of iterations = 1, Word per iterations = %lu\n", total_doc_size, total_doc_size);
+		printf("       Skipping FPGA kernel execution\n");
+		exit(-1);
+	}
+
+	vector<unsigned int,aligned_allocator<unsigned int>>   table_keys;
+	vector<unsigned long,aligned_allocator<unsigned long>> table_weights;
+	unsigned int table_size = buildProfileTable(profile_weights, table_keys, table_weights);
+	if (table_size == 0) {
+		printf("--------------------------------------------------------------------\n");
+		printf("ERROR: The profile does not fit in the %lu slots of the on-chip profile table\n", profile_table_max);
+		printf("       Skipping FPGA kernel execution\n");
+		exit(-1);
+	}
+
+	// The scores are written 8 per 512-bit value: pad with empty documents
+	unsigned int num_docs = (total_num_docs + 7)/8*8;
+	vector<unsigned int,aligned_allocator<unsigned int>>   padded_doc_sizes(num_docs, 0);
+	vector<unsigned long,aligned_allocator<unsigned long>> device_scores(num_docs, 0);
+	copy(doc_sizes, doc_sizes + total_num_docs, padded_doc_sizes.begin());
+
+	// Boilerplate code to load the FPGA binary, create the kernel and command queue
+	vector<cl::Device> devices = xcl::get_xil_devices();
+	cl::Device device = selectDevice(devices);
+	cl::Context context(device);
+	cl::CommandQueue q(context,device, CL_QUEUE_PROFILING_ENABLE|CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE);
+
+	string run_type = xcl::is_emulation()?(xcl::is_hw_emulation()?"hw_emu":"sw_emu"):"hw";
+	string binary_file = "runOnfpga_" + run_type + ".awsxclbin";
+	cl::Program::Binaries bins = xcl::import_binary_file(binary_file);
+	cl::Program program(context, devices, bins);
+	cl::Kernel kernel(program,kernel_name_charptr,NULL);
+
+	unsigned int total_size = total_doc_size;
+	bool load_filter = true;
+
+	// Create buffers
+	cl::Buffer buffer_bloom_filter(context, CL_MEM_USE_HOST_PTR | CL_MEM_READ_ONLY, bloom_filter_size*sizeof(uint),bloom_filter);
+	cl::Buffer buffer_table_keys(context, CL_MEM_USE_HOST_PTR | CL_MEM_READ_ONLY, table_size*sizeof(uint),table_keys.data());
+	cl::Buffer buffer_table_weights(context, CL_MEM_USE_HOST_PTR | CL_MEM_READ_ONLY, table_size*sizeof(unsigned long),table_weights.data());
+	cl::Buffer buffer_doc_sizes(context, CL_MEM_USE_HOST_PTR | CL_MEM_READ_ONLY, num_docs*sizeof(uint),padded_doc_sizes.data());
+	cl::Buffer buffer_input_doc_words(context, CL_MEM_USE_HOST_PTR | CL_MEM_READ_ONLY, total_doc_size*sizeof(uint),input_doc_words);
+	cl::Buffer buffer_output_scores(context, CL_MEM_USE_HOST_PTR | CL_MEM_WRITE_ONLY, num_docs*sizeof(unsigned long),device_scores.data());
+
+	// Set buffer kernel arguments (needed to migrate the buffers in the correct memory)
+	kernel.setArg(0, buffer_output_scores);
+	kernel.setArg(1, buffer_input_doc_words);
+	kernel.setArg(2, buffer_bloom_filter);
+	kernel.setArg(3, buffer_doc_sizes);
+	kernel.setArg(4, buffer_table_keys);
+	kernel.setArg(5, buffer_table_weights);
+
+    double mbytes_total  = (double)(total_doc_size * sizeof(int)) / (double)(1000*1000);
+    printf(" Processing %.3f MBytes of data\n", mbytes_total);
+    printf("Running with a single buffer of %.3f MBytes for FPGA processing and scoring\n",mbytes_total);
+
+    // Create events for read,compute and write
+
+        vector<cl::Event> wordWait;
+        vector<cl::Event> krnlWait;
+        vector<cl::Event> flagWait;
+	cl::Event buffDone, krnlDone, flagDone;
+
+    printf("--------------------------------------------------------------------\n");
+
+
+	chrono::high_resolution_clock::time_point t1, t2;
+	t1 = chrono::high_resolution_clock::now();
+
+
+	// Load the bloom filter, profile table, document sizes and words buffers
+	q.enqueueMigrateMemObjects({buffer_bloom_filter, buffer_table_keys, buffer_table_weights, buffer_doc_sizes, buffer_input_doc_words}, 0,NULL,&buffDone);
+        wordWait.push_back(buffDone);
+
+	// Start the FPGA compute
+	load_filter = true;
+	kernel.setArg(6, table_size);
+	kernel.setArg(7, total_size);
+	kernel.setArg(8, num_docs);
+	kernel.setArg(9, load_filter);
+	q.enqueueTask(kernel,&wordWait,&krnlDone);
+        krnlWait.push_back(krnlDone);
+
+        // Read back the document scores from FPGA to host
+	q.enqueueMigrateMemObjects({buffer_output_scores}, CL_MIGRATE_MEM_OBJECT_HOST,&krnlWait,&flagDone);
+        flagWait.push_back(flagDone);
+        flagWait[0].wait();
+
+	chrono::high_resolution_clock::time_point s1 = chrono::high_resolution_clock::now();
+	copy(device_scores.begin(), device_scores.begin() + total_num_docs, profile_score);
+	chrono::high_resolution_clock::time_point s2 = chrono::high_resolution_clock::now();
+
+	t2 = chrono::high_resolution_clock::now();
+	chrono::duration<double> perf_all_sec  = chrono::duration_cast<duration<double>>(t2-t1);
+
+
+    cl_ulong f1 = 0;
+    cl_ulong f2 = 0;
+    wordWait.front().getProfilingInfo(CL_PROFILING_COMMAND_QUEUED, &f1);
+    flagWait.back().getProfilingInfo(CL_PROFILING_COMMAND_END, &f2);
+    double perf_hw_ms = (f2 - f1)/1000000.0;
+
+    if (xcl::is_emulation()) {
+    	if (xcl::is_hw_emulation()) {
+		    printf(" Emulated FPGA accelerated version  | run 'vitis_analyzer xclbin.run_summary' for performance estimates");
+    	} else {
+		    printf(" Emulated FPGA accelerated version  | (performance not relevant in SW emulation)");
+		}
+    } else {
+		    printf(" Executed FPGA accelerated version  | %10.4f ms   ( FPGA %.3f ms )", 1000*perf_all_sec.count(), perf_hw_ms);
+    }
+	printf("\n");
+	printf(" Profile table on FPGA              | %10u slots ( %.1f KBytes )\n", table_size, table_size*(sizeof(unsigned int)+sizeof(unsigned long))/1000.0);
+	printf(" Read back from FPGA                | %10.3f MBytes of scores ( flags would be %.3f MBytes )\n",
+	       num_docs*sizeof(unsigned long)/1e6, total_doc_size*sizeof(char)/1e6);
+
+	// Per-event timeline of this run and latency summary
+	vector<HostSpan> host_spans(1, HostSpan{0, s1, s2});
+	writeEventTrace("event_trace.json", wordWait, krnlWait, flagWait, host_spans, t1);
+}
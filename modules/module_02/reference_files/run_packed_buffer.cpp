@@ -0,0 +1,253 @@
+#include <vector>
+#include <cstdio>
+#include <ctime>
+
+#include "xcl2.hpp"
+#include "fpga_kernels.h"
+#include "sizes.h"
+#include "common.h"
+#include "event_trace.h"
+#include "packed_corpus.h"
+
+using namespace std;
+using namespace std::chrono;
+
+string kernel_name = "runOnfpga_packed";
+const char* kernel_name_charptr = kernel_name.c_str();
+unsigned int bloom_filter_size = 1L<<bloom_size;
+unsigned int profile_size = 1L<<24;
+unsigned size_per_iter_const=512*1024;
+unsigned size_per_iter;
+
+
+// Generic buffer version transferring the compressed corpus: the documents
+// are sorted and encoded on the host (see packed_corpus.h), the kernel decodes
+// them in front of the hash stage. The binary must be built with the
+// runOnfpga_packed kernel.
+void runOnFPGA(
+	unsigned int*  doc_sizes,
+	unsigned int*  input_doc_words,
+	unsigned int*  bloom_filter,
+	unsigned long* profile_weights,
+	unsigned long* profile_score,
+	unsigned int   total_num_docs,
+	unsigned long  total_doc_size,
+	int            num_iter)
+{
+	if (total_doc_size%64!=0) {
+		printf("--------------------------------------------------------------------\n");
+		printf("ERROR: The number of words must be a multiple of 64\n");
+		printf("       Total words = %lu\n", total_doc_size);
+		printf("       Skipping FPGA kernel execution\n");
+		exit(-1);
+	}
+
+	// Split the data in chunks of a multiple of 64 words, at most max_iter_size,
+	// the last one gets the remainder (as in generic_buffer)
+	unsigned long words_per_iter = ((total_doc_size + num_iter - 1)/num_iter + 63) & ~63UL;
+	if (words_per_iter > max_iter_size) {
+		words_per_iter = max_iter_size;
+	}
+	int requested_iter = num_iter;
+	num_iter = (total_doc_size + words_per_iter - 1)/words_per_iter;
+
+	// Sort a copy of the documents and encode it chunk by chunk into buffers of
+	// the encoded size. A document crossing a chunk boundary is encoded as two
+	// pieces, so a chunk decodes to the words of its own flags; its words are
+	// then sorted within each piece, which scores the same. The sorted copy is
+	// what the flags refer to, and is used for the scoring on the host.
+	unsigned long num_words = 0;
+	for (unsigned doc = 0; doc < total_num_docs; doc++) num_words += doc_sizes[doc];
+	vector<unsigned int,aligned_allocator<unsigned int>> sorted_words(input_doc_words, input_doc_words + total_doc_size);
+	vector<vector<unsigned int,aligned_allocator<unsigned int>>> packed(num_iter);
+	vector<unsigned int> packed_size(num_iter);
+	vector<unsigned int> piece_sizes;
+	unsigned long packed_words = 0;
+	unsigned long packed_total = 0;
+
+	chrono::high_resolution_clock::time_point e1 = chrono::high_resolution_clock::now();
+	// The encoding scratch is freed once every chunk is copied out
+	{
+		vector<unsigned int,aligned_allocator<unsigned int>> encoded;
+		unsigned int  doc = 0;
+		unsigned long doc_used = 0;
+		unsigned long pos = 0;
+		for (int i=0; i<num_iter; i++) {
+			unsigned long offset = i*words_per_iter;
+			unsigned long end    = min(offset + words_per_iter, num_words);
+			piece_sizes.clear();
+			while (pos < end && doc < total_num_docs) {
+				unsigned long take = min(doc_sizes[doc] - doc_used, end - pos);
+				if (take) piece_sizes.push_back(take);
+				pos += take;
+				doc_used += take;
+				if (doc_used == doc_sizes[doc]) {
+					doc++;
+					doc_used = 0;
+				}
+			}
+
+			encoded.resize(packedCorpusBound(end > offset ? end - offset : 0, piece_sizes.size()));
+			unsigned long n = encodeCorpus(piece_sizes.data(), sorted_words.data() + offset, piece_sizes.size(), encoded.data());
+
+			// The kernel reads whole 512-bit values, the tail is docTag padding
+			packed_size[i] = max((n + 15)/16*16, 16UL);
+			packed[i].assign(packed_size[i], docTag);
+			copy(encoded.begin(), encoded.begin() + n, packed[i].begin());
+			packed_words += n;
+			packed_total += packed_size[i];
+		}
+	}
+	chrono::high_resolution_clock::time_point e2 = chrono::high_resolution_clock::now();
+	chrono::duration<double> encode_sec = e2-e1;
+
+	// Boilerplate code to load the FPGA binary, create the kernel and command queue
+	vector<cl::Device> devices = xcl::get_xil_devices();
+	cl::Device device = selectDevice(devices);
+	cl::Context context(device);
+	cl::CommandQueue q(context,device, CL_QUEUE_PROFILING_ENABLE|CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE);
+
+	string run_type = xcl::is_emulation()?(xcl::is_hw_emulation()?"hw_emu":"sw_emu"):"hw";
+	string binary_file = "runOnfpga_" + run_type + ".awsxclbin";
+	cl::Program::Binaries bins = xcl::import_binary_file(binary_file);
+	cl::Program program(context, devices, bins);
+	cl::Kernel kernel(program,kernel_name_charptr,NULL);
+
+	unsigned char* output_inh_flags = (unsigned char*)aligned_alloc(4096, total_doc_size*sizeof(char));
+	unsigned int total_size = 0;
+	bool load_filter = true;
+
+	// Create buffers, one per compressed chunk, and the flags sub-buffers
+	cl::Buffer buffer_bloom_filter(context, CL_MEM_USE_HOST_PTR | CL_MEM_READ_ONLY, bloom_filter_size*sizeof(uint),bloom_filter);
+	cl::Buffer buffer_output_inh_flags(context, CL_MEM_USE_HOST_PTR | CL_MEM_WRITE_ONLY, total_doc_size*sizeof(char),output_inh_flags);
+	vector<cl::Buffer> buffer_input_packed(num_iter);
+	vector<cl_buffer_region> subbuf_inh_info(num_iter);
+	vector<cl::Buffer> subbuf_inh_flags(num_iter);
+	vector<cl::Memory> resident = { buffer_bloom_filter, buffer_output_inh_flags };
+	for (int i=0; i<num_iter; i++) {
+		unsigned long offset = i*words_per_iter;
+		unsigned long words  = min(words_per_iter, total_doc_size-offset);
+		buffer_input_packed[i] = cl::Buffer(context, CL_MEM_USE_HOST_PTR | CL_MEM_READ_ONLY, packed_size[i]*sizeof(uint), packed[i].data());
+		subbuf_inh_info[i] = {offset*sizeof(char), words*sizeof(char)};
+		subbuf_inh_flags[i] = buffer_output_inh_flags.createSubBuffer(CL_MEM_WRITE_ONLY, CL_BUFFER_CREATE_TYPE_REGION, &subbuf_inh_info[i]);
+		resident.push_back(buffer_input_packed[i]);
+	}
+
+	// Set buffer kernel arguments (needed to migrate the buffers in the correct memory)
+	kernel.setArg(0, buffer_output_inh_flags);
+	kernel.setArg(1, buffer_input_packed[0]);
+	kernel.setArg(2, buffer_bloom_filter);
+
+	// Make buffers resident in the device
+	q.enqueueMigrateMemObjects(resident, CL_MIGRATE_MEM_OBJECT_CONTENT_UNDEFINED);
+
+    double mbytes_total  = (double)(total_doc_size * sizeof(int)) / (double)(1000*1000);
+    double mbytes_packed = (double)(packed_total * sizeof(int)) / (double)(1000*1000);
+    printf(" Processing %.3f MBytes of data\n", mbytes_total);
+    printf(" Splitting data in %d compressed buffers of %.3f MBytes in total for FPGA processing\n", num_iter, mbytes_packed);
+    if (num_iter != requested_iter) {
+    printf(" Using %d iterations instead of %d ( %lu words per iteration )\n", num_iter, requested_iter, words_per_iter);
+    }
+
+    // Create events for read,compute and write
+	vector<cl::Event> wordWait;
+	vector<cl::Event> krnlWait;
+	vector<cl::Event> flagWait;
+
+    printf("--------------------------------------------------------------------\n");
+
+
+	chrono::high_resolution_clock::time_point t1, t2;
+	t1 = chrono::high_resolution_clock::now();
+
+	// Set Kernel arguments and load the bloom filter coefficients in the kernel
+	cl::Event buffDone, krnlDone;
+	unsigned int chunk_packed = 0;
+	total_size = 0;
+	load_filter = true;
+	kernel.setArg(3, chunk_packed);
+	kernel.setArg(4, total_size);
+	kernel.setArg(5, load_filter);
+	q.enqueueMigrateMemObjects({buffer_bloom_filter}, 0, NULL, &buffDone);
+	wordWait.push_back(buffDone);
+	q.enqueueTask(kernel, &wordWait, &krnlDone);
+	krnlWait.push_back(krnlDone);
+
+	// Transfer, decode and hash each compressed chunk, read back its flags
+	for (int i=0; i<num_iter; i++)
+	{
+		cl::Event buffDone, krnlDone, flagDone;
+		chunk_packed = packed_size[i];
+		total_size = subbuf_inh_info[i].size / sizeof(char);
+		load_filter = false;
+		kernel.setArg(0, subbuf_inh_flags[i]);
+		kernel.setArg(1, buffer_input_packed[i]);
+		kernel.setArg(3, chunk_packed);
+		kernel.setArg(4, total_size);
+		kernel.setArg(5, load_filter);
+		q.enqueueMigrateMemObjects({buffer_input_packed[i]}, 0, &wordWait, &buffDone);
+		wordWait.push_back(buffDone);
+		q.enqueueTask(kernel, &wordWait, &krnlDone);
+		krnlWait.push_back(krnlDone);
+		q.enqueueMigrateMemObjects({subbuf_inh_flags[i]}, CL_MIGRATE_MEM_OBJECT_HOST, &krnlWait, &flagDone);
+		flagWait.push_back(flagDone);
+	}
+
+	// Wait until all results are copied back to the host before doing the post-processing
+	for (int i=0; i<num_iter; i++)
+	{
+		flagWait[i].wait();
+	}
+
+	// Compute the profile score in CPU using the in-hash flags computed on the FPGA
+	chrono::high_resolution_clock::time_point s1 = chrono::high_resolution_clock::now();
+	unsigned long lookups = scoreDocuments(doc_sizes, sorted_words.data(), output_inh_flags, profile_weights, profile_score, 0, total_num_docs, 0);
+	chrono::high_resolution_clock::time_point s2 = chrono::high_resolution_clock::now();
+	chrono::duration<double> score_sec = s2-s1;
+
+	t2 = chrono::high_resolution_clock::now();
+	chrono::duration<double> perf_all_sec  = chrono::duration_cast<duration<double>>(t2-t1);
+
+
+    cl_ulong f1 = 0;
+    cl_ulong f2 = 0;
+    wordWait.front().getProfilingInfo(CL_PROFILING_COMMAND_QUEUED, &f1);
+    flagWait.back().getProfilingInfo(CL_PROFILING_COMMAND_END, &f2);
+    double perf_hw_ms = (f2 - f1)/1000000.0;
+
+    // Time spent moving the compressed chunks, the bloom filter load excluded
+    double transfer_sec = 0;
+    for (unsigned i = 1; i < wordWait.size(); i++) {
+        cl_ulong w1 = 0;
+        cl_ulong w2 = 0;
+        wordWait[i].getProfilingInfo(CL_PROFILING_COMMAND_START, &w1);
+        wordWait[i].getProfilingInfo(CL_PROFILING_COMMAND_END, &w2);
+        transfer_sec += (w2 - w1)/1e9;
+    }
+
+    if (xcl::is_emulation()) {
+    	if (xcl::is_hw_emulation()) {
+		    printf(" Emulated FPGA accelerated version  | run 'vitis_analyzer xclbin.run_summary' for performance estimates");
+    	} else {
+		    printf(" Emulated FPGA accelerated version  | (performance not relevant in SW emulation)");
+		}
+    } else {
+		    printf(" Executed FPGA accelerated version  | %10.4f ms   ( FPGA %.3f ms )", 1000*perf_all_sec.count(), perf_hw_ms);
+    }
+	printf("\n");
+	printf(" Corpus encoding on CPU             | %10.4f ms   ( %.1f M words/s )\n", 1000*encode_sec.count(), num_words/encode_sec.count()/1e6);
+	printf(" Compression ratio                  | %10.2f     ( %.2f bits per word, %.3f of %.3f MBytes )\n",
+	       (double)num_words/packed_words, 32.0*packed_words/num_words, mbytes_packed, mbytes_total);
+	if (!xcl::is_emulation() && transfer_sec > 0) {
+		// Words delivered per second of transfer, against the same link moving the raw words
+		printf(" Effective transfer to FPGA         | %10.1f M words/s ( raw words at the same rate: %.1f M words/s )\n",
+		       num_words/transfer_sec/1e6, mbytes_packed/4/transfer_sec);
+	}
+	printf(" Profile weight lookups on CPU      | %10.1f M lookups/s ( %lu lookups )\n", lookups/score_sec.count()/1e6, lookups);
+
+	// Per-event timeline of this run and latency summary
+	vector<HostSpan> host_spans(1, HostSpan{0, s1, s2});
+	writeEventTrace("event_trace.json", wordWait, krnlWait, flagWait, host_spans, t1);
+
+	free(output_inh_flags);
+}
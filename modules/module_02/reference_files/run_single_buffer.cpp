@@ -5,6 +5,9 @@
 #include "xcl2.hpp"
 #include "sizes.h"
 #include "common.h"
+#include "event_trace.h"
+#include "fpga_kernels.h"
+#include "buffer_pool.h"
 
 using namespace std;
 using namespace std::chrono;
@@ -24,37 +27,48 @@ void runOnFPGA(
 	unsigned long* profile_weights,
 	unsigned long* profile_score,
 	unsigned int   total_num_docs, 
-	unsigned int   total_doc_size,
+	unsigned long  total_doc_size,
 	int            num_iter)
 {
 	if ((total_doc_size)%64!=0) {
 		printf("--------------------------------------------------------------------\n");
 		printf("ERROR: The number of word per iterations must be a multiple of 64\n");
-		printf("       Total words = %d, Number of iterations = 1, Word per iterations = %d\n", total_doc_size, total_doc_size);
+		printf("       Total words = %lu, Number of iterations = 1, Word per iterations = %lu\n", total_doc_size, total_doc_size);
+		printf("       Skipping FPGA kernel execution\n");
+		exit(-1);
+	}
+	if (total_doc_size > max_iter_size) {
+		printf("--------------------------------------------------------------------\n");
+		printf("ERROR: The number of word per iterations must not exceed %lu\n", max_iter_size);
+		printf("       Total words = %lu, Number of iterations = 1, Word per iterations = %lu\n", total_doc_size, total_doc_size);
 		printf("       Skipping FPGA kernel execution\n");
 		exit(-1);
 	}
 
-	// Boilerplate code to load the FPGA binary, create the kernel and command queue
-	vector<cl::Device> devices = xcl::get_xil_devices();
-	cl::Device device = devices[0];
-	cl::Context context(device);
-	cl::CommandQueue q(context,device, CL_QUEUE_PROFILING_ENABLE|CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE);
-
+	// Boilerplate code to load the FPGA binary, create the kernel and command queue.
+	// The device, context and program are created by the first call only.
 	string run_type = xcl::is_emulation()?(xcl::is_hw_emulation()?"hw_emu":"sw_emu"):"hw";
 	string binary_file = kernel_name + "_" + run_type + ".awsxclbin";
-	cl::Program::Binaries bins = xcl::import_binary_file(binary_file);
-	cl::Program program(context, devices, bins);
-	cl::Kernel kernel(program,kernel_name_charptr,NULL);
+	FpgaSession& session = fpgaSession(binary_file);
+	cl::Context& context = session.context;
+	cl::CommandQueue q(context,session.device, CL_QUEUE_PROFILING_ENABLE|CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE);
+	cl::Kernel kernel(session.program,selectKernel(session.program).c_str(),NULL);
 
 	unsigned int total_size = total_doc_size;
-	unsigned char* output_inh_flags = (unsigned char*)aligned_alloc(4096, total_size*sizeof(char));
 	bool load_filter = true;
 
-	// Create buffers
-	cl::Buffer buffer_bloom_filter(context, CL_MEM_USE_HOST_PTR | CL_MEM_READ_ONLY, bloom_filter_size*sizeof(uint),bloom_filter);
-	cl::Buffer buffer_input_doc_words(context, CL_MEM_USE_HOST_PTR | CL_MEM_READ_ONLY, total_size*sizeof(uint),input_doc_words);
-	cl::Buffer buffer_output_inh_flags(context, CL_MEM_USE_HOST_PTR | CL_MEM_WRITE_ONLY, total_size*sizeof(char),output_inh_flags);
+	// The inputs are used in place (no copy), the flags get pinned memory from
+	// the pool, which goes back to it for the next call. The bloom filter is
+	// the same on every call, its buffer is created by the first one.
+	PooledBuffer* pooled_bloom_filter = session.pool->wrapCached(bloom_filter, bloom_filter_size*sizeof(uint), CL_MEM_READ_ONLY);
+	PooledBuffer* pooled_input_doc_words = session.pool->wrap(input_doc_words, total_doc_size*sizeof(uint), CL_MEM_READ_ONLY);
+	PooledBuffer* pooled_output_inh_flags = session.pool->acquire(total_doc_size*sizeof(char), CL_MEM_WRITE_ONLY);
+	unsigned char* output_inh_flags = (unsigned char*)pooled_output_inh_flags->host;
+
+	// The flags buffer can be larger than the corpus: use its used part only
+	cl::Buffer& buffer_bloom_filter = pooled_bloom_filter->buffer;
+	cl::Buffer& buffer_input_doc_words = pooled_input_doc_words->buffer;
+	cl::Buffer buffer_output_inh_flags = subBuffer(pooled_output_inh_flags, 0, total_doc_size*sizeof(char));
 
 	// Set buffer kernel arguments (needed to migrate the buffers in the correct memory) 
 	kernel.setArg(0, buffer_output_inh_flags);
@@ -95,30 +109,11 @@ void runOnFPGA(
         flagWait.push_back(flagDone);
         flagWait[0].wait(); 
 
-	// Compute the profile score the CPU using the in-hash flags computed on the FPGA
-	unsigned      curr_entry;
-	unsigned char inh_flags;
-			
-	for(unsigned int doc=0, n=0; doc<total_num_docs;doc++) 
-	{
-		unsigned long ans = 0;
-		unsigned int size = doc_sizes[doc];
-
-		for (unsigned i = 0; i < size ; i++, n++)
-		{ 
-			curr_entry = input_doc_words[n];
-			inh_flags  = output_inh_flags[n];
-
-			if (inh_flags) 
-			{
-				unsigned frequency = curr_entry & 0x00ff;
-				unsigned word_id = curr_entry >> 8;
-
-				ans += profile_weights[word_id] * (unsigned long)frequency;
-			}
-		}
-		profile_score[doc] = ans;
-	}
+	// Compute the profile score in CPU using the in-hash flags computed on the FPGA
+	chrono::high_resolution_clock::time_point s1 = chrono::high_resolution_clock::now();
+	unsigned long lookups = scoreDocuments(doc_sizes, input_doc_words, output_inh_flags, profile_weights, profile_score, 0, total_num_docs, 0);
+	chrono::high_resolution_clock::time_point s2 = chrono::high_resolution_clock::now();
+	chrono::duration<double> score_sec = s2-s1;
 
 	t2 = chrono::high_resolution_clock::now();
 	chrono::duration<double> perf_all_sec  = chrono::duration_cast<duration<double>>(t2-t1);
@@ -140,5 +135,15 @@ void runOnFPGA(
 		    printf(" Executed FPGA accelerated version  | %10.4f ms   ( FPGA %.3f ms )", 1000*perf_all_sec.count(), perf_hw_ms);    	
     }
 	printf("\n");
+	printf(" Profile weight lookups on CPU      | %10.1f M lookups/s ( %lu lookups )\n", lookups/score_sec.count()/1e6, lookups);
+
+	// Per-event timeline of this run and latency summary
+	vector<HostSpan> host_spans(1, HostSpan{0, s1, s2});
+	writeEventTrace("event_trace.json", wordWait, krnlWait, flagWait, host_spans, t1);
+
+	session.pool->release(pooled_bloom_filter);
+	session.pool->release(pooled_input_doc_words);
+	session.pool->release(pooled_output_inh_flags);
+	session.pool->printStats();
 }
 
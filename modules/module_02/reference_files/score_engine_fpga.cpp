@@ -0,0 +1,33 @@
+#include <memory>
+#include <algorithm>
+
+#include "xcl2.hpp"
+#include "sizes.h"
+#include "common.h"
+#include "fpga_pipeline.h"
+
+using namespace std;
+
+// Resident FPGA engine of the scoring daemon (cpu_src/score_daemon.cpp, built
+// with make score_daemon in ../makefile). The ScoringPipeline is created by
+// the first call and keeps the binary, command queue and bloom filter loaded
+// for every later micro-batch, so the bloom filter and profile weights must be
+// the same on every call. A call with no documents only creates it.
+static unique_ptr<ScoringPipeline> pipeline;
+
+void scoreOnFPGAPipeline(
+    unsigned int*  doc_sizes,
+    unsigned int*  input_doc_words,
+    unsigned int*  bloom_filter,
+    unsigned long* profile_weights,
+    unsigned long* profile_score,
+    unsigned int   total_num_docs,
+    unsigned long  total_size)
+{
+    if (!pipeline) pipeline.reset(new ScoringPipeline(bloom_filter, profile_weights));
+    if (total_num_docs == 0) return;
+
+    Corpus corpus = { doc_sizes, input_doc_words, total_num_docs, total_size };
+    Scores scores = pipeline->submit(corpus).get();
+    copy(scores.begin(), scores.end(), profile_score);
+}
@@ -1,6 +1,19 @@
 #pragma once
 
+#include <stdint.h>
+#include <stddef.h>
+
 unsigned int MurmurHash2(const void* key ,int len,unsigned int seed);
+unsigned long MurmurHash64A(const void* key ,int len,unsigned long seed);
+
+// Hashes the low 3 bytes of n word ids with seeds 1 (h1) and 5 (h2), same as
+// two MurmurHash2(&id,3,seed) calls. Dispatches to the widest SIMD path the CPU supports.
+void murmur2_3byte_x2(const uint32_t* ids, size_t n, uint32_t* h1, uint32_t* h2);
+
+// Returns a specific implementation ("scalar", "sse4.1", "avx2", "avx512"),
+// or NULL if the CPU does not support it. Used by the benchmark.
+typedef void (*murmur2_x2_fn)(const uint32_t* ids, size_t n, uint32_t* h1, uint32_t* h2);
+murmur2_x2_fn murmur2_3byte_x2_impl(const char* isa);
 
 void runOnCPU (
     unsigned int*  doc_sizes,
@@ -9,7 +22,7 @@ void runOnCPU (
     unsigned long* profile_weights,
     unsigned long* profile_score,
     unsigned int   total_num_docs,
-    unsigned int   total_size);
+    unsigned long  total_size);
 
 void runOnFPGA(	
 	unsigned int*  doc_sizes,
@@ -18,5 +31,49 @@ void runOnFPGA(
 	unsigned long* profile_weights,
 	unsigned long* profile_score,
 	unsigned int   total_num_docs, 
-	unsigned int   total_doc_size,
+	unsigned long  total_doc_size,
 	int            num_iter);
+
+// Index of the device runOnFPGA uses in xcl::get_xil_devices(), 0 unless
+// runSharded gives each worker its own device
+extern unsigned int fpga_device;
+
+// Scores documents [first_doc, first_doc+num_docs), whose first word is at
+// word_offset, from the in-hash flags. Flagged words are looked up in
+// profile_weights in prefetched batches. Returns the number of lookups done.
+unsigned long scoreDocuments (
+    unsigned int*  doc_sizes,
+    unsigned int*  input_doc_words,
+    unsigned char* inh_flags,
+    unsigned long* profile_weights,
+    unsigned long* profile_score,
+    unsigned int   first_doc,
+    unsigned int   num_docs,
+    unsigned long  word_offset);
+
+// Any engine with the runOnCPU signature can score a shard
+typedef void (*score_engine_fn)(
+    unsigned int*  doc_sizes,
+    unsigned int*  input_doc_words,
+    unsigned int*  bloom_filter,
+    unsigned long* profile_weights,
+    unsigned long* profile_score,
+    unsigned int   total_num_docs,
+    unsigned long  total_size);
+
+// Coordinator: splits the corpus on document boundaries into num_workers
+// shards, scores each shard with engine in its own worker process and merges
+// the scores into profile_score through shared memory. Shards are padded with
+// docTag to a multiple of pad_words for engines that need whole blocks.
+// Worker s runs with fpga_device = s, so FPGA engines use one device each.
+void runSharded (
+    unsigned int*  doc_sizes,
+    unsigned int*  input_doc_words,
+    unsigned int*  bloom_filter,
+    unsigned long* profile_weights,
+    unsigned long* profile_score,
+    unsigned int   total_num_docs,
+    unsigned long  total_size,
+    unsigned int   num_workers,
+    unsigned int   pad_words,
+    score_engine_fn engine);
@@ -19,61 +19,51 @@ void runOnCPU (
     unsigned long* profile_weights,
     unsigned long* profile_score,
     unsigned int   total_num_docs,
-    unsigned int   total_size) 
+    unsigned long  total_size) 
 {
 
-    unsigned int size_offset=0;
+    unsigned long size_offset=0;
 
     chrono::high_resolution_clock::time_point t1 = chrono::high_resolution_clock::now();
 
     unsigned char* inh_flags = (unsigned char*)aligned_alloc(4096, total_size*sizeof(char));
 
-
     for(unsigned int doc=0;doc<total_num_docs;doc++) 
     {
         profile_score[doc] = 0.0;
-        unsigned int size = doc_sizes[doc];
+        size_offset+=doc_sizes[doc];
+    }
+
+    // The flags do not depend on document boundaries: hash the words in blocks
+    // so both MurmurHash2 seeds are computed by the batched SIMD routine
+    const unsigned hash_block = 1024;
+    unsigned int word_id[hash_block];
+    unsigned int hash_pu[hash_block];
+    unsigned int hash_lu[hash_block];
+
+    for (unsigned long n = 0; n < size_offset; n += hash_block)
+    { 
+        unsigned count = (size_offset-n < hash_block) ? size_offset-n : hash_block;
+
+        for (unsigned i = 0; i < count; i++) {
+            word_id[i] = input_doc_words[n+i] >> 8;
+        }
+        murmur2_3byte_x2(word_id, count, hash_pu, hash_lu);
 
-        for (unsigned i = 0; i < size ; i++)
-        { 
-            unsigned curr_entry = input_doc_words[size_offset+i];
-            unsigned word_id = curr_entry >> 8;
-            unsigned hash_pu =  MurmurHash2( &word_id , 3,1);
-            unsigned hash_lu =  MurmurHash2( &word_id , 3,5);
-            bool doc_end = (word_id==docTag);
-            unsigned hash1 = hash_pu&hash_bloom;
+        for (unsigned i = 0; i < count; i++)
+        {
+            bool doc_end = (word_id[i]==docTag);
+            unsigned hash1 = hash_pu[i]&hash_bloom;
             bool inh1 = (!doc_end) && (bloom_filter[ hash1 >> 5 ] & ( 1 << (hash1 & 0x1f)));
-            unsigned hash2 = (hash_pu+hash_lu)&hash_bloom;
+            unsigned hash2 = (hash_pu[i]+hash_lu[i])&hash_bloom;
             bool inh2 = (!doc_end) && (bloom_filter[ hash2 >> 5 ] & ( 1 << (hash2 & 0x1f)));
-            
-           
-            if (inh1 && inh2) {
-                inh_flags[size_offset+i]=1;
-            } else {
-                inh_flags[size_offset+i]=0;
-            }
+
+            inh_flags[n+i] = (inh1 && inh2) ? 1 : 0;
         }
-      
-        size_offset+=size;
     }
 
 
-     for(unsigned int doc=0, n=0; doc<total_num_docs;doc++) 
-    {
-        profile_score[doc] = 0.0;
-        unsigned int size = doc_sizes[doc];
-        
-        for (unsigned i = 0; i < size ; i++,n++)
-        { 
-            if(inh_flags[n]) 
-          {            
-            unsigned curr_entry = input_doc_words[n];
-            unsigned frequency = curr_entry & 0x00ff;
-            unsigned word_id = curr_entry >> 8;      
-            profile_score[doc]+= profile_weights[word_id] * (unsigned long)frequency;
-          }
-        }
-    }
+    scoreDocuments(doc_sizes, input_doc_words, inh_flags, profile_weights, profile_score, 0, total_num_docs, 0);
    
     chrono::high_resolution_clock::time_point t2 = chrono::high_resolution_clock::now();
     chrono::duration<double> time_span_cpu   = (t2-t1);
@@ -0,0 +1,172 @@
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+
+#include "xcl2.hpp"
+#include "event_trace.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// One interval on the trace, in microseconds from the first enqueued command
+struct TraceSpan {
+    unsigned int chunk;
+    double queued;
+    double submit;
+    double start;
+    double end;
+};
+
+static const int num_stages = 4;
+static const char* stage_name[num_stages] = { "Transfer to FPGA", "Kernel", "Transfer to host", "Host scoring" };
+
+static void deviceSpans(const vector<EventTimes>& events, unsigned long origin, vector<TraceSpan>& spans)
+{
+    for (unsigned i = 0; i < events.size(); i++) {
+        const EventTimes& t = events[i];
+        TraceSpan s = { i, (double)(t.queued-origin)/1000, (double)(t.submit-origin)/1000, (double)(t.start-origin)/1000, (double)(t.end-origin)/1000 };
+        spans.push_back(s);
+    }
+}
+
+// Value at rank p of sorted values
+static double percentile(const vector<double>& sorted, double p)
+{
+    if (sorted.empty()) return 0;
+    unsigned i = (unsigned)(p*(sorted.size()-1) + 0.5);
+    return sorted[i];
+}
+
+void writeEventTrace(
+    const char*                    json_file,
+    const vector<EventTimes>&      wordWait,
+    const vector<EventTimes>&      krnlWait,
+    const vector<EventTimes>&      flagWait,
+    const vector<HostSpan>&        host_spans,
+    high_resolution_clock::time_point host_start)
+{
+    // Opt-in, like timeline_trace in xrt.ini
+    const char* trace = getenv("EVENT_TRACE");
+    if (!trace || !*trace || !strcmp(trace, "0")) return;
+    if (strcmp(trace, "1")) json_file = trace;
+
+    if (wordWait.empty()) return;
+
+    // Device times are relative to the QUEUED time of the first transfer,
+    // host times to host_start, which is when that transfer was enqueued
+    unsigned long origin = wordWait.front().queued;
+
+    vector<TraceSpan> spans[num_stages];
+    deviceSpans(wordWait, origin, spans[0]);
+    deviceSpans(krnlWait, origin, spans[1]);
+    deviceSpans(flagWait, origin, spans[2]);
+    for (unsigned i = 0; i < host_spans.size(); i++) {
+        double start = duration<double, micro>(host_spans[i].start - host_start).count();
+        double end   = duration<double, micro>(host_spans[i].end - host_start).count();
+        TraceSpan s = { host_spans[i].chunk, start, start, start, end };
+        spans[3].push_back(s);
+    }
+
+    FILE* f = fopen(json_file, "w");
+    if (f) {
+        fprintf(f, "{\"traceEvents\":[\n");
+        for (int st = 0; st < num_stages; st++) {
+            fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n", st+1, stage_name[st]);
+        }
+        bool first = true;
+        for (int st = 0; st < num_stages; st++) {
+            for (unsigned i = 0; i < spans[st].size(); i++) {
+                const TraceSpan& s = spans[st][i];
+                fprintf(f, "%s{\"name\":\"%s %u\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+                           "\"args\":{\"chunk\":%u,\"queued_us\":%.3f,\"submit_us\":%.3f,\"start_us\":%.3f,\"end_us\":%.3f}}",
+                        first ? "" : ",\n", stage_name[st], s.chunk, st == 3 ? "host" : "device", st+1, s.start, s.end-s.start,
+                        s.chunk, s.queued, s.submit, s.start, s.end);
+                first = false;
+            }
+        }
+        fprintf(f, "\n],\"displayTimeUnit\":\"ms\"}\n");
+        fclose(f);
+    }
+
+    // Overlap: busy time of all the stages over the elapsed time. 1.0 means
+    // the stages ran one after the other, higher values mean they overlapped.
+    double elapsed = 0;
+    double busy = 0;
+    double kernel_busy = 0;
+    for (int st = 0; st < num_stages; st++) {
+        for (unsigned i = 0; i < spans[st].size(); i++) {
+            elapsed = max(elapsed, spans[st][i].end);
+            busy += spans[st][i].end - spans[st][i].start;
+            if (st == 1) kernel_busy += spans[st][i].end - spans[st][i].start;
+        }
+    }
+
+    printf("--------------------------------------------------------------------\n");
+    printf(" Event trace                        | %s ( %lu device events, %lu host spans )\n",
+           f ? json_file : "not written", (unsigned long)(spans[0].size()+spans[1].size()+spans[2].size()), (unsigned long)spans[3].size());
+    printf(" Stage               count   total ms     p50 ms     p90 ms     max ms  wait p50 ms\n");
+    for (int st = 0; st < num_stages; st++) {
+        vector<double> dur, wait;
+        double total = 0;
+        for (unsigned i = 0; i < spans[st].size(); i++) {
+            dur.push_back((spans[st][i].end - spans[st][i].start)/1000);
+            wait.push_back((spans[st][i].start - spans[st][i].queued)/1000);
+            total += dur.back();
+        }
+        sort(dur.begin(), dur.end());
+        sort(wait.begin(), wait.end());
+        printf(" %-18s %6lu %10.4f %10.4f %10.4f %10.4f %12.4f\n", stage_name[st], (unsigned long)dur.size(), total,
+               percentile(dur, 0.5), percentile(dur, 0.9), dur.empty() ? 0 : dur.back(), percentile(wait, 0.5));
+    }
+
+    // Duration histograms in power of two microsecond buckets
+    printf(" Duration histogram ( number of events below each power of two )\n");
+    for (int st = 0; st < num_stages; st++) {
+        unsigned long hist[32] = { 0 };
+        for (unsigned i = 0; i < spans[st].size(); i++) {
+            double us = spans[st][i].end - spans[st][i].start;
+            unsigned b = 0;
+            while (b < 31 && (double)(1UL << b) <= us) b++;
+            hist[b]++;
+        }
+        printf(" %-18s |", stage_name[st]);
+        for (int b = 0; b < 32; b++) {
+            if (hist[b]) printf(" <%luus:%lu", 1UL << b, hist[b]);
+        }
+        printf("\n");
+    }
+    if (elapsed > 0) {
+        printf(" Overlap ( busy / elapsed )         | %10.2f   ( kernel busy %.1f %% of %.3f ms )\n", busy/elapsed, 100*kernel_busy/elapsed, elapsed/1000);
+    }
+}
+
+#ifdef CL_PROFILING_COMMAND_QUEUED
+static vector<EventTimes> profilingTimes(const vector<cl::Event>& events)
+{
+    vector<EventTimes> times(events.size());
+    for (unsigned i = 0; i < events.size(); i++) {
+        cl_ulong t[4] = { 0, 0, 0, 0 };
+        events[i].getProfilingInfo(CL_PROFILING_COMMAND_QUEUED, &t[0]);
+        events[i].getProfilingInfo(CL_PROFILING_COMMAND_SUBMIT, &t[1]);
+        events[i].getProfilingInfo(CL_PROFILING_COMMAND_START,  &t[2]);
+        events[i].getProfilingInfo(CL_PROFILING_COMMAND_END,    &t[3]);
+        EventTimes e = { t[0], t[1], t[2], t[3] };
+        times[i] = e;
+    }
+    return times;
+}
+
+void writeEventTrace(
+    const char*                    json_file,
+    const vector<cl::Event>&       wordWait,
+    const vector<cl::Event>&       krnlWait,
+    const vector<cl::Event>&       flagWait,
+    const vector<HostSpan>&        host_spans,
+    high_resolution_clock::time_point host_start)
+{
+    writeEventTrace(json_file, profilingTimes(wordWait), profilingTimes(krnlWait), profilingTimes(flagWait), host_spans, host_start);
+}
+#endif
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "xcl2.hpp"
+
+// Returns the widest runOnfpga variant of compute_score_fpga.cpp found in the
+// program: runOnfpga_16x512, runOnfpga_16x256, runOnfpga, runOnfpga_8x256.
+// All the variants take the same arguments and produce the same flags, they
+// only differ in words hashed per cycle and AXI port width.
+std::string selectKernel(const cl::Program& program);
+
+// Keeps only device fpga_device of devices (see common.h) and returns it.
+// Exits when there is no such device.
+cl::Device selectDevice(std::vector<cl::Device>& devices);
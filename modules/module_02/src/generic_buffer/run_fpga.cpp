@@ -5,6 +5,8 @@
 #include "xcl2.hpp"
 #include "sizes.h"
 #include "common.h"
+#include "event_trace.h"
+#include "fpga_kernels.h"
 
 using namespace std;
 using namespace std::chrono;
@@ -24,20 +26,27 @@ void runOnFPGA(
 	unsigned long* profile_weights,
 	unsigned long* profile_score,
 	unsigned int   total_num_docs, 
-	unsigned int   total_doc_size,
+	unsigned long  total_doc_size,
         int   num_iter) 
 {
 	if ((total_doc_size/2)%64!=0) {
 		printf("--------------------------------------------------------------------\n");
 		printf("ERROR: The number of word per iterations must be a multiple of 64\n");
-		printf("       Total words = %d, Number of iterations = 2, Word per iterations = %d\n", total_doc_size,total_doc_size/2);
+		printf("       Total words = %lu, Number of iterations = 2, Word per iterations = %lu\n", total_doc_size,total_doc_size/2);
+		printf("       Skipping FPGA kernel execution\n");
+		exit(-1);
+	}
+	if (total_doc_size/2 > max_iter_size) {
+		printf("--------------------------------------------------------------------\n");
+		printf("ERROR: The number of word per iterations must not exceed %lu\n", max_iter_size);
+		printf("       Total words = %lu, Number of iterations = 2, Word per iterations = %lu\n", total_doc_size, total_doc_size/2);
 		printf("       Skipping FPGA kernel execution\n");
 		exit(-1);
 	}
 
 	// Boilerplate code to load the FPGA binary, create the kernel and command queue
 	vector<cl::Device> devices = xcl::get_xil_devices();
-	cl::Device device = devices[0];
+	cl::Device device = selectDevice(devices);
 	cl::Context context(device);
 	cl::CommandQueue q(context,device, CL_QUEUE_PROFILING_ENABLE | CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE );
 
@@ -45,16 +54,18 @@ void runOnFPGA(
 	string binary_file = kernel_name + "_" + run_type + ".awsxclbin";
 	cl::Program::Binaries bins = xcl::import_binary_file(binary_file);
 	cl::Program program(context, devices, bins);
-	cl::Kernel kernel(program,kernel_name_charptr,NULL);
+	cl::Kernel kernel(program,selectKernel(program).c_str(),NULL);
 
-	unsigned int total_size = total_doc_size;
-	unsigned char* output_inh_flags = (unsigned char*)aligned_alloc(4096, total_size*sizeof(char));
+	unsigned int total_size = 0;
+	// Host memory of the flags, declared before the buffers using it so it is freed after them
+	vector<unsigned char,aligned_allocator<unsigned char>> inh_flags_host(total_doc_size);
+	unsigned char* output_inh_flags = inh_flags_host.data();
 	bool load_filter = true;
 
 	// Create buffers
 	cl::Buffer buffer_bloom_filter(context, CL_MEM_USE_HOST_PTR | CL_MEM_READ_ONLY, bloom_filter_size*sizeof(uint),bloom_filter);
-	cl::Buffer buffer_input_doc_words(context, CL_MEM_USE_HOST_PTR | CL_MEM_READ_ONLY, total_size*sizeof(uint),input_doc_words);
-	cl::Buffer buffer_output_inh_flags(context, CL_MEM_USE_HOST_PTR | CL_MEM_WRITE_ONLY, total_size*sizeof(char),output_inh_flags);
+	cl::Buffer buffer_input_doc_words(context, CL_MEM_USE_HOST_PTR | CL_MEM_READ_ONLY, total_doc_size*sizeof(uint),input_doc_words);
+	cl::Buffer buffer_output_inh_flags(context, CL_MEM_USE_HOST_PTR | CL_MEM_WRITE_ONLY, total_doc_size*sizeof(char),output_inh_flags);
 
 	// Set buffer kernel arguments (needed to migrate the buffers in the correct memory) 
 	kernel.setArg(0, buffer_output_inh_flags);
@@ -65,8 +76,8 @@ void runOnFPGA(
 	q.enqueueMigrateMemObjects({buffer_bloom_filter, buffer_input_doc_words, buffer_output_inh_flags}, CL_MIGRATE_MEM_OBJECT_CONTENT_UNDEFINED);
 
 	// Create sub-buffers, one for each transaction 
-	unsigned subbuf_doc_sz = total_doc_size/2;
-	unsigned subbuf_inh_sz = total_doc_size/2;
+	unsigned long subbuf_doc_sz = total_doc_size/2;
+	unsigned long subbuf_inh_sz = total_doc_size/2;
 
 	cl_buffer_region subbuf_inh_info[2];
 	cl_buffer_region subbuf_doc_info[2];
@@ -145,10 +156,11 @@ void runOnFPGA(
                 q.finish();
 
 	// Compute the profile score the CPU using the in-hash flags computed on the FPGA
+	chrono::high_resolution_clock::time_point s1 = chrono::high_resolution_clock::now();
 	unsigned      curr_entry;
 	unsigned char inh_flags;
 			
-	for(unsigned int doc=0, n=0; doc<total_num_docs;doc++) 
+	for(unsigned long doc=0, n=0; doc<total_num_docs;doc++) 
 	{
 		unsigned long ans = 0;
 		unsigned int size = doc_sizes[doc];
@@ -168,6 +180,7 @@ void runOnFPGA(
 		}
 		profile_score[doc] = ans;
 	}
+	chrono::high_resolution_clock::time_point s2 = chrono::high_resolution_clock::now();
 
 	t2 = chrono::high_resolution_clock::now();
 	chrono::duration<double> perf_all_sec  = chrono::duration_cast<duration<double>>(t2-t1);
@@ -188,5 +201,9 @@ void runOnFPGA(
 		    printf(" Executed FPGA accelerated version  | %10.4f ms   ( FPGA %.3f ms )", 1000*perf_all_sec.count(), perf_hw_ms);    	
     }
 	printf("\n");
+
+	// Per-event timeline of this run and latency summary
+	vector<HostSpan> host_spans(1, HostSpan{0, s1, s2});
+	writeEventTrace("event_trace.json", wordWait, krnlWait, flagWait, host_spans, t1);
 }
 
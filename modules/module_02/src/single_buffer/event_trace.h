@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vector>
+#include <chrono>
+
+#include "xcl2.hpp"
+
+// Host-side work done for one chunk, e.g. scoring the documents covered by its flags
+struct HostSpan {
+    unsigned int chunk;
+    std::chrono::high_resolution_clock::time_point start;
+    std::chrono::high_resolution_clock::time_point end;
+};
+
+// QUEUED/SUBMIT/START/END times of one device command, in nanoseconds
+struct EventTimes {
+    unsigned long queued;
+    unsigned long submit;
+    unsigned long start;
+    unsigned long end;
+};
+
+// Writes the times of every transfer to the device (wordWait), kernel run
+// (krnlWait) and flag transfer back (flagWait) with the host spans as a
+// Chrome trace (chrome://tracing or ui.perfetto.dev) and prints per-stage
+// latency statistics and histograms. host_start is the host time at which the
+// first command was enqueued; it is used to place the device events on the
+// host time line.
+//
+// Does nothing unless the EVENT_TRACE environment variable is set: to 1 for
+// json_file, or to the name of the file to write instead.
+void writeEventTrace(
+    const char*                     json_file,
+    const std::vector<EventTimes>&  wordWait,
+    const std::vector<EventTimes>&  krnlWait,
+    const std::vector<EventTimes>&  flagWait,
+    const std::vector<HostSpan>&    host_spans,
+    std::chrono::high_resolution_clock::time_point host_start);
+
+#ifdef CL_PROFILING_COMMAND_QUEUED
+// Same with the profiling times of the OpenCL events
+void writeEventTrace(
+    const char*                    json_file,
+    const std::vector<cl::Event>&  wordWait,
+    const std::vector<cl::Event>&  krnlWait,
+    const std::vector<cl::Event>&  flagWait,
+    const std::vector<HostSpan>&   host_spans,
+    std::chrono::high_resolution_clock::time_point host_start);
+#endif
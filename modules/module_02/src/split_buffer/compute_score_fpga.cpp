@@ -12,9 +12,6 @@
 #define PARALLELISATION 8
 #endif
 
-typedef ap_uint<sizeof(int )*8*PARALLELISATION> parallel_words_t; 
-typedef ap_uint<sizeof(char)*8*PARALLELISATION> parallel_flags_t; 
-
 const unsigned int bloom_filter_size = 1<<bloom_size;
 
 unsigned int MurmurHash2(unsigned int key, int len, unsigned int seed)
@@ -34,18 +31,19 @@ unsigned int MurmurHash2(unsigned int key, int len, unsigned int seed)
   return h;
 } 
 
+template<int LANES>
 void compute_hash_flags (
-        hls::stream<parallel_flags_t>& flag_stream,
-        hls::stream<parallel_words_t>& word_stream,
-        unsigned int                   bloom_filter_local[PARALLELISATION][bloom_filter_size],
-        unsigned int                   total_size) 
+        hls::stream<ap_uint<8*LANES> >&  flag_stream,
+        hls::stream<ap_uint<32*LANES> >& word_stream,
+        unsigned int                     bloom_filter_local[LANES][bloom_filter_size],
+        unsigned int                     total_size) 
 {
-  compute_flags: for(int i=0; i<total_size/PARALLELISATION; i++)
+  compute_flags: for(int i=0; i<total_size/LANES; i++)
   {
-    parallel_words_t parallel_entries = word_stream.read();
-    parallel_flags_t inh_flags = 0;
+    ap_uint<32*LANES> parallel_entries = word_stream.read();
+    ap_uint<8*LANES> inh_flags = 0;
 
-    for (unsigned int j=0; j<PARALLELISATION; j++)
+    for (unsigned int j=0; j<LANES; j++)
     {
 #pragma HLS UNROLL
 
@@ -67,16 +65,290 @@ void compute_hash_flags (
   } 
 }
 
+template<int LANES, int BUS>
 void compute_hash_flags_dataflow(
-        ap_uint<512>*   output_flags,
-        ap_uint<512>*   input_words,
-        unsigned int    bloom_filter[PARALLELISATION][bloom_filter_size],
+        ap_uint<BUS>*   output_flags,
+        ap_uint<BUS>*   input_words,
+        unsigned int    bloom_filter[LANES][bloom_filter_size],
+        unsigned int    total_size)
+{
+    hls::stream<ap_uint<BUS> >      data_from_gmem;
+    hls::stream<ap_uint<32*LANES> > word_stream;
+    hls::stream<ap_uint<8*LANES> >  flag_stream;
+    hls::stream<ap_uint<BUS> >      data_to_gmem;
+
+    // resize counts the values of the wider of its two streams
+    const int wide_words = (BUS > 32*LANES) ? BUS/32 : LANES;
+
+#pragma HLS DATAFLOW
+
+  // Burst read BUS-bit values from global memory over AXI interface
+  hls_stream::buffer(data_from_gmem, input_words, total_size/(BUS/32));
+
+  // Form a stream of parallel words from stream of BUS-bit values
+  hls_stream::resize(word_stream, data_from_gmem, total_size/wide_words);
+
+  // Process stream of parallel word 
+  compute_hash_flags<LANES>(flag_stream, word_stream, bloom_filter, total_size);
+ 
+  // Form a stream of BUS-bit values from stream of parallel flags
+  hls_stream::resize(data_to_gmem, flag_stream, total_size/(BUS/8));
+
+  // Burst write BUS-bit values to global memory over AXI interface
+  hls_stream::buffer(output_flags, data_to_gmem, total_size/(BUS/8));
+}
+
+// Expands the blocks of a compressed corpus (see packed_corpus.h) into
+// parallel words, then pads with docTag up to total_size words. The padding
+// words of the packed stream are docTag and are skipped.
+template<int LANES>
+void decode_words (
+        hls::stream<ap_uint<32*LANES> >& word_stream,
+        hls::stream<ap_uint<32> >&       packed_stream,
+        unsigned int                     packed_size,
+        unsigned int                     total_size)
+{
+  unsigned int ids[64];
+  ap_uint<32*LANES> parallel_entries = 0;
+  unsigned int lane = 0;
+  unsigned int produced = 0;
+  unsigned int consumed = 0;
+
+  decode_blocks: while (consumed < packed_size)
+  {
+#pragma HLS LOOP_TRIPCOUNT min=1 max=65536
+    unsigned int first = packed_stream.read();
+    consumed++;
+    if (first == docTag) continue;
+
+    unsigned int info  = packed_stream.read();
+    unsigned int count = info & 0x7f;
+    unsigned int bits  = (info >> 8) & 0x1f;
+    consumed++;
+
+    // Word ids from the bit-packed deltas
+    ap_uint<64> acc = 0;
+    unsigned int avail = 0;
+    unsigned int id = first >> 8;
+    unpack_deltas: for (unsigned int i=1; i<count; i++)
+    {
+#pragma HLS LOOP_TRIPCOUNT min=1 max=63
+#pragma HLS PIPELINE II=1
+      if (avail < bits) {
+        ap_uint<64> w = packed_stream.read();
+        acc |= w << avail;
+        avail += 32;
+        consumed++;
+      }
+      id += (unsigned int)(acc & ((1u << bits) - 1));
+      acc >>= bits;
+      avail -= bits;
+      ids[i] = id << 8;
+    }
+    ids[0] = first;
+
+    // Frequencies, 4 per 32-bit word, and output
+    unsigned int freqs = 0;
+    emit_words: for (unsigned int i=0; i<count; i++)
+    {
+#pragma HLS LOOP_TRIPCOUNT min=1 max=64
+#pragma HLS PIPELINE II=1
+      unsigned int entry = ids[i];
+      if (i > 0) {
+        if ((i-1)%4 == 0) {
+          freqs = packed_stream.read();
+          consumed++;
+        }
+        entry |= (freqs >> (8*((i-1)%4))) & 0xff;
+      }
+      parallel_entries(31+lane*32, lane*32) = entry;
+      produced++;
+      if (++lane == LANES) {
+        word_stream.write(parallel_entries);
+        lane = 0;
+      }
+    }
+  }
+
+  pad_words: for (; produced < total_size; produced++)
+  {
+#pragma HLS LOOP_TRIPCOUNT min=0 max=63
+#pragma HLS PIPELINE II=1
+    parallel_entries(31+lane*32, lane*32) = docTag;
+    if (++lane == LANES) {
+      word_stream.write(parallel_entries);
+      lane = 0;
+    }
+  }
+}
+
+template<int LANES, int BUS>
+void compute_hash_flags_packed_dataflow(
+        ap_uint<BUS>*   output_flags,
+        ap_uint<BUS>*   input_packed,
+        unsigned int    bloom_filter[LANES][bloom_filter_size],
+        unsigned int    packed_size,
         unsigned int    total_size)
 {
-    hls::stream<ap_uint<512> >    data_from_gmem;
-    hls::stream<parallel_words_t> word_stream;
-    hls::stream<parallel_flags_t> flag_stream;
-    hls::stream<ap_uint<512> >    data_to_gmem;
+    hls::stream<ap_uint<BUS> >      data_from_gmem;
+    hls::stream<ap_uint<32> >       packed_stream;
+    hls::stream<ap_uint<32*LANES> > word_stream;
+    hls::stream<ap_uint<8*LANES> >  flag_stream;
+    hls::stream<ap_uint<BUS> >      data_to_gmem;
+
+#pragma HLS DATAFLOW
+
+  // Burst read the compressed corpus from global memory over AXI interface
+  hls_stream::buffer(data_from_gmem, input_packed, packed_size/(BUS/32));
+
+  // Form a stream of 32-bit values from stream of BUS-bit values
+  hls_stream::resize(packed_stream, data_from_gmem, packed_size/(BUS/32));
+
+  // Decode the blocks into a stream of parallel words
+  decode_words<LANES>(word_stream, packed_stream, packed_size, total_size);
+
+  // Process stream of parallel word 
+  compute_hash_flags<LANES>(flag_stream, word_stream, bloom_filter, total_size);
+ 
+  // Form a stream of BUS-bit values from stream of parallel flags
+  hls_stream::resize(data_to_gmem, flag_stream, total_size/(BUS/8));
+
+  // Burst write BUS-bit values to global memory over AXI interface
+  hls_stream::buffer(output_flags, data_to_gmem, total_size/(BUS/8));
+}
+
+// Group of LANES words holding at least one in-hash word
+template<int LANES>
+struct hit_group_t {
+  ap_uint<32*LANES> words;
+  ap_uint<LANES>    flags;
+  unsigned int      group;
+  bool              last;
+};
+
+// Same flags as compute_hash_flags, but only the groups of words with a flag
+// set are forwarded, followed by a group marked last
+template<int LANES>
+void compute_hash_hits (
+        hls::stream<hit_group_t<LANES> >& hit_stream,
+        hls::stream<ap_uint<32*LANES> >&  word_stream,
+        unsigned int                      bloom_filter_local[LANES][bloom_filter_size],
+        unsigned int                      total_size) 
+{
+  compute_hits: for(int i=0; i<total_size/LANES; i++)
+  {
+#pragma HLS PIPELINE II=1
+    hit_group_t<LANES> hit;
+    hit.words = word_stream.read();
+    hit.flags = 0;
+    hit.group = i;
+    hit.last  = false;
+
+    for (unsigned int j=0; j<LANES; j++)
+    {
+#pragma HLS UNROLL
+
+      unsigned int curr_entry = hit.words(31+j*32, j*32);
+      unsigned int word_id = curr_entry >> 8;
+      unsigned hash_pu = MurmurHash2(word_id, 3, 1);
+      unsigned hash_lu = MurmurHash2(word_id, 3, 5);
+      bool doc_end= (word_id==docTag); 
+      unsigned hash1 = hash_pu&hash_bloom; 
+      bool inh1 = (!doc_end) && (bloom_filter_local[j][ hash1 >> 5 ] & ( 1 << (hash1 & 0x1f)));
+      unsigned hash2=(hash_pu+hash_lu)&hash_bloom;
+      bool inh2 = (!doc_end) && (bloom_filter_local[j][ hash2 >> 5 ] & ( 1 << (hash2 & 0x1f)));
+
+      hit.flags[j] = (inh1 && inh2) ? 1 : 0;
+    }
+
+    if (hit.flags != 0) hit_stream.write(hit);
+  }
+
+  hit_group_t<LANES> last;
+  last.words = 0;
+  last.flags = 0;
+  last.group = 0;
+  last.last  = true;
+  hit_stream.write(last);
+}
+
+// Adds weight*frequency of the in-hash words to the score of their document
+// and writes one score per document. Documents are walked with doc_sizes as
+// the hits come in. Weights come from the compact profile table: word_id keys
+// placed at MurmurHash2(word_id,3,1) with linear probing, docTag for empty.
+template<int LANES>
+void accumulate_scores (
+        hls::stream<ap_uint<64> >&        score_stream,
+        hls::stream<hit_group_t<LANES> >& hit_stream,
+        unsigned int*                     doc_sizes,
+        unsigned int                      table_keys[profile_table_max],
+        unsigned long                     table_weights[profile_table_max],
+        unsigned int                      table_size,
+        unsigned int                      num_docs)
+{
+  unsigned int  doc = 0;
+  unsigned long doc_end = num_docs ? doc_sizes[0] : 0;
+  ap_uint<64>   score = 0;
+
+  accumulate_hits: while (true)
+  {
+#pragma HLS LOOP_TRIPCOUNT min=1 max=65536
+    hit_group_t<LANES> hit = hit_stream.read();
+    if (hit.last) break;
+
+    accumulate_lanes: for (unsigned int j=0; j<LANES; j++)
+    {
+      if (!hit.flags[j]) continue;
+
+      unsigned long n = (unsigned long)hit.group*LANES + j;
+      next_doc: while (n >= doc_end) {
+#pragma HLS LOOP_TRIPCOUNT min=0 max=1
+        score_stream.write(score);
+        score = 0;
+        doc++;
+        doc_end += doc_sizes[doc];
+      }
+
+      unsigned int curr_entry = hit.words(31+j*32, j*32);
+      unsigned int frequency = curr_entry & 0x00ff;
+      unsigned int word_id = curr_entry >> 8;
+      unsigned int slot = MurmurHash2(word_id, 3, 1) & (table_size-1);
+      probe: while (table_keys[slot] != word_id && table_keys[slot] != docTag) {
+#pragma HLS LOOP_TRIPCOUNT min=0 max=2
+        slot = (slot+1) & (table_size-1);
+      }
+      if (table_keys[slot] == word_id) {
+        score += (ap_uint<64>)table_weights[slot] * frequency;
+      }
+    }
+  }
+
+  flush_scores: for (; doc < num_docs; doc++)
+  {
+#pragma HLS PIPELINE II=1
+    score_stream.write(score);
+    score = 0;
+  }
+}
+
+template<int LANES>
+void compute_scores_dataflow(
+        ap_uint<512>*   output_scores,
+        ap_uint<512>*   input_words,
+        unsigned int*   doc_sizes,
+        unsigned int    bloom_filter[LANES][bloom_filter_size],
+        unsigned int    table_keys[profile_table_max],
+        unsigned long   table_weights[profile_table_max],
+        unsigned int    table_size,
+        unsigned int    total_size,
+        unsigned int    num_docs)
+{
+    hls::stream<ap_uint<512> >       data_from_gmem;
+    hls::stream<ap_uint<32*LANES> >  word_stream;
+    hls::stream<hit_group_t<LANES> > hit_stream;
+    hls::stream<ap_uint<64> >        score_stream;
+    hls::stream<ap_uint<512> >       data_to_gmem;
+#pragma HLS STREAM variable=hit_stream depth=64
 
 #pragma HLS DATAFLOW
 
@@ -86,56 +358,195 @@ void compute_hash_flags_dataflow(
   // Form a stream of parallel words from stream of 512-bit values
   hls_stream::resize(word_stream, data_from_gmem, total_size/(512/32));
 
-  // Process stream of parallel word 
-  compute_hash_flags(flag_stream, word_stream, bloom_filter, total_size);
- 
-  // Form a stream of 512-bit values from stream of parallel flags
-  hls_stream::resize(data_to_gmem, flag_stream, total_size/(512/8));
+  // Keep the groups of words with in-hash words
+  compute_hash_hits<LANES>(hit_stream, word_stream, bloom_filter, total_size);
+
+  // Accumulate the scores of the documents
+  accumulate_scores<LANES>(score_stream, hit_stream, doc_sizes, table_keys, table_weights, table_size, num_docs);
+
+  // Form a stream of 512-bit values from stream of scores
+  hls_stream::resize(data_to_gmem, score_stream, num_docs/(512/64));
 
   // Burst write 512-bit values to global memory over AXI interface
-  hls_stream::buffer(output_flags, data_to_gmem, total_size/(512/8));
+  hls_stream::buffer(output_scores, data_to_gmem, num_docs/(512/64));
+}
+
+template<int LANES>
+void read_bloom_filter(
+        unsigned int*  bloom_filter,
+        unsigned int   bloom_filter_local[LANES][bloom_filter_size])
+{
+  read_bloom_filter: for(int index=0; index<bloom_filter_size; index++) {
+#pragma HLS PIPELINE II=1
+    unsigned int tmp = bloom_filter[index];
+    for (int j=0; j<LANES; j++) {
+      bloom_filter_local[j][index] = tmp;
+    }
+  }
+}
+
+// Kernel body for LANES words hashed per cycle over BUS-bit AXI ports. The
+// bloom filter copies are static, so each instantiation keeps its own between
+// calls. BUS must be a multiple of 32*LANES or the other way round, and the
+// number of words a multiple of BUS/8.
+template<int LANES, int BUS>
+void runOnfpga_body (
+        ap_uint<BUS>*  output_flags,
+        ap_uint<BUS>*  input_words,
+        unsigned int*  bloom_filter,
+        unsigned int   total_size,
+        bool           load_filter)
+{
+  static unsigned int bloom_filter_local[LANES][bloom_filter_size];
+#pragma HLS ARRAY_PARTITION variable=bloom_filter_local complete dim=1
+
+  if(load_filter==true) 
+  {
+    read_bloom_filter<LANES>(bloom_filter, bloom_filter_local);
+  }
+
+  compute_hash_flags_dataflow<LANES, BUS>(
+    output_flags,
+    input_words,
+    bloom_filter_local,
+    total_size);
 }
 
+// Exports runOnfpga_body<LANES, BUS> as the kernel NAME. Build the variants
+// wanted in the xclbin with v++ -k NAME; the host uses the widest one present.
+#define RUN_ON_FPGA_KERNEL(NAME, LANES, BUS) \
+  void NAME ( \
+          ap_uint<BUS>*  output_flags, \
+          ap_uint<BUS>*  input_words, \
+          unsigned int*  bloom_filter, \
+          unsigned int   total_size, \
+          bool           load_filter) \
+  { \
+  _Pragma("HLS INTERFACE ap_ctrl_chain port=return            bundle=control") \
+  _Pragma("HLS INTERFACE s_axilite     port=return            bundle=control") \
+  _Pragma("HLS INTERFACE s_axilite     port=output_flags      bundle=control") \
+  _Pragma("HLS INTERFACE s_axilite     port=input_words       bundle=control") \
+  _Pragma("HLS INTERFACE s_axilite     port=bloom_filter      bundle=control") \
+  _Pragma("HLS INTERFACE s_axilite     port=total_size        bundle=control") \
+  _Pragma("HLS INTERFACE s_axilite     port=load_filter       bundle=control") \
+  _Pragma("HLS INTERFACE m_axi         port=output_flags      bundle=maxiport0   offset=slave") \
+  _Pragma("HLS INTERFACE m_axi         port=input_words       bundle=maxiport0   offset=slave") \
+  _Pragma("HLS INTERFACE m_axi         port=bloom_filter      bundle=maxiport1   offset=slave") \
+    runOnfpga_body<LANES, BUS>(output_flags, input_words, bloom_filter, total_size, load_filter); \
+  }
+
 extern "C" 
 {
+  // PARALLELISATION (8 by default) lanes on 512-bit ports, the kernel of the prebuilt binaries
+  RUN_ON_FPGA_KERNEL(runOnfpga,        PARALLELISATION, 512)
+
+  RUN_ON_FPGA_KERNEL(runOnfpga_8x256,  8,  256)
+  RUN_ON_FPGA_KERNEL(runOnfpga_16x256, 16, 256)
+  RUN_ON_FPGA_KERNEL(runOnfpga_16x512, 16, 512)
 
-  void runOnfpga (
+  // Same as runOnfpga on a compressed corpus: input_packed holds packed_size
+  // 32-bit words (a multiple of 16, padded with docTag) which decode into
+  // total_size words. The flags are those of the decoded, sorted corpus.
+  void runOnfpga_packed (
           ap_uint<512>*  output_flags,
-          ap_uint<512>*  input_words,
+          ap_uint<512>*  input_packed,
           unsigned int*  bloom_filter,
+          unsigned int   packed_size,
           unsigned int   total_size,
           bool           load_filter)
   {
   #pragma HLS INTERFACE ap_ctrl_chain port=return            bundle=control
   #pragma HLS INTERFACE s_axilite     port=return            bundle=control
   #pragma HLS INTERFACE s_axilite     port=output_flags      bundle=control
-  #pragma HLS INTERFACE s_axilite     port=input_words       bundle=control
+  #pragma HLS INTERFACE s_axilite     port=input_packed      bundle=control
   #pragma HLS INTERFACE s_axilite     port=bloom_filter      bundle=control
+  #pragma HLS INTERFACE s_axilite     port=packed_size       bundle=control
   #pragma HLS INTERFACE s_axilite     port=total_size        bundle=control
   #pragma HLS INTERFACE s_axilite     port=load_filter       bundle=control
 
   #pragma HLS INTERFACE m_axi         port=output_flags      bundle=maxiport0   offset=slave 
+  #pragma HLS INTERFACE m_axi         port=input_packed      bundle=maxiport0   offset=slave 
+  #pragma HLS INTERFACE m_axi         port=bloom_filter      bundle=maxiport1   offset=slave 
+
+    static unsigned int bloom_filter_local[PARALLELISATION][bloom_filter_size];
+  #pragma HLS ARRAY_PARTITION variable=bloom_filter_local complete dim=1
+
+    if(load_filter==true) 
+    {
+      read_bloom_filter<PARALLELISATION>(bloom_filter, bloom_filter_local);
+    }
+
+    compute_hash_flags_packed_dataflow<PARALLELISATION, 512>(
+      output_flags,
+      input_packed,
+      bloom_filter_local,
+      packed_size,
+      total_size);
+  }
+
+  // Scores the documents on the device: doc_sizes gives the num_docs document
+  // sizes (num_docs a multiple of 8, padded with empty documents) and the
+  // compact profile table (table_keys/table_weights, table_size slots, a power
+  // of two up to profile_table_max) is loaded with the bloom filter. Writes
+  // one 64-bit score per document instead of one flag per word.
+  void runOnfpga_score (
+          ap_uint<512>*  output_scores,
+          ap_uint<512>*  input_words,
+          unsigned int*  bloom_filter,
+          unsigned int*  doc_sizes,
+          unsigned int*  table_keys,
+          unsigned long* table_weights,
+          unsigned int   table_size,
+          unsigned int   total_size,
+          unsigned int   num_docs,
+          bool           load_filter)
+  {
+  #pragma HLS INTERFACE ap_ctrl_chain port=return            bundle=control
+  #pragma HLS INTERFACE s_axilite     port=return            bundle=control
+  #pragma HLS INTERFACE s_axilite     port=output_scores     bundle=control
+  #pragma HLS INTERFACE s_axilite     port=input_words       bundle=control
+  #pragma HLS INTERFACE s_axilite     port=bloom_filter      bundle=control
+  #pragma HLS INTERFACE s_axilite     port=doc_sizes         bundle=control
+  #pragma HLS INTERFACE s_axilite     port=table_keys        bundle=control
+  #pragma HLS INTERFACE s_axilite     port=table_weights     bundle=control
+  #pragma HLS INTERFACE s_axilite     port=table_size        bundle=control
+  #pragma HLS INTERFACE s_axilite     port=total_size        bundle=control
+  #pragma HLS INTERFACE s_axilite     port=num_docs          bundle=control
+  #pragma HLS INTERFACE s_axilite     port=load_filter       bundle=control
+
+  #pragma HLS INTERFACE m_axi         port=output_scores     bundle=maxiport0   offset=slave 
   #pragma HLS INTERFACE m_axi         port=input_words       bundle=maxiport0   offset=slave 
   #pragma HLS INTERFACE m_axi         port=bloom_filter      bundle=maxiport1   offset=slave 
+  #pragma HLS INTERFACE m_axi         port=doc_sizes         bundle=maxiport1   offset=slave 
+  #pragma HLS INTERFACE m_axi         port=table_keys        bundle=maxiport1   offset=slave 
+  #pragma HLS INTERFACE m_axi         port=table_weights     bundle=maxiport1   offset=slave 
 
     static unsigned int bloom_filter_local[PARALLELISATION][bloom_filter_size];
   #pragma HLS ARRAY_PARTITION variable=bloom_filter_local complete dim=1
+    static unsigned int  table_keys_local[profile_table_max];
+    static unsigned long table_weights_local[profile_table_max];
 
     if(load_filter==true) 
     {
-      read_bloom_filter: for(int index=0; index<bloom_filter_size; index++) {
+      read_bloom_filter<PARALLELISATION>(bloom_filter, bloom_filter_local);
+
+      read_profile_table: for(int index=0; index<table_size; index++) {
+  #pragma HLS LOOP_TRIPCOUNT min=1024 max=65536
   #pragma HLS PIPELINE II=1
-        unsigned int tmp = bloom_filter[index];
-        for (int j=0; j<PARALLELISATION; j++) {
-          bloom_filter_local[j][index] = tmp;
-        }
+        table_keys_local[index] = table_keys[index];
+        table_weights_local[index] = table_weights[index];
       }
     }
 
-    compute_hash_flags_dataflow(
-      output_flags,
+    compute_scores_dataflow<PARALLELISATION>(
+      output_scores,
       input_words,
+      doc_sizes,
       bloom_filter_local,
-      total_size);
+      table_keys_local,
+      table_weights_local,
+      table_size,
+      total_size,
+      num_docs);
   }
 }
@@ -4,3 +4,10 @@
 #define bloom_size 14
 #define docTag 0xffffffff
 
+// Maximum number of words processed by one kernel call (1 GByte of words).
+// Keeps the 32-bit total_size kernel argument and each sub-buffer within device limits.
+#define max_iter_size (1UL << 28)
+
+// Maximum number of slots of the compact profile table held on-chip by the
+// scoring kernel (open addressing, word_id keys, empty slots hold docTag)
+#define profile_table_max (1UL << 16)
@@ -0,0 +1,148 @@
+#include<cstdio>
+#include<cstdlib>
+#include<cstring>
+#include<cstdint>
+
+#include"sizes.h"
+#include "common.h"
+
+// Profile weight lookup stage shared by the CPU and FPGA flows.
+//
+// profile_weights has 16M entries (128 MBytes), so every flagged word is a
+// random DRAM access. Rather than accumulating each flagged word as it is
+// found, the (word_id, frequency, doc) tuples are collected in small batches.
+// A batch is prefetched as soon as it is full and accumulated one batch later,
+// so the loads of a whole batch are in flight while the previous one is summed.
+
+static const unsigned lookup_batch = 32;
+
+struct LookupBatch {
+    unsigned int word_id[lookup_batch];
+    unsigned int frequency[lookup_batch];
+    unsigned int doc[lookup_batch];
+    unsigned int count;
+};
+
+static inline void prefetchBatch(const LookupBatch& batch, const unsigned long* profile_weights)
+{
+    for (unsigned i = 0; i < batch.count; i++) {
+        __builtin_prefetch(&profile_weights[batch.word_id[i]], 0, 0);
+    }
+}
+
+static inline void accumulateBatch(LookupBatch& batch, const unsigned long* profile_weights, unsigned long* profile_score)
+{
+    for (unsigned i = 0; i < batch.count; i++) {
+        profile_score[batch.doc[i]] += profile_weights[batch.word_id[i]] * (unsigned long)batch.frequency[i];
+    }
+    batch.count = 0;
+}
+
+// Packed words: (word_id << 8) | frequency
+struct PackedWords {
+    const unsigned int* words;
+    unsigned int wordId(unsigned long n) const { return words[n] >> 8; }
+    unsigned int frequency(unsigned long n) const { return words[n] & 0x00ff; }
+};
+
+// Structure-of-arrays words: separate word_id and frequency streams
+struct SoAWords {
+    const unsigned int*  word_ids;
+    const unsigned char* frequencies;
+    unsigned int wordId(unsigned long n) const { return word_ids[n]; }
+    unsigned int frequency(unsigned long n) const { return frequencies[n]; }
+};
+
+template <typename Words>
+static unsigned long scoreWords (
+    unsigned int*  doc_sizes,
+    const Words&   words,
+    unsigned char* inh_flags,
+    unsigned long* profile_weights,
+    unsigned long* profile_score,
+    unsigned int   first_doc,
+    unsigned int   num_docs,
+    unsigned long  word_offset)
+{
+    LookupBatch batches[2];
+    LookupBatch* curr = &batches[0];
+    LookupBatch* prev = &batches[1];
+    curr->count = 0;
+    prev->count = 0;
+
+    unsigned long lookups = 0;
+    unsigned long n = word_offset;
+
+    for (unsigned int doc = first_doc; doc < first_doc+num_docs; doc++)
+    {
+        profile_score[doc] = 0;
+        unsigned long end = n + doc_sizes[doc];
+
+        while (n < end)
+        {
+            // Most flags are zero: skip them 8 at a time
+            if (n+8 <= end) {
+                uint64_t flags8;
+                memcpy(&flags8, &inh_flags[n], sizeof(flags8));
+                if (flags8 == 0) {
+                    n += 8;
+                    continue;
+                }
+            }
+
+            if (inh_flags[n])
+            {
+                curr->word_id[curr->count]   = words.wordId(n);
+                curr->frequency[curr->count] = words.frequency(n);
+                curr->doc[curr->count]       = doc;
+                curr->count++;
+
+                if (curr->count == lookup_batch) {
+                    prefetchBatch(*curr, profile_weights);
+                    accumulateBatch(*prev, profile_weights, profile_score);
+                    LookupBatch* tmp = prev;
+                    prev = curr;
+                    curr = tmp;
+                    lookups += lookup_batch;
+                }
+            }
+            n++;
+        }
+    }
+
+    lookups += curr->count;
+    prefetchBatch(*curr, profile_weights);
+    accumulateBatch(*prev, profile_weights, profile_score);
+    accumulateBatch(*curr, profile_weights, profile_score);
+
+    return lookups;
+}
+
+unsigned long scoreDocuments (
+    unsigned int*  doc_sizes,
+    unsigned int*  input_doc_words,
+    unsigned char* inh_flags,
+    unsigned long* profile_weights,
+    unsigned long* profile_score,
+    unsigned int   first_doc,
+    unsigned int   num_docs,
+    unsigned long  word_offset)
+{
+    PackedWords words = { input_doc_words };
+    return scoreWords(doc_sizes, words, inh_flags, profile_weights, profile_score, first_doc, num_docs, word_offset);
+}
+
+unsigned long scoreDocumentsSoA (
+    unsigned int*  doc_sizes,
+    unsigned int*  word_ids,
+    unsigned char* frequencies,
+    unsigned char* inh_flags,
+    unsigned long* profile_weights,
+    unsigned long* profile_score,
+    unsigned int   first_doc,
+    unsigned int   num_docs,
+    unsigned long  word_offset)
+{
+    SoAWords words = { word_ids, frequencies };
+    return scoreWords(doc_sizes, words, inh_flags, profile_weights, profile_score, first_doc, num_docs, word_offset);
+}
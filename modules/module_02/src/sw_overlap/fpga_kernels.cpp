@@ -0,0 +1,56 @@
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+
+#include "xcl2.hpp"
+#include "common.h"
+#include "fpga_kernels.h"
+
+using namespace std;
+
+unsigned int fpga_device = 0;
+
+struct KernelVariant {
+    const char* name;
+    unsigned int lanes;
+    unsigned int bus_width;
+};
+
+// Widest first. runOnfpga is PARALLELISATION lanes, 8 unless built otherwise.
+static const KernelVariant kernel_variants[] = {
+    { "runOnfpga_16x512", 16, 512 },
+    { "runOnfpga_16x256", 16, 256 },
+    { "runOnfpga",         8, 512 },
+    { "runOnfpga_8x256",   8, 256 },
+};
+
+string selectKernel(const cl::Program& program)
+{
+    string names;
+    program.getInfo(CL_PROGRAM_KERNEL_NAMES, &names);
+    names = ";" + names + ";";
+
+    for (unsigned i = 0; i < sizeof(kernel_variants)/sizeof(kernel_variants[0]); i++) {
+        if (names.find(string(";") + kernel_variants[i].name + ";") != string::npos) {
+            printf("Using kernel %s ( %u lanes, %u-bit ports )\n", kernel_variants[i].name, kernel_variants[i].lanes, kernel_variants[i].bus_width);
+            return kernel_variants[i].name;
+        }
+    }
+
+    printf("--------------------------------------------------------------------\n");
+    printf("ERROR: No runOnfpga kernel in the FPGA binary ( kernels: %s )\n", names.c_str());
+    printf("--------------------------------------------------------------------\n");
+    exit(-1);
+}
+
+cl::Device selectDevice(vector<cl::Device>& devices)
+{
+    if (fpga_device >= devices.size()) {
+        printf("--------------------------------------------------------------------\n");
+        printf("ERROR: FPGA device %u requested, %lu found\n", fpga_device, (unsigned long)devices.size());
+        printf("--------------------------------------------------------------------\n");
+        exit(-1);
+    }
+    devices = vector<cl::Device>(1, devices[fpga_device]);
+    return devices[0];
+}
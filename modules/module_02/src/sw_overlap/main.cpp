@@ -8,6 +8,8 @@
 #include<vector>
 #include<utility>
 #include<random>
+#include<string>
+#include<cstring>
 #include"xcl2.hpp"
 #include"sizes.h"
 #include"common.h"
@@ -19,7 +21,7 @@ using namespace std::chrono;
 vector<unsigned int,aligned_allocator<unsigned int>> input_doc_words;
 vector<unsigned long,aligned_allocator<unsigned long>> profile_weights;
 vector<unsigned int,aligned_allocator<unsigned int>> bloom_filter;
-vector<unsigned int,aligned_allocator<unsigned int>> starting_doc_id;
+vector<unsigned long,aligned_allocator<unsigned long>> starting_doc_id;
 vector<unsigned long,aligned_allocator<unsigned long>> fpga_profileScore;
 vector<unsigned int,aligned_allocator<unsigned int>> doc_sizes;
 vector<unsigned long,aligned_allocator<unsigned long>> cpu_profileScore;
@@ -28,7 +30,7 @@ default_random_engine generator;
 normal_distribution<double> distribution(3500,500);
 
 unsigned int total_num_docs;
-unsigned size=0;
+unsigned long size=0;
 unsigned block_size;
 
 unsigned doc_len()
@@ -40,6 +42,8 @@ unsigned doc_len()
 }
 
 
+void setupProfile();
+
 void setupData()
 {
     starting_doc_id.reserve( total_num_docs );
@@ -49,7 +53,7 @@ void setupData()
     //  h_docInfo.reserve( total_num_docs );
 
     doc_sizes.reserve( total_num_docs );
-    unsigned unpadded_size=0;
+    unsigned long unpadded_size=0;
 
     for (unsigned i=0; i<total_num_docs; i++) {
         unsigned len_doc = doc_len();
@@ -58,22 +62,21 @@ void setupData()
         doc_sizes[i] = len_doc;
     }
     
-    size = unpadded_size&(~(block_size-1));
+    size = unpadded_size&(~((unsigned long)block_size-1));
     if(unpadded_size & (block_size-1)) size+=block_size;
-    bloom_filter.reserve( (1L << bloom_size) );
     input_doc_words.reserve( size );
 
     // double mbytes = size*sizeof(int)/(1000000.0);
 
-    printf("Creating documents - total size : %.3f MBytes (%d words)\n", size*sizeof(int)/1000000.0, size);
+    printf("Creating documents - total size : %.3f MBytes (%lu words)\n", size*sizeof(int)/1000000.0, size);
     // std::cout << "Creating documents of total size = "<< size  << " words" << endl;
 
-    for (unsigned i=0; i<size; i++) {
+    for (unsigned long i=0; i<size; i++) {
         input_doc_words[i] = docTag;
     }
     for (unsigned doci=0; doci < total_num_docs; doci++)
     {
-        unsigned start_dimm1 = starting_doc_id[doci];
+        unsigned long start_dimm1 = starting_doc_id[doci];
         unsigned size_1 = doc_sizes[doci];
         unsigned term;
         unsigned freq;
@@ -86,6 +89,12 @@ void setupData()
         }
     }
 
+    setupProfile();
+}
+
+void setupProfile()
+{
+    bloom_filter.reserve( (1L << bloom_size) );
     profile_weights.reserve( (1L << 24) );
     for (unsigned i=0; i<(1L << bloom_size); i++) {
         bloom_filter[i] = 0x0;
@@ -97,15 +106,18 @@ void setupData()
         profile_weights[i] = 0;
     }
 
-    for (unsigned i=0; i<16384; i++) {
-        unsigned entry = (rand()%(1<<24));	
+    const unsigned num_entries = 16384;
+    vector<unsigned int> entry(num_entries), hash_pu(num_entries), hash_lu(num_entries);
 
-        profile_weights[entry] = 10;
-        unsigned hash_pu = MurmurHash2(&entry,3,1);
-        unsigned hash_lu = MurmurHash2(&entry,3,5);
+    for (unsigned i=0; i<num_entries; i++) {
+        entry[i] = (rand()%(1<<24));	
+        profile_weights[entry[i]] = 10;
+    }
+    murmur2_3byte_x2(entry.data(), num_entries, hash_pu.data(), hash_lu.data());
 
-        unsigned hash1 = hash_pu&hash_bloom; 
-        unsigned hash2 = (hash_pu+hash_lu)&hash_bloom;
+    for (unsigned i=0; i<num_entries; i++) {
+        unsigned hash1 = hash_pu[i]&hash_bloom; 
+        unsigned hash2 = (hash_pu[i]+hash_lu[i])&hash_bloom;
 
         bloom_filter[ hash1 >> 5 ] |= 1 << (hash1 & 0x1f);
         bloom_filter[ hash2 >> 5 ] |= 1 << (hash2 & 0x1f);
@@ -113,11 +125,96 @@ void setupData()
 
 }
 
+// Load a corpus written by the ingest tool: <prefix>.sizes holds the number of
+// words of each document, <prefix>.words the packed words of all documents
+bool loadData(const char* prefix)
+{
+    string sizes_file = string(prefix) + ".sizes";
+    string words_file = string(prefix) + ".words";
+    FILE* fsizes = fopen(sizes_file.c_str(), "rb");
+    FILE* fwords = fopen(words_file.c_str(), "rb");
+    if (!fsizes || !fwords) {
+        printf("ERROR: Cannot open %s and %s\n", sizes_file.c_str(), words_file.c_str());
+        if (fsizes) fclose(fsizes);
+        if (fwords) fclose(fwords);
+        return false;
+    }
+
+    fseek(fsizes, 0, SEEK_END);
+    total_num_docs = ftell(fsizes)/sizeof(unsigned int);
+    rewind(fsizes);
+
+    doc_sizes.resize( total_num_docs );
+    starting_doc_id.resize( total_num_docs );
+    fpga_profileScore.resize( total_num_docs );
+    cpu_profileScore.resize( total_num_docs );
+    if (fread(doc_sizes.data(), sizeof(unsigned int), total_num_docs, fsizes) != total_num_docs) {
+        printf("ERROR: Cannot read %s\n", sizes_file.c_str());
+        fclose(fsizes);
+        fclose(fwords);
+        return false;
+    }
+
+    unsigned long unpadded_size=0;
+    for (unsigned i=0; i<total_num_docs; i++) {
+        starting_doc_id[i] = unpadded_size;
+        unpadded_size+=doc_sizes[i];
+    }
+
+    size = unpadded_size&(~((unsigned long)block_size-1));
+    if(unpadded_size & (block_size-1)) size+=block_size;
+    input_doc_words.resize( size, docTag );
+
+    printf("Loading documents - total size : %.3f MBytes (%lu words, %u documents)\n", size*sizeof(int)/1000000.0, size, total_num_docs);
+
+    if (fread(input_doc_words.data(), sizeof(unsigned int), unpadded_size, fwords) != unpadded_size) {
+        printf("ERROR: Cannot read %lu words from %s\n", unpadded_size, words_file.c_str());
+        fclose(fsizes);
+        fclose(fwords);
+        return false;
+    }
+    fclose(fsizes);
+    fclose(fwords);
+
+    setupProfile();
+    return true;
+}
+
+// runOnFPGA with the num_iter of the command line, as the engine of the
+// sharded workers
+static int shard_num_iter;
+
+static void runOnFPGA_shard(
+    unsigned int*  doc_sizes,
+    unsigned int*  input_doc_words,
+    unsigned int*  bloom_filter,
+    unsigned long* profile_weights,
+    unsigned long* profile_score,
+    unsigned int   total_num_docs,
+    unsigned long  total_size)
+{
+    runOnFPGA(doc_sizes, input_doc_words, bloom_filter, profile_weights, profile_score, total_num_docs, total_size, shard_num_iter);
+}
+
 int main(int argc, char** argv)
 {
     int num_iter;
+    const char* corpus = NULL;
+    unsigned num_workers = 0;
 
-    switch(argc) {
+    // ./host [-w workers] <num_docs> [num_iter] generates random documents,
+    // ./host [-w workers] -f <prefix> [num_iter] loads documents written by the ingest tool.
+    // With -w the corpus is split between that many worker processes, worker s
+    // running runOnFPGA on FPGA device s.
+    if (argc >= 3 && strcmp(argv[1], "-w") == 0) {
+        num_workers = atoi(argv[2]);
+        argc -= 2;
+        argv += 2;
+    }
+    if (argc >= 3 && strcmp(argv[1], "-f") == 0) {
+        corpus = argv[2];
+        num_iter = (argc > 3) ? atoi(argv[3]) : 2;
+    } else switch(argc) {
       case 2: 
          total_num_docs=atoi(argv[1]);
          num_iter = 2;
@@ -133,17 +230,36 @@ int main(int argc, char** argv)
 
     std::cout << "Initializing data"<< endl;
     block_size = num_iter*64;
-    setupData();
+    if (corpus) {
+        if (!loadData(corpus)) return 1;
+    } else {
+        setupData();
+    }
 
-    runOnFPGA(
-        doc_sizes.data(),
-        input_doc_words.data(),
-        bloom_filter.data(),
-        profile_weights.data(),
-        fpga_profileScore.data(),
-        total_num_docs,
-        size,
-        num_iter) ;
+    if (num_workers) {
+        shard_num_iter = num_iter;
+        runSharded(
+            doc_sizes.data(),
+            input_doc_words.data(),
+            bloom_filter.data(),
+            profile_weights.data(),
+            fpga_profileScore.data(),
+            total_num_docs,
+            size,
+            num_workers,
+            block_size,
+            runOnFPGA_shard) ;
+    } else {
+        runOnFPGA(
+            doc_sizes.data(),
+            input_doc_words.data(),
+            bloom_filter.data(),
+            profile_weights.data(),
+            fpga_profileScore.data(),
+            total_num_docs,
+            size,
+            num_iter) ;
+    }
   
      runOnCPU(
         doc_sizes.data(),
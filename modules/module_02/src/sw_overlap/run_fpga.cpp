@@ -1,10 +1,13 @@
 #include <vector>
+#include <algorithm>
 #include <cstdio>
 #include <ctime>
 
 #include "xcl2.hpp"
 #include "sizes.h"
 #include "common.h"
+#include "event_trace.h"
+#include "fpga_kernels.h"
 
 using namespace std;
 using namespace std::chrono;
@@ -24,20 +27,29 @@ void runOnFPGA(
 	unsigned long* profile_weights,
 	unsigned long* profile_score,
 	unsigned int   total_num_docs, 
-	unsigned int   total_doc_size,
+	unsigned long  total_doc_size,
 	int            num_iter)
 {
-	if ((total_doc_size/num_iter)%64!=0) {
+	if (total_doc_size%64!=0) {
 		printf("--------------------------------------------------------------------\n");
-		printf("ERROR: The number of word per iterations must be a multiple of 64\n");
-		printf("       Total words = %d, Number of iterations = %d, Word per iterations = %d\n", total_doc_size, num_iter, total_doc_size/num_iter);
+		printf("ERROR: The number of words must be a multiple of 64\n");
+		printf("       Total words = %lu\n", total_doc_size);
 		printf("       Skipping FPGA kernel execution\n");
 		exit(-1);
 	}
 
+	// Split the data in chunks of a multiple of 64 words (one 512-bit burst of flags).
+	// More iterations are used if a chunk would exceed max_iter_size; the last one gets the remainder.
+	unsigned long words_per_iter = ((total_doc_size + num_iter - 1)/num_iter + 63) & ~63UL;
+	if (words_per_iter > max_iter_size) {
+		words_per_iter = max_iter_size;
+	}
+	int requested_iter = num_iter;
+	num_iter = (total_doc_size + words_per_iter - 1)/words_per_iter;
+
 	// Boilerplate code to load the FPGA binary, create the kernel and command queue
 	vector<cl::Device> devices = xcl::get_xil_devices();
-	cl::Device device = devices[0];
+	cl::Device device = selectDevice(devices);
 	cl::Context context(device);
 	cl::CommandQueue q(context,device, CL_QUEUE_PROFILING_ENABLE | CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE );
 
@@ -45,16 +57,18 @@ void runOnFPGA(
 	string binary_file = kernel_name + "_" + run_type + ".awsxclbin";
 	cl::Program::Binaries bins = xcl::import_binary_file(binary_file);
 	cl::Program program(context, devices, bins);
-	cl::Kernel kernel(program,kernel_name_charptr,NULL);
+	cl::Kernel kernel(program,selectKernel(program).c_str(),NULL);
 
-	unsigned int total_size = total_doc_size;
-	unsigned char* output_inh_flags = (unsigned char*)aligned_alloc(4096, total_size*sizeof(char));
+	unsigned int total_size = 0;
+	// Host memory of the flags, declared before the buffers using it so it is freed after them
+	vector<unsigned char,aligned_allocator<unsigned char>> inh_flags_host(total_doc_size);
+	unsigned char* output_inh_flags = inh_flags_host.data();
 	bool load_filter = true;
 
 	// Create buffers
 	cl::Buffer buffer_bloom_filter(context, CL_MEM_USE_HOST_PTR | CL_MEM_READ_ONLY, bloom_filter_size*sizeof(uint),bloom_filter);
-	cl::Buffer buffer_input_doc_words(context, CL_MEM_USE_HOST_PTR | CL_MEM_READ_ONLY, total_size*sizeof(uint),input_doc_words);
-	cl::Buffer buffer_output_inh_flags(context, CL_MEM_USE_HOST_PTR | CL_MEM_WRITE_ONLY, total_size*sizeof(char),output_inh_flags);
+	cl::Buffer buffer_input_doc_words(context, CL_MEM_USE_HOST_PTR | CL_MEM_READ_ONLY, total_doc_size*sizeof(uint),input_doc_words);
+	cl::Buffer buffer_output_inh_flags(context, CL_MEM_USE_HOST_PTR | CL_MEM_WRITE_ONLY, total_doc_size*sizeof(char),output_inh_flags);
 
 	// Set buffer kernel arguments (needed to migrate the buffers in the correct memory) 
 	kernel.setArg(0, buffer_output_inh_flags);
@@ -65,29 +79,32 @@ void runOnFPGA(
 	q.enqueueMigrateMemObjects({buffer_bloom_filter, buffer_input_doc_words, buffer_output_inh_flags}, CL_MIGRATE_MEM_OBJECT_CONTENT_UNDEFINED);
 
 	// Create sub-buffers, one for each transaction 
-	unsigned subbuf_doc_sz = total_doc_size/num_iter;
-	unsigned subbuf_inh_sz = total_doc_size/num_iter;
 
-	cl_buffer_region subbuf_inh_info[num_iter];
-	cl_buffer_region subbuf_doc_info[num_iter];
+	vector<cl_buffer_region> subbuf_inh_info(num_iter);
+	vector<cl_buffer_region> subbuf_doc_info(num_iter);
 
-	cl::Buffer subbuf_inh_flags[num_iter];
-	cl::Buffer subbuf_doc_words[num_iter];
+	vector<cl::Buffer> subbuf_inh_flags(num_iter);
+	vector<cl::Buffer> subbuf_doc_words(num_iter);
 
 	for (int i=0; i<num_iter; i++) {
-		subbuf_inh_info[i]={i*subbuf_inh_sz*sizeof(char), subbuf_inh_sz*sizeof(char)};
-		subbuf_doc_info[i]={i*subbuf_doc_sz*sizeof(uint), subbuf_doc_sz*sizeof(uint)};
+		unsigned long offset = i*words_per_iter;
+		unsigned long words  = min(words_per_iter, total_doc_size-offset);
+		subbuf_inh_info[i]={offset*sizeof(char), words*sizeof(char)};
+		subbuf_doc_info[i]={offset*sizeof(uint), words*sizeof(uint)};
 		subbuf_inh_flags[i] = buffer_output_inh_flags.createSubBuffer(CL_MEM_WRITE_ONLY, CL_BUFFER_CREATE_TYPE_REGION, &subbuf_inh_info[i]);
 		subbuf_doc_words[i] = buffer_input_doc_words.createSubBuffer (CL_MEM_READ_ONLY,  CL_BUFFER_CREATE_TYPE_REGION, &subbuf_doc_info[i]);
 	}
 
 	printf("\n");
     double mbytes_total  = (double)(total_doc_size * sizeof(int)) / (double)(1000*1000);
-    double mbytes_block  = mbytes_total / num_iter;
+    double mbytes_block  = (double)(words_per_iter * sizeof(int)) / (double)(1000*1000);
     printf(" Processing %.3f MBytes of data\n", mbytes_total);
     if (num_iter>1) {
     printf(" Splitting data in %d sub-buffers of %.3f MBytes for FPGA processing\n", num_iter, mbytes_block);
     }
+    if (num_iter != requested_iter) {
+    printf(" Using %d iterations instead of %d ( %lu words per iteration )\n", num_iter, requested_iter, words_per_iter);
+    }
 
     // Events 
 	vector<cl::Event> wordWait;
@@ -137,10 +154,11 @@ void runOnFPGA(
         q.finish();
 
 	// Compute the profile score the CPU using the in-hash flags computed on the FPGA
+	chrono::high_resolution_clock::time_point s1 = chrono::high_resolution_clock::now();
 	unsigned      curr_entry;
 	unsigned char inh_flags;
 			
-	for(unsigned int doc=0, n=0; doc<total_num_docs;doc++) 
+	for(unsigned long doc=0, n=0; doc<total_num_docs;doc++) 
 	{
 		unsigned long ans = 0;
 		unsigned int size = doc_sizes[doc];
@@ -160,6 +178,7 @@ void runOnFPGA(
 		}
 		profile_score[doc] = ans;
 	}
+	chrono::high_resolution_clock::time_point s2 = chrono::high_resolution_clock::now();
 
 	t2 = chrono::high_resolution_clock::now();
 	chrono::duration<double> perf_all_sec  = chrono::duration_cast<duration<double>>(t2-t1);
@@ -180,5 +199,9 @@ void runOnFPGA(
 		    printf(" Executed FPGA accelerated version  | %10.4f ms   ( FPGA %.3f ms )", 1000*perf_all_sec.count(), perf_hw_ms);    	
     }
 	printf("\n");
+
+	// Per-event timeline of this run and latency summary
+	vector<HostSpan> host_spans(1, HostSpan{0, s1, s2});
+	writeEventTrace("event_trace.json", wordWait, krnlWait, flagWait, host_spans, t1);
 }
 
@@ -0,0 +1,229 @@
+#include "constants.h"
+#include "convolve_bands.h"
+#include "filters.h"
+#include "kernels.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+using std::chrono::duration;
+using std::chrono::high_resolution_clock;
+using std::vector;
+
+// Times the CPU convolution engines on a random frame, for every filter of
+// filters.h, against the direct 2D loop, then convolve_cpu from 1 thread up
+// to one per hardware thread (the output must not change), the fixed-point
+// model of the FPGA kernels against its scalar form, then the tiled
+// and FFT engines on random non-separable 7x7 to 19x19 filters with the L1D
+// and L2 misses per frame from the perf counters:
+//   ./bench [WIDTH HEIGHT [ITERATIONS]]
+
+struct Filter {
+    const char* name;
+    float* coefficients;
+    int size;
+};
+
+static double time_ms(convolve_fn fn, const vector<RGBPixel>& in, vector<RGBPixel>& out,
+                      const Filter& filter, int width, int height, int iterations) {
+    auto start = high_resolution_clock::now();
+    for(int i = 0; i < iterations; i++) {
+        fn(in.data(), out.data(), filter.coefficients, filter.size, width, height);
+    }
+    return 1000 * duration<double>(high_resolution_clock::now() - start).count() / iterations;
+}
+
+// Cache misses of the calling thread. L2 misses are counted as last level
+// cache accesses, which is what an L2 miss becomes on Intel and AMD cores.
+// The counters read -1 where perf events are not available (containers,
+// perf_event_paranoid > 2).
+struct CacheCounters {
+    int fd[2];
+
+    CacheCounters() {
+        const unsigned long long cache[2] = { PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_LL };
+        const unsigned long long result[2] = { PERF_COUNT_HW_CACHE_RESULT_MISS, PERF_COUNT_HW_CACHE_RESULT_ACCESS };
+        for(int i = 0; i < 2; i++) {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = cache[i] | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (result[i] << 16);
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        }
+    }
+    ~CacheCounters() {
+        for(int i = 0; i < 2; i++) if(fd[i] >= 0) close(fd[i]);
+    }
+    void start() {
+        for(int i = 0; i < 2; i++) if(fd[i] >= 0) { ioctl(fd[i], PERF_EVENT_IOC_RESET, 0); ioctl(fd[i], PERF_EVENT_IOC_ENABLE, 0); }
+    }
+    // L1D (i = 0) or L2 (i = 1) misses since start
+    long long stop(int i) {
+        long long count = -1;
+        if(fd[i] < 0) return count;
+        ioctl(fd[i], PERF_EVENT_IOC_DISABLE, 0);
+        if(read(fd[i], &count, sizeof(count)) != sizeof(count)) count = -1;
+        return count;
+    }
+};
+
+static void print_misses(long long misses, int iterations) {
+    if(misses < 0) printf(" %10s", "n/a");
+    else printf(" %9.1fK", misses / 1e3 / iterations);
+}
+
+// Largest channel difference. Sums above 255 wrap around in both engines, so
+// the difference is taken modulo 256.
+static int max_difference(const vector<RGBPixel>& a, const vector<RGBPixel>& b) {
+    int worst = 0;
+    for(size_t i = 0; i < a.size(); i++) {
+        int d[3] = { a[i].r - b[i].r, a[i].g - b[i].g, a[i].b - b[i].b };
+        for(int c = 0; c < 3; c++) {
+            int diff = abs(d[c]);
+            if(diff > 128) diff = 256 - diff;
+            if(diff > worst) worst = diff;
+        }
+    }
+    return worst;
+}
+
+int main(int argc, char* argv[]) {
+    int width = 1280, height = 720, iterations = 3;
+    if(argc >= 3) { width = atoi(argv[1]); height = atoi(argv[2]); }
+    if(argc >= 4) { iterations = atoi(argv[3]); }
+
+    Filter filters[] = {
+        { "gaussian",      gaussian,      3 },
+        { "sobel",         sobel,         3 },
+        { "emboss",        emboss,        3 },
+        { "sharpen",       sharpen,       3 },
+        { "gaussianLarge", gaussianLarge, 19 },
+    };
+
+    vector<RGBPixel> in(width * height);
+    vector<RGBPixel> gold(width * height);
+    vector<RGBPixel> out(width * height);
+    srand(1);
+    for(auto& p : in) {
+        p.r = rand() & 0xff;
+        p.g = rand() & 0xff;
+        p.b = rand() & 0xff;
+        p.a = 0;
+    }
+
+    // Engines compared to the scalar 2D loop; convolve_cpu picks one per filter
+    struct Engine {
+        const char* name;
+        convolve_fn fn;
+    } engines[] = {
+        { "avx2",         convolve_cpu_2d_impl("avx2") },
+        { "avx512",       convolve_cpu_2d_impl("avx512") },
+        { "separable",    convolve_cpu_separable },
+        { "convolve_cpu", convolve_cpu },
+    };
+
+    double mpixels = width * height / 1e6;
+    printf("Frame %dx%d, %d iterations\n", width, height, iterations);
+    printf("%-14s %-24s %10s %10s %8s %9s\n", "filter", "engine", "ms", "MPixel/s", "speedup", "max diff");
+    for(const Filter& f : filters) {
+        double ref_ms = time_ms(convolve_cpu_2d, in, gold, f, width, height, iterations);
+        printf("%-14s %-24s %10.2f %10.1f %8s %9s\n", f.name, "scalar 2d", ref_ms, mpixels / ref_ms * 1000, "", "");
+        for(const Engine& e : engines) {
+            if(!e.fn) continue;
+            if(e.fn == convolve_cpu_separable && !convolve_is_separable(f.coefficients, f.size)) continue;
+            char name[64];
+            snprintf(name, sizeof(name), "%s%s", e.name,
+                     e.fn == convolve_cpu ? (convolve_is_separable(f.coefficients, f.size) ? " (separable)" :
+                                            f.size >= fft_filter_size ? " (fft)" : " (simd)") : "");
+            double ms = time_ms(e.fn, in, out, f, width, height, iterations);
+            printf("%-14s %-24s %10.2f %10.1f %7.1fx %9d\n", "", name, ms, mpixels / ms * 1000, ref_ms / ms, max_difference(gold, out));
+        }
+    }
+
+    // Thread scaling of convolve_cpu, against its single-thread output
+    unsigned int max_threads = std::max(1u, std::thread::hardware_concurrency());
+    printf("\nconvolve_cpu thread scaling (%u hardware threads)\n", max_threads);
+    printf("%-14s %-24s %10s %10s %8s %9s\n", "filter", "threads", "ms", "MPixel/s", "speedup", "max diff");
+    for(const Filter& f : filters) {
+        convolve_cpu_threads(1);
+        double ref_ms = time_ms(convolve_cpu, in, gold, f, width, height, iterations);
+        printf("%-14s %-24d %10.2f %10.1f %8s %9s\n", f.name, 1, ref_ms, mpixels / ref_ms * 1000, "", "");
+        for(unsigned int threads = 2; threads < 2 * max_threads; threads *= 2) {
+            threads = std::min(threads, max_threads);
+            convolve_cpu_threads(threads);
+            double ms = time_ms(convolve_cpu, in, out, f, width, height, iterations);
+            printf("%-14s %-24u %10.2f %10.1f %7.1fx %9d\n", "", threads, ms, mpixels / ms * 1000, ref_ms / ms, max_difference(gold, out));
+        }
+    }
+    convolve_cpu_threads(0);
+
+    // ap_fixed<16,9> model against its scalar form, which is the golden
+    // model of the FPGA kernels; the float engine differs from it
+    struct Engine fixed_engines[] = {
+        { "fixed avx2",           convolve_cpu_fixed_impl("avx2") },
+        { "fixed avx512",         convolve_cpu_fixed_impl("avx512") },
+        { "convolve_cpu (float)", convolve_cpu },
+    };
+    printf("\nFixed-point ap_fixed<16,9> model\n");
+    printf("%-14s %-24s %10s %10s %8s %9s\n", "filter", "engine", "ms", "MPixel/s", "speedup", "max diff");
+    for(const Filter& f : filters) {
+        double ref_ms = time_ms(convolve_cpu_fixed_impl("scalar"), in, gold, f, width, height, iterations);
+        printf("%-14s %-24s %10.2f %10.1f %8s %9s\n", f.name, "fixed scalar", ref_ms, mpixels / ref_ms * 1000, "", "");
+        for(const Engine& e : fixed_engines) {
+            if(!e.fn) continue;
+            double ms = time_ms(e.fn, in, out, f, width, height, iterations);
+            printf("%-14s %-24s %10.2f %10.1f %7.1fx %9d\n", "", e.name, ms, mpixels / ms * 1000, ref_ms / ms, max_difference(gold, out));
+        }
+    }
+
+    // Tiled and FFT engines on large filters, with random coefficients that
+    // are not rank-1
+    struct Engine tiled_engines[] = {
+        { "avx2",         convolve_cpu_2d_impl("avx2") },
+        { "avx512",       convolve_cpu_2d_impl("avx512") },
+        { "avx2-tiled",   convolve_cpu_2d_impl("avx2-tiled") },
+        { "avx512-tiled", convolve_cpu_2d_impl("avx512-tiled") },
+        { "fft",          convolve_cpu_fft },
+        { "convolve_cpu", convolve_cpu },
+    };
+    CacheCounters counters;
+    printf("\nLarge non-separable filters (misses per frame)\n");
+    printf("%-14s %-24s %10s %10s %8s %9s %10s %10s\n", "filter", "engine", "ms", "MPixel/s", "speedup", "max diff", "L1D miss", "L2 miss");
+    for(int size = 7; size <= MAX_FILTER; size += 2) {
+        vector<float> coefficients(size * size);
+        for(auto& c : coefficients) c = (rand() % 2001 - 1000) / 1000.0f / size;
+        Filter f = { "", coefficients.data(), size };
+        char name[16];
+        snprintf(name, sizeof(name), "random %dx%d", size, size);
+
+        double ref_ms = time_ms(convolve_cpu_2d, in, gold, f, width, height, 1);
+        printf("%-14s %-24s %10.2f %10.1f %8s %9s\n", name, "scalar 2d", ref_ms, mpixels / ref_ms * 1000, "", "");
+        for(const Engine& e : tiled_engines) {
+            if(!e.fn) continue;
+            counters.start();
+            double ms = time_ms(e.fn, in, out, f, width, height, iterations);
+            long long l1_misses = counters.stop(0);
+            long long l2_misses = counters.stop(1);
+            printf("%-14s %-24s %10.2f %10.1f %7.1fx %9d", "", e.name, ms, mpixels / ms * 1000, ref_ms / ms, max_difference(gold, out));
+            print_misses(l1_misses, iterations);
+            print_misses(l2_misses, iterations);
+            printf("\n");
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -8,6 +8,7 @@
 
 #include <argp.h>
 #include "common.h"
+#include "frame_io.h"
 #include "kernels.h"
 
 using std::make_tuple;
@@ -27,13 +28,14 @@ static char default_kernel_name[] = "";
 // The options we understand.
 static struct argp_option options[] = {
     {"gray", 'g', 0, 0, "Convert input to grayscale"},
-    {"output", 'o', "FILE", 0, "Output file (default: output.mp4)"},
+    {"output", 'o', "FILE", 0, "Output file (default: output.mp4; .rgba, .raw and .y4m are written without ffmpeg)"},
     {"scale", 's', "WIDTH HEIGHT", 0,
-     "The input will be resized to this before being processed"},
+     "The input will be resized to this before being processed (the frame size of a raw RGBA input)"},
     {"quiet", 'q', 0, 0, "Display verbose output"},
     {"nframes", 'n', "NUM", 0, "Number of frames to process"},
     {"kernel_name", 'k', "KERNEL_NAME", 0, "The kernel to launch"},
     {"ncomputeunits", 'c', "NUM", 0, "Number of compute units"},
+    {"threads", 't', "NUM", 0, "Number of CPU threads (default: one per hardware thread)"},
     {0}};
 
 char default_output[] = "output.mp4";
@@ -91,6 +93,10 @@ parse_opt (int key, char *arg, struct argp_state *state) {
       arguments->ncompute_units = atoi(arg);
       break;
 
+    case 't':
+      arguments->nthreads = atoi(arg);
+      break;
+
     case ARGP_KEY_ARG:
       if(strstr(arg, "xclbin")) {
         arguments->binary_file = arg;
@@ -132,11 +138,21 @@ arguments parse_args(int argc, char* argv[]) {
     arguments.binary_file = nullptr;
     arguments.kernel_name = default_kernel_name;
     arguments.ncompute_units = 1;
+    arguments.nthreads = 0;
 
     argp_parse (&argp, argc, argv, 0, 0, &arguments);
 
+    // Raw RGBA and Y4M inputs are read without ffmpeg, so without ffprobe
     int input_width, input_height, input_frames;
-    tie(input_width, input_height, input_frames) = get_video_size(arguments.input_file);
+    if(!native_video_size(arguments.input_file, arguments.width, arguments.height,
+                          &input_width, &input_height, &input_frames)) {
+      tie(input_width, input_height, input_frames) = get_video_size(arguments.input_file);
+    }
+    if(input_width <= 0 || input_height <= 0) {
+      printf("Error: cannot get the video size of %s (a raw RGBA input needs --scale WIDTH HEIGHT)\n",
+             arguments.input_file);
+      exit(EXIT_FAILURE);
+    }
     arguments.in_width = input_width;
     arguments.in_height = input_height;
 
@@ -156,28 +172,16 @@ arguments parse_args(int argc, char* argv[]) {
     return arguments;
 }
 
-tuple<FILE*, FILE*>
+tuple<FrameSource*, FrameSink*>
 get_streams(arguments &args) {
-  string inCommand;
-  inCommand.resize(2048);
-  snprintf(&inCommand.front(), 2048,
-           "ffmpeg -v error -hide_banner -i %s -f image2pipe -vcodec rawvideo -vf scale=w=%d:h=%d -vframes %d -pix_fmt rgba -",
-           args.input_file, args.width, args.height, args.nframes);
-
-  string outCommand;
-  outCommand.resize(2048);
-  snprintf(&outCommand.front(), 2048,
-           "ffmpeg -v error -hide_banner -y -f rawvideo -vcodec rawvideo -pix_fmt %s -s %dx%d -framerate 25 -i - -f mp4 -q:v 5 -an -codec mpeg4 %s",
-           (args.gray) ? "gray" : "rgba", args.width, args.height, args.output_file);
+  FrameSource* source = open_source(args);
+  FrameSink* sink = open_sink(args);
 
   if(args.verbose) {
-    printf("IN COMMAND:  %s\n"
-           "OUT COMMAND: %s\n", inCommand.c_str(), outCommand.c_str());
+    printf("IN:  %s\n"
+           "OUT: %s\n", source ? source->name() : "(error)", sink ? sink->name() : "(error)");
     if(args.binary_file) printf("Binary Path: %s\n", args.binary_file);
   }
 
-  FILE* streamIn = popen(inCommand.c_str(), "r");
-  FILE* streamOut = popen(outCommand.c_str(), "w");
-
-  return make_tuple(streamIn, streamOut);
+  return make_tuple(source, sink);
 }
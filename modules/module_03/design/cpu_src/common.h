@@ -1,9 +1,13 @@
 #pragma once
+#include <cstdio>
 #include <tuple>
 
 #include "constants.h"
 #include "types.h"
 
+class FrameSource;
+class FrameSink;
+
 struct arguments {
   // The path to the input video
   char *input_file;
@@ -32,6 +36,9 @@ struct arguments {
   // The number of compute units on the binary
   int ncompute_units;
 
+  // The number of CPU threads of convolve_cpu, 0 for one per hardware thread
+  int nthreads;
+
   // The path to the xclbin or awsxcbin file
   char* binary_file;
 
@@ -48,10 +55,11 @@ arguments parse_args(int argc, char* argv[]);
 // Prints the progress of an operation
 void print_progress(int cnt, int total);
 
-// Returns an input and output pipe stream.
-std::tuple<FILE*, FILE*> get_streams(arguments &args);
+// Returns the frame source and sink of the input and output files, nullptr
+// for one that could not be opened. The caller deletes them.
+std::tuple<FrameSource*, FrameSink*> get_streams(arguments &args);
 
 // Method for performing convolution
-void convolve(FILE* streamIn, FILE* streamOut,
+void convolve(FrameSource* source, FrameSink* sink,
               float* filter, int filter_size,
               arguments args);
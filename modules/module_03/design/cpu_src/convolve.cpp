@@ -1,6 +1,7 @@
 
 #include "common.h"
 #include "constants.h"
+#include "frame_pipeline.h"
 #include "kernels.h"
 
 #include <vector>
@@ -15,61 +16,48 @@ bool operator==(const RGBPixel& lhs, const RGBPixel& rhs) {
 }
 
 void
-test(vector<RGBPixel>& in, vector<RGBPixel>& out,
+test(const RGBPixel* in, const RGBPixel* out,
      float* coefficients, int coefficient_size,
      int width, int height) {
-    vector<RGBPixel> gold(out.size());
-    convolve_cpu(in.data(), gold.data(), coefficients, coefficient_size, width, height);
-    auto it = mismatch(begin(gold), end(gold), begin(out));
+    vector<RGBPixel> gold(width * height);
+    convolve_cpu(in, gold.data(), coefficients, coefficient_size, width, height);
+    auto it = mismatch(begin(gold), end(gold), out);
     if(it.first != end(gold)) {
         printf("Incorrect result: \n Expected: (%d %d %d)\nResult:  (%d %d %d)\n ",
                it.first->r, it.first->g, it.first->b, it.second->r, it.second->g, it.second->b);
     }
 }
 
-void convolve(FILE* streamIn, FILE* streamOut,
+// Frames in flight: one being read, one computed, one written and one spare
+// so a slow frame in one stage does not stall the others right away
+static const int pipeline_depth = 4;
+
+void convolve(FrameSource* source, FrameSink* sink,
               float* coefficients, int coefficient_size,
               arguments args) {
     size_t frame_bytes = args.width * args.height * sizeof(RGBPixel);
     size_t gray_frame_bytes = args.width * args.height * sizeof(GrayPixel);
-    vector<RGBPixel> inFrame(args.width * args.height);
-    vector<RGBPixel> outFrame(args.width * args.height);
-    vector<GrayPixel> grayFrame(args.width * args.height);
-
-    size_t bytes_read = 0;
-    size_t bytes_written = 0;
-    for(int frame_count = 0; frame_count < args.nframes; frame_count++) {
-        // Read frame
-        bytes_read = fread(inFrame.data(), 1, frame_bytes, streamIn);
-        if(bytes_read != frame_bytes) {
-        	printf("\nError: partial frame.\nExpected %zu\nActual %zu\n", frame_bytes, bytes_read);
-        	break;
-        }
 
-        convolve_cpu(inFrame.data(), outFrame.data(),
+    FramePipeline pipeline(source, sink, args.width, args.height, args.nframes, pipeline_depth);
+    while(FrameBuffer* frame = pipeline.acquire()) {
+        convolve_cpu(frame->in, frame->out.data(),
                      coefficients, coefficient_size,
                      args.width, args.height);
 
         if(args.gray) {
-          grayscale_cpu(outFrame.data(), grayFrame.data(), args.width, args.height);
-          bytes_written = fwrite(outFrame.data(), 1, gray_frame_bytes, streamOut);
-          fflush(streamOut);
-          if (bytes_written != gray_frame_bytes) {
-            printf("\nError: partial frame.\nExpected %zu\nActual %zu\n",
-                   gray_frame_bytes, bytes_written);
-            break;
-          }
+          grayscale_cpu(frame->out.data(), frame->gray.data(), args.width, args.height);
+          frame->data = frame->gray.data();
+          frame->bytes = gray_frame_bytes;
         } else {
-          bytes_written = fwrite(outFrame.data(), 1, frame_bytes, streamOut);
-          fflush(streamOut);
-          if (bytes_written != frame_bytes) {
-            printf("\nError: partial frame.\nExpected %zu\nActual %zu\n",
-                   frame_bytes, bytes_written);
-            break;
-          }
-          // test(inFrame, outFrame, coefficients, coefficient_size, width, height);
+          frame->data = frame->out.data();
+          frame->bytes = frame_bytes;
+          // test(frame->in, frame->out.data(), coefficients, coefficient_size, args.width, args.height);
         }
+        // The writer thread owns the frame once it is submitted
+        int index = frame->index;
+        pipeline.submit(frame);
 
-        print_progress(frame_count, args.nframes);
+        print_progress(index, args.nframes);
     }
+    pipeline.finish();
 }
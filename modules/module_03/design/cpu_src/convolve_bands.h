@@ -0,0 +1,68 @@
+#pragma once
+
+#include "types.h"
+
+// Band engines: compute output lines [first_line, last_line) of the frame.
+// The coefficient_size/2 halo rows above and below the band are read from
+// inFrame (zero outside the frame), so bands can run on different threads
+// and the output is the same as one call on the whole frame.
+typedef void (*convolve_band_fn)(const RGBPixel* inFrame, RGBPixel* outFrame,
+                                 const float* coefficient, int coefficient_size,
+                                 int img_width, int img_height,
+                                 int first_line, int last_line);
+
+void convolve_band_2d(const RGBPixel* inFrame, RGBPixel* outFrame,
+                      const float* coefficient, int coefficient_size,
+                      int img_width, int img_height, int first_line, int last_line);
+
+// Factors of a rank-1 filter, coefficient[m][n] == col[m] * row[n], false if
+// the filter is not separable
+bool separable_factors(const float* coefficient, int coefficient_size,
+                       float* col, float* row);
+
+void convolve_band_separable(const RGBPixel* inFrame, RGBPixel* outFrame,
+                             const float* coefficient, int coefficient_size,
+                             int img_width, int img_height, int first_line, int last_line);
+
+void convolve_band_fft(const RGBPixel* inFrame, RGBPixel* outFrame,
+                       const float* coefficient, int coefficient_size,
+                       int img_width, int img_height, int first_line, int last_line);
+
+// Lines and pixels of an FFT tile, bands of convolve_band_fft are best
+// made of whole tiles
+int convolve_fft_block(int coefficient_size);
+
+// Filters from this size on use the FFT engine. Measured with bench against
+// the tiled AVX-512 engine on 1280x720, AVX2 only CPUs cross over earlier.
+// Separable filters of any size take convolve_band_separable_best instead:
+// on 640x360 it runs a 3x3 gaussian in the time of the AVX-512 engine
+// (1.2 ms) and the 19x19 gaussianLarge in 3.1 ms against 12.0 ms for FFT.
+static const int fft_filter_size = 15;
+
+// Padding after the last pixel of a line, so whole groups can be loaded
+static const int simd_pad = 16;
+
+// Copies lines [first_line - center, last_line + center) of the frame into a
+// per thread buffer of lines of stride pixels, with a zero border of center
+// pixels. Line first_line - center of the frame is line 0 of the buffer.
+const RGBPixel* pad_frame(const RGBPixel* inFrame, int img_width, int img_height,
+                          int first_line, int last_line, int center, int stride);
+
+// SIMD band engine for "avx2", "avx512", "avx2-tiled", "avx512-tiled",
+// "avx2-separable" or "avx512-separable", nullptr if the CPU does not support
+// it. The separable ones take rank-1 filters only.
+convolve_band_fn convolve_band_simd_impl(const char* isa);
+
+// Filters from this size on use the tiled engines
+static const int tiled_filter_size = 7;
+
+// Widest SIMD band engine the CPU supports for the filter size, tiled for
+// large filters, convolve_band_2d without SIMD
+convolve_band_fn convolve_band_simd_best(int coefficient_size);
+
+// Widest separable band engine the CPU supports, convolve_band_separable
+// without SIMD
+convolve_band_fn convolve_band_separable_best();
+
+// Fastest band engine of the ap_fixed<16,9> model the CPU supports
+convolve_band_fn convolve_band_fixed_best();
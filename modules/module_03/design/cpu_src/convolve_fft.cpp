@@ -0,0 +1,319 @@
+
+#include "constants.h"
+#include "convolve_bands.h"
+#include "kernels.h"
+#include "types.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+using std::max;
+using std::min;
+using std::vector;
+
+// FFT convolution for large filters, O(log N) instead of O(k^2) operations
+// per pixel. The band is cut into tiles of fft_block(k) x fft_block(k)
+// output pixels. Each tile reads an N x N input tile (its pixels and the
+// k - 1 halo rows and columns, zero outside the frame), multiplies its 2D
+// spectrum with the spectrum of the filter and keeps the part of the
+// circular result that did not wrap around (overlap-save). Tiles read their
+// halo like the bands do, so they are independent of each other. The tiles
+// are on a grid from the top left pixel of the frame whatever the band, so
+// the output does not depend on how the frame is split.
+//
+// The color planes are packed two per complex FFT: a pair of tiles is
+// computed with 3 transforms, R + iG of the first tile, B of the first +
+// i B of the second, R + iG of the second. The filter is real, so the real
+// and imaginary parts of the result are the two planes filtered separately.
+//
+// The transforms are radix-2 on split real/imaginary arrays. A pass runs the
+// butterflies of every stage on whole rows, so the inner loops are
+// contiguous and vectorize. The forward transform is decimation in
+// frequency (bit-reversed output) and the inverse is decimation in time
+// (bit-reversed input), so no bit reversal is needed. The second dimension
+// is done on the transposed tile, and the spectra stay transposed.
+//
+// The float rounding of the transforms makes a channel differ by at most 1
+// from convolve_cpu_2d, like the separable engine.
+
+// log2 of the transform size for a filter: 64 x 64 below 15x15, 128 x 128
+// from there, measured with bench
+static int fft_log2(int coefficient_size)
+{
+    return coefficient_size < 15 ? 6 : 7;
+}
+
+int convolve_fft_block(int coefficient_size)
+{
+    return (1 << fft_log2(coefficient_size)) - (coefficient_size - 1);
+}
+
+// Complex N x N tile in split form
+struct FftTile
+{
+    vector<float> re;
+    vector<float> im;
+
+    void resize(int n) { re.assign(n * n, 0.0f); im.assign(n * n, 0.0f); }
+};
+
+// Twiddle factors exp(-2 pi i j / n), j < n / 2
+struct FftTwiddles
+{
+    int n;
+    vector<float> re;
+    vector<float> im;
+
+    explicit FftTwiddles(int size) : n(size), re(size / 2), im(size / 2)
+    {
+        for(int j = 0; j < n / 2; ++j)
+        {
+            double angle = -2 * M_PI * j / n;
+            re[j] = cos(angle);
+            im[j] = sin(angle);
+        }
+    }
+};
+
+// One butterfly on rows a and b of the tile: (a + b, (a - b) * w)
+__attribute__((target_clones("avx512f", "avx2", "default")))
+static void butterfly_dif(float* __restrict ar, float* __restrict ai, float* __restrict br, float* __restrict bi,
+                          float wr, float wi, int n)
+{
+    for(int c = 0; c < n; ++c)
+    {
+        float xr = ar[c] - br[c];
+        float xi = ai[c] - bi[c];
+        ar[c] += br[c];
+        ai[c] += bi[c];
+        br[c] = xr * wr - xi * wi;
+        bi[c] = xr * wi + xi * wr;
+    }
+}
+
+// (a + b * w, a - b * w)
+__attribute__((target_clones("avx512f", "avx2", "default")))
+static void butterfly_dit(float* __restrict ar, float* __restrict ai, float* __restrict br, float* __restrict bi,
+                          float wr, float wi, int n)
+{
+    for(int c = 0; c < n; ++c)
+    {
+        float tr = br[c] * wr - bi[c] * wi;
+        float ti = br[c] * wi + bi[c] * wr;
+        br[c] = ar[c] - tr;
+        bi[c] = ai[c] - ti;
+        ar[c] += tr;
+        ai[c] += ti;
+    }
+}
+
+// Transform of every column, along the rows
+static void fft_columns(FftTile& tile, const FftTwiddles& tw, bool inverse)
+{
+    int n = tw.n;
+    float* re = tile.re.data();
+    float* im = tile.im.data();
+    for(int step = 0; step < 31 && (1 << step) < n; ++step)
+    {
+        // The forward transform halves the butterfly span every stage, the
+        // inverse doubles it and uses the conjugate twiddles
+        int len = inverse ? 2 << step : n >> step;
+        int half = len / 2;
+        for(int start = 0; start < n; start += len)
+        {
+            for(int r = 0; r < half; ++r)
+            {
+                int j = r * (n / len);
+                float* ar = re + (start + r) * n;
+                float* ai = im + (start + r) * n;
+                float* br = ar + half * n;
+                float* bi = ai + half * n;
+                if(inverse)
+                    butterfly_dit(ar, ai, br, bi, tw.re[j], -tw.im[j], n);
+                else
+                    butterfly_dif(ar, ai, br, bi, tw.re[j], tw.im[j], n);
+            }
+        }
+    }
+}
+
+static void transpose(vector<float>& a, int n)
+{
+    // 8 x 8 blocks, swapped across the diagonal
+    const int block = 8;
+    for(int rb = 0; rb < n; rb += block)
+    {
+        for(int cb = rb; cb < n; cb += block)
+        {
+            for(int r = rb; r < rb + block; ++r)
+            {
+                for(int c = (cb == rb ? r + 1 : cb); c < cb + block; ++c)
+                {
+                    std::swap(a[r * n + c], a[c * n + r]);
+                }
+            }
+        }
+    }
+}
+
+static void fft_2d(FftTile& tile, const FftTwiddles& tw, bool inverse)
+{
+    fft_columns(tile, tw, inverse);
+    transpose(tile.re, tw.n);
+    transpose(tile.im, tw.n);
+    fft_columns(tile, tw, inverse);
+}
+
+__attribute__((target_clones("avx512f", "avx2", "default")))
+static void multiply_spectrum(float* __restrict re, float* __restrict im,
+                              const float* __restrict kr, const float* __restrict ki, int count)
+{
+    for(int i = 0; i < count; ++i)
+    {
+        float r = re[i] * kr[i] - im[i] * ki[i];
+        float s = re[i] * ki[i] + im[i] * kr[i];
+        re[i] = r;
+        im[i] = s;
+    }
+}
+
+// Spectrum of the filter, scaled by 1 / N^2 for the inverse transform, kept
+// per thread for the last filter. The output is a correlation, so
+// coefficient[m][n] goes to (-m, -n) mod N.
+static const FftTile& filter_spectrum(const float* coefficient, int coefficient_size, const FftTwiddles& tw)
+{
+    static thread_local FftTile spectrum;
+    static thread_local vector<float> filter;
+    static thread_local int filter_n = 0;
+
+    int n = tw.n;
+    if(filter_n == n && filter.size() == (size_t)(coefficient_size * coefficient_size) &&
+       memcmp(filter.data(), coefficient, filter.size() * sizeof(float)) == 0)
+        return spectrum;
+
+    filter.assign(coefficient, coefficient + coefficient_size * coefficient_size);
+    filter_n = n;
+    spectrum.resize(n);
+    float scale = 1.0f / (n * n);
+    for(int m = 0; m < coefficient_size; ++m)
+    {
+        for(int k = 0; k < coefficient_size; ++k)
+        {
+            spectrum.re[((n - m) % n) * n + (n - k) % n] = coefficient[(m * coefficient_size) + k] * scale;
+        }
+    }
+    fft_2d(spectrum, tw, false);
+    return spectrum;
+}
+
+// Loads channel of the input tile with top left pixel (y, x) into plane
+static void load_plane(float* plane, const RGBPixel* inFrame, int img_width, int img_height,
+                       int y, int x, int channel, int n)
+{
+    for(int r = 0; r < n; ++r)
+    {
+        float* out = plane + r * n;
+        int line = y + r;
+        if(line < 0 || line >= img_height)
+        {
+            memset(out, 0, n * sizeof(float));
+            continue;
+        }
+        const unsigned char* in = &inFrame[line * img_width].r + channel;
+        for(int c = 0; c < n; ++c)
+        {
+            int pixel = x + c;
+            out[c] = (pixel >= 0 && pixel < img_width) ? in[pixel * sizeof(RGBPixel)] : 0.0f;
+        }
+    }
+}
+
+// Stores the block x block pixels of channel from plane that are on lines
+// [first_line, last_line), fabsf and low byte like the direct engines
+static void store_plane(RGBPixel* outFrame, const float* plane, int img_width, int line,
+                        int first_line, int last_line, int pixel, int block, int channel, int n)
+{
+    int lines = min(block, last_line - line);
+    int pixels = min(block, img_width - pixel);
+    for(int r = max(0, first_line - line); r < lines; ++r)
+    {
+        unsigned char* out = &outFrame[(line + r) * img_width + pixel].r + channel;
+        const float* in = plane + r * n;
+        for(int c = 0; c < pixels; ++c)
+        {
+            out[c * sizeof(RGBPixel)] = (unsigned char)(int)fabsf(in[c]);
+        }
+    }
+}
+
+void convolve_band_fft(const RGBPixel* inFrame, RGBPixel* outFrame,
+                       const float* coefficient, int coefficient_size,
+                       int img_width, int img_height, int first_line, int last_line)
+{
+    int n = 1 << fft_log2(coefficient_size);
+    int block = convolve_fft_block(coefficient_size);
+    int center = coefficient_size / 2;
+
+    static thread_local vector<FftTwiddles> twiddles;
+    if(twiddles.empty() || twiddles.back().n != n)
+    {
+        twiddles.assign(1, FftTwiddles(n));
+    }
+    const FftTwiddles& tw = twiddles.back();
+    const FftTile& spectrum = filter_spectrum(coefficient, coefficient_size, tw);
+
+    static thread_local FftTile tiles[3];
+    if(tiles[0].re.size() != (size_t)(n * n))
+    {
+        for(FftTile& t : tiles) t.resize(n);
+    }
+
+    for(int line = first_line - first_line % block; line < last_line; line += block)
+    {
+        for(int pixel = 0; pixel < img_width; pixel += 2 * block)
+        {
+            // First tile at pixel, second at pixel + block (past the frame
+            // for the last tile of an odd count, then zero)
+            int y = line - center;
+            int x[2] = { pixel - center, pixel + block - center };
+            load_plane(tiles[0].re.data(), inFrame, img_width, img_height, y, x[0], 0, n);
+            load_plane(tiles[0].im.data(), inFrame, img_width, img_height, y, x[0], 1, n);
+            load_plane(tiles[1].re.data(), inFrame, img_width, img_height, y, x[0], 2, n);
+            load_plane(tiles[1].im.data(), inFrame, img_width, img_height, y, x[1], 2, n);
+            load_plane(tiles[2].re.data(), inFrame, img_width, img_height, y, x[1], 0, n);
+            load_plane(tiles[2].im.data(), inFrame, img_width, img_height, y, x[1], 1, n);
+
+            bool second = pixel + block < img_width;
+            for(int t = 0; t < (second ? 3 : 2); ++t)
+            {
+                fft_2d(tiles[t], tw, false);
+                multiply_spectrum(tiles[t].re.data(), tiles[t].im.data(), spectrum.re.data(), spectrum.im.data(), n * n);
+                fft_2d(tiles[t], tw, true);
+            }
+
+            store_plane(outFrame, tiles[0].re.data(), img_width, line, first_line, last_line, pixel, block, 0, n);
+            store_plane(outFrame, tiles[0].im.data(), img_width, line, first_line, last_line, pixel, block, 1, n);
+            store_plane(outFrame, tiles[1].re.data(), img_width, line, first_line, last_line, pixel, block, 2, n);
+            if(second)
+            {
+                store_plane(outFrame, tiles[1].im.data(), img_width, line, first_line, last_line, pixel + block, block, 2, n);
+                store_plane(outFrame, tiles[2].re.data(), img_width, line, first_line, last_line, pixel + block, block, 0, n);
+                store_plane(outFrame, tiles[2].im.data(), img_width, line, first_line, last_line, pixel + block, block, 1, n);
+            }
+        }
+    }
+}
+
+extern "C"
+{
+
+void convolve_cpu_fft(const RGBPixel* inFrame, RGBPixel* outFrame,
+                      const float* coefficient, int coefficient_size,
+                      int img_width, int img_height)
+{
+    convolve_band_fft(inFrame, outFrame, coefficient, coefficient_size, img_width, img_height, 0, img_height);
+}
+
+}
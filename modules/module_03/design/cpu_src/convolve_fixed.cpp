@@ -0,0 +1,290 @@
+
+#include "constants.h"
+#include "convolve_bands.h"
+#include "kernels.h"
+#include "types.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CONVOLVE_X86 1
+#endif
+
+// Integer model of the ap_fixed<16,9> kernels (dataflow, multicu). A fixed
+// value is an int16 in units of 1/128:
+// - the coefficients are converted from float with truncation toward minus
+//   infinity (AP_TRN) and wrap to 16 bits (AP_WRAP),
+// - pixel * coefficient is exact and the sum wraps to 16 bits after every
+//   add. Wrapping is modulo 2^16, so the sums can be done in int32 (or
+//   wrap in int32) and only the low 16 bits kept at the end,
+// - to_int() truncates toward zero, and the low byte goes to the channel.
+// Pixels outside the frame count as zero. The FPGA kernels are written for
+// 3x3 filters; this models their arithmetic for any filter size.
+//
+// The SIMD engines use pmaddwd: a vector holds the 16 bit channels of the
+// pixels under tap n interleaved with those under tap n + 1, so one pmaddwd
+// with the coefficient pair (n, n + 1) adds 2 taps to the 32 bit sums of
+// each channel. pmaddubsw would do 4 taps per instruction, but it takes
+// signed 8 bit coefficients and saturates its 16 bit pair sums, while the
+// coefficients have 16 bits and the kernels wrap.
+
+static short fixed_coefficient(float coefficient)
+{
+    return (short)(long long)floor((double)coefficient * 128);
+}
+
+static unsigned char fixed_to_channel(int sum)
+{
+    short fixed = (short)sum;
+    return (unsigned char)(fixed / 128);
+}
+
+static void fixed_coefficients(const float* coefficient, int coefficient_size, short* fixed)
+{
+    for(int i = 0; i < coefficient_size * coefficient_size; ++i)
+    {
+        fixed[i] = fixed_coefficient(coefficient[i]);
+    }
+}
+
+static void convolve_band_fixed(const RGBPixel* inFrame, RGBPixel* outFrame,
+                                const float* coefficient, int coefficient_size,
+                                int img_width, int img_height, int first_line, int last_line)
+{
+    short coef[MAX_FILTER * MAX_FILTER];
+    fixed_coefficients(coefficient, coefficient_size, coef);
+
+    int center = coefficient_size / 2;
+    for(int line = first_line; line < last_line; ++line)
+    {
+        for(int pixel = 0; pixel < img_width; ++pixel)
+        {
+            unsigned int sum_r = 0, sum_g = 0, sum_b = 0;
+            for(int m = 0; m < coefficient_size; ++m)
+            {
+                int ii = line + m - center;
+                if(ii < 0 || ii >= img_height) continue;
+                for(int n = 0; n < coefficient_size; ++n)
+                {
+                    int jj = pixel + n - center;
+                    if(jj >= 0 && jj < img_width)
+                    {
+                        const RGBPixel& p = inFrame[(ii * img_width) + jj];
+                        sum_r += p.r * coef[(m * coefficient_size) + n];
+                        sum_g += p.g * coef[(m * coefficient_size) + n];
+                        sum_b += p.b * coef[(m * coefficient_size) + n];
+                    }
+                }
+            }
+            outFrame[line * img_width + pixel].r = fixed_to_channel(sum_r);
+            outFrame[line * img_width + pixel].g = fixed_to_channel(sum_g);
+            outFrame[line * img_width + pixel].b = fixed_to_channel(sum_b);
+        }
+    }
+}
+
+#ifdef CONVOLVE_X86
+
+// Coefficient pairs (n, n + 1) of each row as pmaddwd operands, with a zero
+// after the last coefficient of odd sized rows
+static int coefficient_pairs(const float* coefficient, int coefficient_size, int* pairs)
+{
+    short coef[MAX_FILTER * MAX_FILTER];
+    fixed_coefficients(coefficient, coefficient_size, coef);
+
+    int per_row = (coefficient_size + 1) / 2;
+    for(int m = 0; m < coefficient_size; ++m)
+    {
+        for(int i = 0; i < per_row; ++i)
+        {
+            int n = 2 * i;
+            unsigned short c0 = coef[(m * coefficient_size) + n];
+            unsigned short c1 = (n + 1 < coefficient_size) ? coef[(m * coefficient_size) + n + 1] : 0;
+            pairs[(m * per_row) + i] = (int)(c0 | ((unsigned int)c1 << 16));
+        }
+    }
+    return per_row;
+}
+
+// to_int() of the low 16 bits of each sum, low byte
+__attribute__((target("avx2")))
+static inline __m256i fixed_to_channel_avx2(__m256i sum)
+{
+    __m256i fixed = _mm256_srai_epi32(_mm256_slli_epi32(sum, 16), 16);
+    __m256i toward_zero = _mm256_and_si256(_mm256_srai_epi32(fixed, 31), _mm256_set1_epi32(127));
+    return _mm256_and_si256(_mm256_srai_epi32(_mm256_add_epi32(fixed, toward_zero), 7), _mm256_set1_epi32(0xff));
+}
+
+// 8 pixels per step. A 256 bit lane of 16 bit channels holds 2 pixels, so
+// the low and high interleaves of a lane are 2 neighbouring output pixels.
+__attribute__((target("avx2")))
+static void convolve_band_fixed_avx2(const RGBPixel* inFrame, RGBPixel* outFrame,
+                                     const float* coefficient, int coefficient_size,
+                                     int img_width, int img_height, int first_line, int last_line)
+{
+    int pairs[MAX_FILTER * MAX_FILTER];
+    int per_row = coefficient_pairs(coefficient, coefficient_size, pairs);
+
+    int center = coefficient_size / 2;
+    int stride = img_width + 2 * center + simd_pad;
+    const RGBPixel* padded = pad_frame(inFrame, img_width, img_height, first_line, last_line, center, stride);
+    const __m256i rgb = _mm256_set1_epi32(0x00ffffff);
+
+    for(int line = first_line; line < last_line; ++line)
+    {
+        for(int pixel = 0; pixel < img_width; pixel += 8)
+        {
+            // Pixels {0, 2}, {1, 3}, {4, 6}, {5, 7}
+            __m256i acc[4] = { _mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256() };
+            for(int m = 0; m < coefficient_size; ++m)
+            {
+                const RGBPixel* src = &padded[(size_t)(line - first_line + m) * stride + pixel];
+                for(int i = 0; i < per_row; ++i)
+                {
+                    __m256i c = _mm256_set1_epi32(pairs[(m * per_row) + i]);
+                    const RGBPixel* tap = src + 2 * i;
+                    for(int h = 0; h < 2; ++h)
+                    {
+                        __m256i a = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(tap + 4 * h)));
+                        __m256i b = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(tap + 4 * h + 1)));
+                        acc[2 * h]     = _mm256_add_epi32(acc[2 * h],     _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), c));
+                        acc[2 * h + 1] = _mm256_add_epi32(acc[2 * h + 1], _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), c));
+                    }
+                }
+            }
+
+            // Back to pixel order: packs puts pixels 0, 1 | 2, 3 and 4, 5 | 6, 7
+            // in the lanes, packus interleaves the lanes of the two halves
+            __m256i half0 = _mm256_packs_epi32(fixed_to_channel_avx2(acc[0]), fixed_to_channel_avx2(acc[1]));
+            __m256i half1 = _mm256_packs_epi32(fixed_to_channel_avx2(acc[2]), fixed_to_channel_avx2(acc[3]));
+            __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(half0, half1), _MM_SHUFFLE(3, 1, 2, 0));
+
+            RGBPixel* out = &outFrame[(size_t)line * img_width + pixel];
+            if(pixel + 8 <= img_width)
+            {
+                __m256i old = _mm256_loadu_si256((const __m256i*)out);
+                _mm256_storeu_si256((__m256i*)out, _mm256_blendv_epi8(old, packed, rgb));
+            }
+            else
+            {
+                RGBPixel group[8];
+                _mm256_storeu_si256((__m256i*)group, packed);
+                for(int i = 0; i < img_width - pixel; ++i)
+                {
+                    out[i].r = group[i].r;
+                    out[i].g = group[i].g;
+                    out[i].b = group[i].b;
+                }
+            }
+        }
+    }
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static inline __m512i fixed_to_channel_avx512(__m512i sum)
+{
+    __m512i fixed = _mm512_srai_epi32(_mm512_slli_epi32(sum, 16), 16);
+    __m512i toward_zero = _mm512_and_si512(_mm512_srai_epi32(fixed, 31), _mm512_set1_epi32(127));
+    return _mm512_and_si512(_mm512_srai_epi32(_mm512_add_epi32(fixed, toward_zero), 7), _mm512_set1_epi32(0xff));
+}
+
+// 16 pixels per step, as two groups of 8 in 512 bit vectors, stored through
+// a byte mask that skips the alpha channel and the pixels past the line
+__attribute__((target("avx512f,avx512bw,avx512vl")))
+static void convolve_band_fixed_avx512(const RGBPixel* inFrame, RGBPixel* outFrame,
+                                       const float* coefficient, int coefficient_size,
+                                       int img_width, int img_height, int first_line, int last_line)
+{
+    int pairs[MAX_FILTER * MAX_FILTER];
+    int per_row = coefficient_pairs(coefficient, coefficient_size, pairs);
+
+    int center = coefficient_size / 2;
+    int stride = img_width + 2 * center + simd_pad;
+    const RGBPixel* padded = pad_frame(inFrame, img_width, img_height, first_line, last_line, center, stride);
+
+    for(int line = first_line; line < last_line; ++line)
+    {
+        for(int pixel = 0; pixel < img_width; pixel += 16)
+        {
+            __m512i acc[4] = { _mm512_setzero_si512(), _mm512_setzero_si512(), _mm512_setzero_si512(), _mm512_setzero_si512() };
+            for(int m = 0; m < coefficient_size; ++m)
+            {
+                const RGBPixel* src = &padded[(size_t)(line - first_line + m) * stride + pixel];
+                for(int i = 0; i < per_row; ++i)
+                {
+                    __m512i c = _mm512_set1_epi32(pairs[(m * per_row) + i]);
+                    const RGBPixel* tap = src + 2 * i;
+                    for(int h = 0; h < 2; ++h)
+                    {
+                        __m512i a = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i*)(tap + 8 * h)));
+                        __m512i b = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i*)(tap + 8 * h + 1)));
+                        acc[2 * h]     = _mm512_add_epi32(acc[2 * h],     _mm512_madd_epi16(_mm512_unpacklo_epi16(a, b), c));
+                        acc[2 * h + 1] = _mm512_add_epi32(acc[2 * h + 1], _mm512_madd_epi16(_mm512_unpackhi_epi16(a, b), c));
+                    }
+                }
+            }
+
+            for(int h = 0; h < 2; ++h)
+            {
+                int count = std::min(8, img_width - pixel - 8 * h);
+                if(count <= 0) break;
+                __m512i channels = _mm512_packs_epi32(fixed_to_channel_avx512(acc[2 * h]), fixed_to_channel_avx512(acc[2 * h + 1]));
+                __mmask32 mask = (__mmask32)(0x77777777u & (0xffffffffu >> (32 - 4 * count)));
+                _mm256_mask_storeu_epi8(&outFrame[(size_t)line * img_width + pixel + 8 * h], mask, _mm512_cvtepi16_epi8(channels));
+            }
+        }
+    }
+}
+
+static void convolve_cpu_fixed_avx2(const RGBPixel* inFrame, RGBPixel* outFrame,
+                                    const float* coefficient, int coefficient_size,
+                                    int img_width, int img_height)
+{
+    convolve_band_fixed_avx2(inFrame, outFrame, coefficient, coefficient_size, img_width, img_height, 0, img_height);
+}
+
+static void convolve_cpu_fixed_avx512(const RGBPixel* inFrame, RGBPixel* outFrame,
+                                      const float* coefficient, int coefficient_size,
+                                      int img_width, int img_height)
+{
+    convolve_band_fixed_avx512(inFrame, outFrame, coefficient, coefficient_size, img_width, img_height, 0, img_height);
+}
+
+#endif
+
+static void convolve_cpu_fixed_scalar(const RGBPixel* inFrame, RGBPixel* outFrame,
+                                      const float* coefficient, int coefficient_size,
+                                      int img_width, int img_height)
+{
+    convolve_band_fixed(inFrame, outFrame, coefficient, coefficient_size, img_width, img_height, 0, img_height);
+}
+
+convolve_band_fn convolve_band_fixed_best()
+{
+#ifdef CONVOLVE_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl")) return convolve_band_fixed_avx512;
+    if(__builtin_cpu_supports("avx2")) return convolve_band_fixed_avx2;
+#endif
+    return convolve_band_fixed;
+}
+
+extern "C"
+{
+
+convolve_fn convolve_cpu_fixed_impl(const char* isa)
+{
+    if(strcmp(isa, "scalar") == 0) return convolve_cpu_fixed_scalar;
+#ifdef CONVOLVE_X86
+    __builtin_cpu_init();
+    if(strcmp(isa, "avx2") == 0 && __builtin_cpu_supports("avx2")) return convolve_cpu_fixed_avx2;
+    if(strcmp(isa, "avx512") == 0 && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl"))
+        return convolve_cpu_fixed_avx512;
+#endif
+    return nullptr;
+}
+
+}
@@ -0,0 +1,536 @@
+
+#include "constants.h"
+#include "convolve_bands.h"
+#include "kernels.h"
+#include "types.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CONVOLVE_X86 1
+#endif
+
+using std::vector;
+
+// Vectorized 2D convolution. The frame is copied into a buffer with a zero
+// border of filter_size/2 pixels, so the inner loops have no bounds checks,
+// and the 4 channels of a pixel stay interleaved: one float vector holds 2
+// (AVX2) or 4 (AVX-512) whole RGBA pixels, multiplied by the same broadcast
+// coefficient. The multiply-adds are done in the order of convolve_cpu_2d
+// and without FMA, then fabsf and truncation to the low byte, so the output
+// is the same as convolve_cpu_2d. The alpha channel of outFrame is left as is.
+// A band pads only its lines and their halo rows.
+
+// Line first_line - center of the frame is line 0 of the padded buffer
+const RGBPixel* pad_frame(const RGBPixel* inFrame, int img_width, int img_height,
+                          int first_line, int last_line, int center, int stride)
+{
+    static thread_local vector<RGBPixel> padded;
+    RGBPixel zero = { 0, 0, 0, 0 };
+    padded.assign((size_t)stride * (last_line - first_line + 2 * center), zero);
+    for(int line = std::max(0, first_line - center); line < std::min(img_height, last_line + center); ++line)
+    {
+        memcpy(&padded[(size_t)(line - first_line + center) * stride + center], &inFrame[(size_t)line * img_width],
+               img_width * sizeof(RGBPixel));
+    }
+    return padded.data();
+}
+
+// Stores count pixels of group, keeping the alpha channel of out
+static void store_pixels(RGBPixel* out, const RGBPixel* group, int count)
+{
+    for(int i = 0; i < count; ++i)
+    {
+        out[i].r = group[i].r;
+        out[i].g = group[i].g;
+        out[i].b = group[i].b;
+    }
+}
+
+#ifdef CONVOLVE_X86
+
+// fabsf, truncate, keep the low byte of each channel and store the 8 pixels
+// of acc, keeping the alpha channel of out
+__attribute__((target("avx2")))
+static inline void store_avx2(RGBPixel* out, const __m256 acc[4], int count)
+{
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    const __m256i low_byte = _mm256_set1_epi32(0xff);
+    const __m256i rgb = _mm256_set1_epi32(0x00ffffff);
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+    __m256i q[4];
+    for(int j = 0; j < 4; ++j)
+    {
+        q[j] = _mm256_and_si256(_mm256_cvttps_epi32(_mm256_andnot_ps(sign, acc[j])), low_byte);
+    }
+    __m256i packed = _mm256_packus_epi16(_mm256_packus_epi32(q[0], q[1]), _mm256_packus_epi32(q[2], q[3]));
+    packed = _mm256_permutevar8x32_epi32(packed, order);
+
+    if(count == 8)
+    {
+        __m256i old = _mm256_loadu_si256((const __m256i*)out);
+        _mm256_storeu_si256((__m256i*)out, _mm256_blendv_epi8(old, packed, rgb));
+    }
+    else
+    {
+        RGBPixel group[8];
+        _mm256_storeu_si256((__m256i*)group, packed);
+        store_pixels(out, group, count);
+    }
+}
+
+// Same for the 16 pixels of acc
+__attribute__((target("avx512f")))
+static inline void store_avx512(RGBPixel* out, const __m512 acc[4], int count)
+{
+    RGBPixel group[16];
+    for(int j = 0; j < 4; ++j)
+    {
+        // vpmovdb keeps the low byte, like the scalar conversion
+        __m512i q = _mm512_cvttps_epi32(_mm512_abs_ps(acc[j]));
+        _mm_storeu_si128((__m128i*)&group[4 * j], _mm512_cvtepi32_epi8(q));
+    }
+    store_pixels(out, group, count);
+}
+
+// 8 pixels per step, in 4 vectors of 2 pixels
+__attribute__((target("avx2"), optimize("fp-contract=off")))
+static void convolve_band_avx2(const RGBPixel* inFrame, RGBPixel* outFrame,
+                               const float* coefficient, int coefficient_size,
+                               int img_width, int img_height, int first_line, int last_line)
+{
+    int center = coefficient_size / 2;
+    int stride = img_width + 2 * center + simd_pad;
+    const RGBPixel* padded = pad_frame(inFrame, img_width, img_height, first_line, last_line, center, stride);
+
+    for(int line = first_line; line < last_line; ++line)
+    {
+        for(int pixel = 0; pixel < img_width; pixel += 8)
+        {
+            __m256 acc[4] = { _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps() };
+            for(int m = 0; m < coefficient_size; ++m)
+            {
+                const RGBPixel* src = &padded[(size_t)(line - first_line + m) * stride + pixel];
+                for(int n = 0; n < coefficient_size; ++n)
+                {
+                    __m256 c = _mm256_set1_ps(coefficient[(m * coefficient_size) + n]);
+                    __m128i p0 = _mm_loadu_si128((const __m128i*)(src + n));
+                    __m128i p1 = _mm_loadu_si128((const __m128i*)(src + n + 4));
+                    __m256 v0 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(p0));
+                    __m256 v1 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(p0, 8)));
+                    __m256 v2 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(p1));
+                    __m256 v3 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(p1, 8)));
+                    acc[0] = _mm256_add_ps(acc[0], _mm256_mul_ps(v0, c));
+                    acc[1] = _mm256_add_ps(acc[1], _mm256_mul_ps(v1, c));
+                    acc[2] = _mm256_add_ps(acc[2], _mm256_mul_ps(v2, c));
+                    acc[3] = _mm256_add_ps(acc[3], _mm256_mul_ps(v3, c));
+                }
+            }
+
+            int count = (pixel + 8 <= img_width) ? 8 : img_width - pixel;
+            store_avx2(&outFrame[(size_t)line * img_width + pixel], acc, count);
+        }
+    }
+}
+
+// 16 pixels per step, in 4 vectors of 4 pixels
+__attribute__((target("avx512f"), optimize("fp-contract=off")))
+static void convolve_band_avx512(const RGBPixel* inFrame, RGBPixel* outFrame,
+                                 const float* coefficient, int coefficient_size,
+                                 int img_width, int img_height, int first_line, int last_line)
+{
+    int center = coefficient_size / 2;
+    int stride = img_width + 2 * center + simd_pad;
+    const RGBPixel* padded = pad_frame(inFrame, img_width, img_height, first_line, last_line, center, stride);
+
+    for(int line = first_line; line < last_line; ++line)
+    {
+        for(int pixel = 0; pixel < img_width; pixel += 16)
+        {
+            __m512 acc[4] = { _mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps() };
+            for(int m = 0; m < coefficient_size; ++m)
+            {
+                const RGBPixel* src = &padded[(size_t)(line - first_line + m) * stride + pixel];
+                for(int n = 0; n < coefficient_size; ++n)
+                {
+                    __m512 c = _mm512_set1_ps(coefficient[(m * coefficient_size) + n]);
+                    for(int j = 0; j < 4; ++j)
+                    {
+                        __m128i p = _mm_loadu_si128((const __m128i*)(src + n + 4 * j));
+                        acc[j] = _mm512_add_ps(acc[j], _mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(p)), c));
+                    }
+                }
+            }
+
+            int count = (pixel + 16 <= img_width) ? 16 : img_width - pixel;
+            store_avx512(&outFrame[(size_t)line * img_width + pixel], acc, count);
+        }
+    }
+}
+
+// Tiled engines for large filters. The untiled loops stream coefficient_size
+// full-width rows for every output line, which for 19x19 at 1280 pixels is
+// ~100 KB and falls out of L1. Here each band is cut into tiles of
+// tile_width pixels, sized so the input rows under a step (coefficient_size
+// + tile_lines - 1 rows of the tile) stay in L1 while the tile moves down
+// the band. A step computes tile_lines output lines together: each input row
+// is loaded and converted once and multiplied by the coefficient row of every
+// output line it falls under. Each accumulator still adds its products in
+// the m, n order of convolve_cpu_2d, so the output does not change.
+static const int tile_cache_bytes = 32 * 1024;
+
+static int tile_width(int coefficient_size, int tile_lines, int group)
+{
+    int rows = coefficient_size + tile_lines - 1;
+    int width = tile_cache_bytes / (rows * (int)sizeof(RGBPixel)) - (coefficient_size - 1);
+    return std::max(group, width / group * group);
+}
+
+// lines output lines of 8 pixels from padded line row
+template<int lines>
+__attribute__((target("avx2"), optimize("fp-contract=off")))
+static inline void tile_step_avx2(const RGBPixel* padded, int stride, int row, int pixel,
+                                  const float* coefficient, int coefficient_size, __m256 acc[][4])
+{
+    for(int l = 0; l < lines; ++l)
+        for(int j = 0; j < 4; ++j) acc[l][j] = _mm256_setzero_ps();
+
+    for(int r = 0; r < coefficient_size + lines - 1; ++r)
+    {
+        const RGBPixel* src = &padded[(size_t)(row + r) * stride + pixel];
+        int l_begin = std::max(0, r - coefficient_size + 1);
+        int l_end   = std::min(lines, r + 1);
+        for(int n = 0; n < coefficient_size; ++n)
+        {
+            __m128i p0 = _mm_loadu_si128((const __m128i*)(src + n));
+            __m128i p1 = _mm_loadu_si128((const __m128i*)(src + n + 4));
+            __m256 v[4] = { _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(p0)),
+                            _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(p0, 8))),
+                            _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(p1)),
+                            _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(p1, 8))) };
+            for(int l = l_begin; l < l_end; ++l)
+            {
+                // Output line l uses this row with coefficient row r - l
+                __m256 c = _mm256_set1_ps(coefficient[((r - l) * coefficient_size) + n]);
+                for(int j = 0; j < 4; ++j) acc[l][j] = _mm256_add_ps(acc[l][j], _mm256_mul_ps(v[j], c));
+            }
+        }
+    }
+}
+
+template<int lines>
+__attribute__((target("avx512f"), optimize("fp-contract=off")))
+static inline void tile_step_avx512(const RGBPixel* padded, int stride, int row, int pixel,
+                                    const float* coefficient, int coefficient_size, __m512 acc[][4])
+{
+    for(int l = 0; l < lines; ++l)
+        for(int j = 0; j < 4; ++j) acc[l][j] = _mm512_setzero_ps();
+
+    for(int r = 0; r < coefficient_size + lines - 1; ++r)
+    {
+        const RGBPixel* src = &padded[(size_t)(row + r) * stride + pixel];
+        int l_begin = std::max(0, r - coefficient_size + 1);
+        int l_end   = std::min(lines, r + 1);
+        for(int n = 0; n < coefficient_size; ++n)
+        {
+            __m512 v[4];
+            for(int j = 0; j < 4; ++j)
+            {
+                v[j] = _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)(src + n + 4 * j))));
+            }
+            for(int l = l_begin; l < l_end; ++l)
+            {
+                __m512 c = _mm512_set1_ps(coefficient[((r - l) * coefficient_size) + n]);
+                for(int j = 0; j < 4; ++j) acc[l][j] = _mm512_add_ps(acc[l][j], _mm512_mul_ps(v[j], c));
+            }
+        }
+    }
+}
+
+// 2 lines of 8 pixels per step, 8 accumulators of the 16 AVX2 registers
+__attribute__((target("avx2"), optimize("fp-contract=off")))
+static void convolve_band_tiled_avx2(const RGBPixel* inFrame, RGBPixel* outFrame,
+                                     const float* coefficient, int coefficient_size,
+                                     int img_width, int img_height, int first_line, int last_line)
+{
+    const int tile_lines = 2;
+    int center = coefficient_size / 2;
+    int stride = img_width + 2 * center + simd_pad;
+    const RGBPixel* padded = pad_frame(inFrame, img_width, img_height, first_line, last_line, center, stride);
+    int width = tile_width(coefficient_size, tile_lines, 8);
+
+    for(int tile = 0; tile < img_width; tile += width)
+    {
+        int tile_end = std::min(img_width, tile + width);
+        int lines;
+        for(int line = first_line; line < last_line; line += lines)
+        {
+            // Whole steps, then the last lines of the band one at a time
+            lines = (last_line - line >= tile_lines) ? tile_lines : 1;
+            for(int pixel = tile; pixel < tile_end; pixel += 8)
+            {
+                __m256 acc[tile_lines][4];
+                if(lines == tile_lines)
+                    tile_step_avx2<tile_lines>(padded, stride, line - first_line, pixel, coefficient, coefficient_size, acc);
+                else
+                    tile_step_avx2<1>(padded, stride, line - first_line, pixel, coefficient, coefficient_size, acc);
+                int count = std::min(8, img_width - pixel);
+                for(int l = 0; l < lines; ++l)
+                    store_avx2(&outFrame[(size_t)(line + l) * img_width + pixel], acc[l], count);
+            }
+        }
+    }
+}
+
+// 4 lines of 16 pixels per step, 16 accumulators of the 32 AVX-512 registers
+__attribute__((target("avx512f"), optimize("fp-contract=off")))
+static void convolve_band_tiled_avx512(const RGBPixel* inFrame, RGBPixel* outFrame,
+                                       const float* coefficient, int coefficient_size,
+                                       int img_width, int img_height, int first_line, int last_line)
+{
+    const int tile_lines = 4;
+    int center = coefficient_size / 2;
+    int stride = img_width + 2 * center + simd_pad;
+    const RGBPixel* padded = pad_frame(inFrame, img_width, img_height, first_line, last_line, center, stride);
+    int width = tile_width(coefficient_size, tile_lines, 16);
+
+    for(int tile = 0; tile < img_width; tile += width)
+    {
+        int tile_end = std::min(img_width, tile + width);
+        int lines;
+        for(int line = first_line; line < last_line; line += lines)
+        {
+            // Whole steps, then the last lines of the band one at a time
+            lines = (last_line - line >= tile_lines) ? tile_lines : 1;
+            for(int pixel = tile; pixel < tile_end; pixel += 16)
+            {
+                __m512 acc[tile_lines][4];
+                if(lines == tile_lines)
+                    tile_step_avx512<tile_lines>(padded, stride, line - first_line, pixel, coefficient, coefficient_size, acc);
+                else
+                    tile_step_avx512<1>(padded, stride, line - first_line, pixel, coefficient, coefficient_size, acc);
+                int count = std::min(16, img_width - pixel);
+                for(int l = 0; l < lines; ++l)
+                    store_avx512(&outFrame[(size_t)(line + l) * img_width + pixel], acc[l], count);
+            }
+        }
+    }
+}
+
+// Separable engines for rank-1 filters, convolve_band_separable with the
+// layout above: 2*coefficient_size multiply-adds per pixel and channel
+// instead of coefficient_size^2. Each padded row of the band is filtered with
+// row into a ring of coefficient_size rows of RGBA floats, small enough to
+// stay in L2, and each output line sums the rows of the ring times col. Rows
+// in the zero border filter to zero, so the output is within 1 of
+// convolve_cpu_2d like the scalar passes.
+
+// Padded row r of the band into its slot of the ring
+template<typename HorizontalRow>
+static inline void fill_ring(HorizontalRow horizontal_row, float* ring, int h_stride, int coefficient_size, int r)
+{
+    horizontal_row(r, ring + (size_t)(r % coefficient_size) * h_stride);
+}
+
+// 8 pixels per step, in 4 vectors of 2 pixels
+__attribute__((target("avx2")))
+static void convolve_band_separable_avx2(const RGBPixel* inFrame, RGBPixel* outFrame,
+                                         const float* coefficient, int coefficient_size,
+                                         int img_width, int img_height, int first_line, int last_line)
+{
+    float col[MAX_FILTER], row[MAX_FILTER];
+    separable_factors(coefficient, coefficient_size, col, row);
+
+    int center = coefficient_size / 2;
+    int stride = img_width + 2 * center + simd_pad;
+    const RGBPixel* padded = pad_frame(inFrame, img_width, img_height, first_line, last_line, center, stride);
+
+    int h_stride = 4 * ((img_width + 7) & ~7);
+    static thread_local vector<float> ring;
+    ring.resize((size_t)h_stride * coefficient_size);
+
+    auto horizontal_row = [&](int r, float* out) __attribute__((target("avx2"))) {
+        for(int pixel = 0; pixel < img_width; pixel += 8)
+        {
+            const RGBPixel* src = &padded[(size_t)r * stride + pixel];
+            __m256 acc[4] = { _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps() };
+            for(int n = 0; n < coefficient_size; ++n)
+            {
+                __m256 c = _mm256_set1_ps(row[n]);
+                __m128i p0 = _mm_loadu_si128((const __m128i*)(src + n));
+                __m128i p1 = _mm_loadu_si128((const __m128i*)(src + n + 4));
+                acc[0] = _mm256_add_ps(acc[0], _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(p0)), c));
+                acc[1] = _mm256_add_ps(acc[1], _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(p0, 8))), c));
+                acc[2] = _mm256_add_ps(acc[2], _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(p1)), c));
+                acc[3] = _mm256_add_ps(acc[3], _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(p1, 8))), c));
+            }
+            for(int j = 0; j < 4; ++j) _mm256_storeu_ps(out + 4 * pixel + 8 * j, acc[j]);
+        }
+    };
+
+    for(int r = 0; r < coefficient_size - 1; ++r) fill_ring(horizontal_row, ring.data(), h_stride, coefficient_size, r);
+    for(int line = first_line; line < last_line; ++line)
+    {
+        int l = line - first_line;
+        fill_ring(horizontal_row, ring.data(), h_stride, coefficient_size, l + coefficient_size - 1);
+        for(int pixel = 0; pixel < img_width; pixel += 8)
+        {
+            __m256 acc[4] = { _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps() };
+            for(int m = 0; m < coefficient_size; ++m)
+            {
+                __m256 c = _mm256_set1_ps(col[m]);
+                const float* src = &ring[(size_t)((l + m) % coefficient_size) * h_stride + 4 * pixel];
+                for(int j = 0; j < 4; ++j) acc[j] = _mm256_add_ps(acc[j], _mm256_mul_ps(_mm256_loadu_ps(src + 8 * j), c));
+            }
+            int count = std::min(8, img_width - pixel);
+            store_avx2(&outFrame[(size_t)line * img_width + pixel], acc, count);
+        }
+    }
+}
+
+// 16 pixels per step, in 4 vectors of 4 pixels
+__attribute__((target("avx512f")))
+static void convolve_band_separable_avx512(const RGBPixel* inFrame, RGBPixel* outFrame,
+                                           const float* coefficient, int coefficient_size,
+                                           int img_width, int img_height, int first_line, int last_line)
+{
+    float col[MAX_FILTER], row[MAX_FILTER];
+    separable_factors(coefficient, coefficient_size, col, row);
+
+    int center = coefficient_size / 2;
+    int stride = img_width + 2 * center + simd_pad;
+    const RGBPixel* padded = pad_frame(inFrame, img_width, img_height, first_line, last_line, center, stride);
+
+    int h_stride = 4 * ((img_width + 15) & ~15);
+    static thread_local vector<float> ring;
+    ring.resize((size_t)h_stride * coefficient_size);
+
+    auto horizontal_row = [&](int r, float* out) __attribute__((target("avx512f"))) {
+        for(int pixel = 0; pixel < img_width; pixel += 16)
+        {
+            const RGBPixel* src = &padded[(size_t)r * stride + pixel];
+            __m512 acc[4] = { _mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps() };
+            for(int n = 0; n < coefficient_size; ++n)
+            {
+                __m512 c = _mm512_set1_ps(row[n]);
+                for(int j = 0; j < 4; ++j)
+                {
+                    __m128i p = _mm_loadu_si128((const __m128i*)(src + n + 4 * j));
+                    acc[j] = _mm512_add_ps(acc[j], _mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(p)), c));
+                }
+            }
+            for(int j = 0; j < 4; ++j) _mm512_storeu_ps(out + 4 * pixel + 16 * j, acc[j]);
+        }
+    };
+
+    for(int r = 0; r < coefficient_size - 1; ++r) fill_ring(horizontal_row, ring.data(), h_stride, coefficient_size, r);
+    for(int line = first_line; line < last_line; ++line)
+    {
+        int l = line - first_line;
+        fill_ring(horizontal_row, ring.data(), h_stride, coefficient_size, l + coefficient_size - 1);
+        for(int pixel = 0; pixel < img_width; pixel += 16)
+        {
+            __m512 acc[4] = { _mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps() };
+            for(int m = 0; m < coefficient_size; ++m)
+            {
+                __m512 c = _mm512_set1_ps(col[m]);
+                const float* src = &ring[(size_t)((l + m) % coefficient_size) * h_stride + 4 * pixel];
+                for(int j = 0; j < 4; ++j) acc[j] = _mm512_add_ps(acc[j], _mm512_mul_ps(_mm512_loadu_ps(src + 16 * j), c));
+            }
+            int count = std::min(16, img_width - pixel);
+            store_avx512(&outFrame[(size_t)line * img_width + pixel], acc, count);
+        }
+    }
+}
+
+static void convolve_cpu_avx2(const RGBPixel* inFrame, RGBPixel* outFrame,
+                              const float* coefficient, int coefficient_size,
+                              int img_width, int img_height)
+{
+    convolve_band_avx2(inFrame, outFrame, coefficient, coefficient_size, img_width, img_height, 0, img_height);
+}
+
+static void convolve_cpu_avx512(const RGBPixel* inFrame, RGBPixel* outFrame,
+                                const float* coefficient, int coefficient_size,
+                                int img_width, int img_height)
+{
+    convolve_band_avx512(inFrame, outFrame, coefficient, coefficient_size, img_width, img_height, 0, img_height);
+}
+
+static void convolve_cpu_tiled_avx2(const RGBPixel* inFrame, RGBPixel* outFrame,
+                                    const float* coefficient, int coefficient_size,
+                                    int img_width, int img_height)
+{
+    convolve_band_tiled_avx2(inFrame, outFrame, coefficient, coefficient_size, img_width, img_height, 0, img_height);
+}
+
+static void convolve_cpu_tiled_avx512(const RGBPixel* inFrame, RGBPixel* outFrame,
+                                      const float* coefficient, int coefficient_size,
+                                      int img_width, int img_height)
+{
+    convolve_band_tiled_avx512(inFrame, outFrame, coefficient, coefficient_size, img_width, img_height, 0, img_height);
+}
+
+#endif
+
+convolve_band_fn convolve_band_simd_impl(const char* isa)
+{
+#ifdef CONVOLVE_X86
+    __builtin_cpu_init();
+    if(strcmp(isa, "avx2") == 0 && __builtin_cpu_supports("avx2")) return convolve_band_avx2;
+    if(strcmp(isa, "avx512") == 0 && __builtin_cpu_supports("avx512f")) return convolve_band_avx512;
+    if(strcmp(isa, "avx2-tiled") == 0 && __builtin_cpu_supports("avx2")) return convolve_band_tiled_avx2;
+    if(strcmp(isa, "avx512-tiled") == 0 && __builtin_cpu_supports("avx512f")) return convolve_band_tiled_avx512;
+    if(strcmp(isa, "avx2-separable") == 0 && __builtin_cpu_supports("avx2")) return convolve_band_separable_avx2;
+    if(strcmp(isa, "avx512-separable") == 0 && __builtin_cpu_supports("avx512f")) return convolve_band_separable_avx512;
+#endif
+    return nullptr;
+}
+
+convolve_band_fn convolve_band_simd_best(int coefficient_size)
+{
+    static const convolve_band_fn untiled = convolve_band_simd_impl("avx512") ? convolve_band_simd_impl("avx512") :
+                                            convolve_band_simd_impl("avx2")   ? convolve_band_simd_impl("avx2")   : convolve_band_2d;
+    static const convolve_band_fn tiled = convolve_band_simd_impl("avx512-tiled") ? convolve_band_simd_impl("avx512-tiled") :
+                                          convolve_band_simd_impl("avx2-tiled")   ? convolve_band_simd_impl("avx2-tiled")   : convolve_band_2d;
+    return coefficient_size >= tiled_filter_size ? tiled : untiled;
+}
+
+convolve_band_fn convolve_band_separable_best()
+{
+    static const convolve_band_fn best = convolve_band_simd_impl("avx512-separable") ? convolve_band_simd_impl("avx512-separable") :
+                                         convolve_band_simd_impl("avx2-separable")   ? convolve_band_simd_impl("avx2-separable")   :
+                                                                                       convolve_band_separable;
+    return best;
+}
+
+extern "C"
+{
+
+convolve_fn convolve_cpu_2d_impl(const char* isa)
+{
+    if(strcmp(isa, "scalar") == 0) return convolve_cpu_2d;
+#ifdef CONVOLVE_X86
+    __builtin_cpu_init();
+    if(strcmp(isa, "avx2") == 0 && __builtin_cpu_supports("avx2")) return convolve_cpu_avx2;
+    if(strcmp(isa, "avx512") == 0 && __builtin_cpu_supports("avx512f")) return convolve_cpu_avx512;
+    if(strcmp(isa, "avx2-tiled") == 0 && __builtin_cpu_supports("avx2")) return convolve_cpu_tiled_avx2;
+    if(strcmp(isa, "avx512-tiled") == 0 && __builtin_cpu_supports("avx512f")) return convolve_cpu_tiled_avx512;
+#endif
+    return nullptr;
+}
+
+void convolve_cpu_simd(const RGBPixel* inFrame, RGBPixel* outFrame,
+                       const float* coefficient, int coefficient_size,
+                       int img_width, int img_height)
+{
+    convolve_band_fn fn = convolve_band_simd_best(coefficient_size);
+    fn(inFrame, outFrame, coefficient, coefficient_size, img_width, img_height, 0, img_height);
+}
+
+}
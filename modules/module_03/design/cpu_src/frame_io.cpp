@@ -0,0 +1,481 @@
+#include "frame_io.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <strings.h>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using std::min;
+using std::string;
+using std::vector;
+
+namespace {
+
+bool has_extension(const char* path, const char* extension) {
+    const char* dot = strrchr(path, '.');
+    return dot && strcasecmp(dot + 1, extension) == 0;
+}
+
+bool is_raw(const char* path) {
+    return has_extension(path, "rgba") || has_extension(path, "raw");
+}
+
+bool is_y4m(const char* path) {
+    return has_extension(path, "y4m");
+}
+
+// Read-only view of a file. The file is mapped when it can be, and a range
+// is then a pointer into the mapping; otherwise (a file system without mmap)
+// a range is read into the caller's buffer with pread.
+class InputFile {
+public:
+    InputFile() : fd(-1), data(nullptr), size(0) {}
+    ~InputFile() {
+        if(data) munmap(data, size);
+        if(fd >= 0) close(fd);
+    }
+
+    bool open(const char* path) {
+        fd = ::open(path, O_RDONLY);
+        if(fd < 0) return false;
+        struct stat st;
+        if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            size = st.st_size;
+            void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(mapping != MAP_FAILED) {
+                data = (unsigned char*)mapping;
+                madvise(data, size, MADV_SEQUENTIAL);
+            } else {
+                posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+            }
+        }
+        return true;
+    }
+
+    bool mapped() const { return data != nullptr; }
+
+    // bytes at offset, nullptr past the end of the file or on a read error
+    const unsigned char* at(size_t offset, size_t bytes, void* buffer) {
+        if(data) {
+            return offset + bytes <= size ? data + offset : nullptr;
+        }
+        size_t done = 0;
+        while(done < bytes) {
+            ssize_t n = pread(fd, (char*)buffer + done, bytes - done, offset + done);
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0) return nullptr;
+            done += n;
+        }
+        return (const unsigned char*)buffer;
+    }
+
+    // Starts reading the range in the background and faults the pages of
+    // the frame being returned in the calling (reader) thread, so the compute
+    // thread does not stall on them
+    void prefetch(size_t offset, size_t bytes, size_t next_bytes) {
+        if(!data || offset >= size) return;
+        size_t page = sysconf(_SC_PAGESIZE);
+        size_t next = offset + bytes;
+        if(next < size) {
+            size_t start = next / page * page;
+            madvise(data + start, min(next_bytes, size - next) + (next - start), MADV_WILLNEED);
+        }
+        volatile unsigned char sink = 0;
+        for(size_t i = offset; i < min(offset + bytes, size); i += page) sink += data[i];
+        (void)sink;
+    }
+
+    int fd;
+    unsigned char* data;
+    size_t size;
+};
+
+// YUV4MPEG2 stream header: "YUV4MPEG2 W1280 H720 F25:1 Ip A1:1 C420jpeg\n"
+// followed by frames, each "FRAME[ params]\n" and the Y, Cb, Cr planes
+struct Y4mFormat {
+    enum Chroma { unsupported, high_depth, c420, c444, mono };
+
+    int width;
+    int height;
+    Chroma chroma;
+    size_t header_bytes;
+
+    size_t chroma_width() const { return chroma == c420 ? (width + 1) / 2 : width; }
+    size_t chroma_height() const { return chroma == c420 ? (height + 1) / 2 : height; }
+    size_t frame_bytes() const {
+        size_t luma = (size_t)width * height;
+        return chroma == mono ? luma : luma + 2 * chroma_width() * chroma_height();
+    }
+};
+
+// Length of the line at offset including its '\n', 0 if none within limit
+size_t line_length(InputFile& file, size_t offset, size_t limit, vector<char>& scratch) {
+    scratch.resize(limit);
+    size_t bytes = file.mapped() ? min(limit, file.size > offset ? file.size - offset : 0) : limit;
+    const unsigned char* line = nullptr;
+    // Fewer than limit bytes left in the file: retry shorter
+    while(bytes > 0 && !(line = file.at(offset, bytes, scratch.data()))) bytes /= 2;
+    if(!line) return 0;
+    const void* end = memchr(line, '\n', bytes);
+    return end ? (const unsigned char*)end - line + 1 : 0;
+}
+
+// Chroma tag of a Y4M header. Only 8-bit samples are decoded, a tag with a bit
+// depth (420p10, 444p12, mono16) is high_depth and 8-bit 422 or 411 unsupported
+Y4mFormat::Chroma y4m_chroma(const string& tag) {
+    if(tag.find_first_not_of("0123456789") != string::npos && isdigit((unsigned char)tag.back()))
+        return Y4mFormat::high_depth;
+    if(tag == "420" || tag == "420jpeg" || tag == "420paldv" || tag == "420mpeg2") return Y4mFormat::c420;
+    if(tag == "444") return Y4mFormat::c444;
+    if(tag == "mono") return Y4mFormat::mono;
+    return Y4mFormat::unsupported;
+}
+
+bool parse_y4m(InputFile& file, Y4mFormat& format) {
+    format.width = format.height = 0;
+    format.chroma = Y4mFormat::c420;
+
+    vector<char> scratch;
+    size_t length = line_length(file, 0, 1024, scratch);
+    if(length == 0) return false;
+    string header((const char*)file.at(0, length, scratch.data()), length - 1);
+    if(header.compare(0, 10, "YUV4MPEG2 ") != 0) return false;
+
+    format.header_bytes = length;
+    size_t pos = 10;
+    while(pos < header.size()) {
+        size_t end = header.find(' ', pos);
+        if(end == string::npos) end = header.size();
+        string token = header.substr(pos, end - pos);
+        if(!token.empty()) {
+            string value = token.substr(1);
+            switch(token[0]) {
+                case 'W': format.width = atoi(value.c_str()); break;
+                case 'H': format.height = atoi(value.c_str()); break;
+                case 'C': format.chroma = y4m_chroma(value); break;
+            }
+        }
+        pos = end + 1;
+    }
+    return format.width > 0 && format.height > 0 && format.chroma >= Y4mFormat::c420;
+}
+
+// Frames of a Y4M file, walking the frame headers
+int count_y4m_frames(InputFile& file, const Y4mFormat& format) {
+    vector<char> scratch;
+    size_t offset = format.header_bytes;
+    int frames = 0;
+    while(size_t length = line_length(file, offset, 256, scratch)) {
+        offset += length + format.frame_bytes();
+        if(file.mapped() && offset > file.size) break;
+        if(!file.mapped() && !file.at(offset - 1, 1, scratch.data())) break;
+        frames++;
+    }
+    return frames;
+}
+
+unsigned char clamp_byte(int value) {
+    return value < 0 ? 0 : value > 255 ? 255 : value;
+}
+
+// BT.601 limited range, the default of ffmpeg's rgba conversions, in 8-bit
+// fixed point
+void yuv_to_rgba(int y, int u, int v, RGBPixel& p) {
+    int c = 298 * (y - 16) + 128;
+    int d = u - 128;
+    int e = v - 128;
+    p.r = clamp_byte((c + 409 * e) >> 8);
+    p.g = clamp_byte((c - 100 * d - 208 * e) >> 8);
+    p.b = clamp_byte((c + 516 * d) >> 8);
+    p.a = 255;
+}
+
+class RawSource : public FrameSource {
+public:
+    RawSource(size_t frame_bytes) : frame_bytes(frame_bytes), offset(0) {}
+
+    bool open(const char* path) { return file.open(path); }
+
+    const RGBPixel* read(RGBPixel* buffer) {
+        const unsigned char* frame = file.at(offset, frame_bytes, buffer);
+        if(frame) file.prefetch(offset, frame_bytes, frame_bytes);
+        offset += frame_bytes;
+        return (const RGBPixel*)frame;
+    }
+
+    const char* name() const { return file.mapped() ? "raw RGBA (mmap)" : "raw RGBA (pread)"; }
+
+private:
+    InputFile file;
+    size_t frame_bytes;
+    size_t offset;
+};
+
+class Y4mSource : public FrameSource {
+public:
+    Y4mSource() : offset(0) {}
+
+    bool open(const char* path) {
+        if(!file.open(path) || !parse_y4m(file, format)) return false;
+        offset = format.header_bytes;
+        return true;
+    }
+
+    const RGBPixel* read(RGBPixel* buffer) {
+        size_t length = line_length(file, offset, 256, scratch);
+        const unsigned char* tag = file.at(offset, 5, scratch.data());
+        if(length < 6 || !tag || memcmp(tag, "FRAME", 5) != 0) return nullptr;
+        offset += length;
+        size_t bytes = format.frame_bytes();
+        planes.resize(file.mapped() ? 0 : bytes);
+        const unsigned char* frame = file.at(offset, bytes, planes.data());
+        if(!frame) return nullptr;
+        file.prefetch(offset, bytes, bytes + length);
+        offset += bytes;
+
+        int width = format.width;
+        size_t chroma_width = format.chroma_width();
+        const unsigned char* y_plane = frame;
+        const unsigned char* u_plane = y_plane + (size_t)width * format.height;
+        const unsigned char* v_plane = u_plane + chroma_width * format.chroma_height();
+        for(int line = 0; line < format.height; line++) {
+            const unsigned char* y = y_plane + (size_t)line * width;
+            RGBPixel* out = buffer + (size_t)line * width;
+            if(format.chroma == Y4mFormat::mono) {
+                for(int pixel = 0; pixel < width; pixel++) yuv_to_rgba(y[pixel], 128, 128, out[pixel]);
+                continue;
+            }
+            int chroma_line = format.chroma == Y4mFormat::c420 ? line / 2 : line;
+            const unsigned char* u = u_plane + chroma_line * chroma_width;
+            const unsigned char* v = v_plane + chroma_line * chroma_width;
+            int shift = format.chroma == Y4mFormat::c420 ? 1 : 0;
+            for(int pixel = 0; pixel < width; pixel++) {
+                yuv_to_rgba(y[pixel], u[pixel >> shift], v[pixel >> shift], out[pixel]);
+            }
+        }
+        return buffer;
+    }
+
+    const char* name() const { return file.mapped() ? "Y4M (mmap)" : "Y4M (pread)"; }
+
+private:
+    InputFile file;
+    Y4mFormat format;
+    size_t offset;
+    vector<char> scratch;
+    vector<unsigned char> planes;
+};
+
+class FfmpegSource : public FrameSource {
+public:
+    FfmpegSource(const arguments& args) : frame_bytes(args.width * args.height * sizeof(RGBPixel)) {
+        command.resize(2048);
+        snprintf(&command.front(), 2048,
+                 "ffmpeg -v error -hide_banner -i %s -f image2pipe -vcodec rawvideo -vf scale=w=%d:h=%d -vframes %d -pix_fmt rgba -",
+                 args.input_file, args.width, args.height, args.nframes);
+        command.resize(strlen(command.c_str()));
+        stream = popen(command.c_str(), "r");
+    }
+    ~FfmpegSource() {
+        if(stream) pclose(stream);
+    }
+
+    bool opened() const { return stream != nullptr; }
+
+    const RGBPixel* read(RGBPixel* buffer) {
+        size_t bytes_read = fread(buffer, 1, frame_bytes, stream);
+        return bytes_read == frame_bytes ? buffer : nullptr;
+    }
+
+    const char* name() const { return command.c_str(); }
+
+private:
+    string command;
+    FILE* stream;
+    size_t frame_bytes;
+};
+
+bool write_all(int fd, const void* data, size_t bytes) {
+    const char* p = (const char*)data;
+    while(bytes > 0) {
+        ssize_t n = ::write(fd, p, bytes);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return false;
+        p += n;
+        bytes -= n;
+    }
+    return true;
+}
+
+class RawSink : public FrameSink {
+public:
+    RawSink() : fd(-1) {}
+    ~RawSink() {
+        if(fd >= 0) close(fd);
+    }
+
+    bool open(const char* path) {
+        fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        return fd >= 0;
+    }
+
+    bool write(const void* data, size_t bytes) { return write_all(fd, data, bytes); }
+
+    const char* name() const { return "raw"; }
+
+protected:
+    int fd;
+};
+
+// 4:4:4 (mono for --gray) so the output is not subsampled, 25 fps like the
+// ffmpeg encoder
+class Y4mSink : public RawSink {
+public:
+    Y4mSink(int width, int height, bool gray) : width(width), height(height), gray(gray) {}
+
+    bool open(const char* path) {
+        if(!RawSink::open(path)) return false;
+        char header[128];
+        snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F25:1 Ip A1:1 C%s\n", width, height, gray ? "mono" : "444");
+        return write_all(fd, header, strlen(header));
+    }
+
+    bool write(const void* data, size_t bytes) {
+        static const char frame_header[] = "FRAME\n";
+        size_t pixels = (size_t)width * height;
+        size_t header_bytes = sizeof(frame_header) - 1;
+        if(gray) {
+            return write_all(fd, frame_header, header_bytes) && write_all(fd, data, bytes);
+        }
+        frame.resize(header_bytes + 3 * pixels);
+        memcpy(frame.data(), frame_header, header_bytes);
+        unsigned char* y = frame.data() + header_bytes;
+        unsigned char* u = y + pixels;
+        unsigned char* v = u + pixels;
+        const RGBPixel* in = (const RGBPixel*)data;
+        for(size_t i = 0; i < min(pixels, bytes / sizeof(RGBPixel)); i++) {
+            int r = in[i].r, g = in[i].g, b = in[i].b;
+            y[i] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+            u[i] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+            v[i] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+        }
+        return write_all(fd, frame.data(), frame.size());
+    }
+
+    const char* name() const { return gray ? "Y4M mono" : "Y4M 4:4:4"; }
+
+private:
+    int width;
+    int height;
+    bool gray;
+    vector<unsigned char> frame;
+};
+
+class FfmpegSink : public FrameSink {
+public:
+    FfmpegSink(const arguments& args) {
+        command.resize(2048);
+        snprintf(&command.front(), 2048,
+                 "ffmpeg -v error -hide_banner -y -f rawvideo -vcodec rawvideo -pix_fmt %s -s %dx%d -framerate 25 -i - -f mp4 -q:v 5 -an -codec mpeg4 %s",
+                 (args.gray) ? "gray" : "rgba", args.width, args.height, args.output_file);
+        command.resize(strlen(command.c_str()));
+        stream = popen(command.c_str(), "w");
+    }
+    ~FfmpegSink() {
+        if(stream) pclose(stream);
+    }
+
+    bool opened() const { return stream != nullptr; }
+
+    bool write(const void* data, size_t bytes) {
+        size_t bytes_written = fwrite(data, 1, bytes, stream);
+        fflush(stream);
+        return bytes_written == bytes;
+    }
+
+    const char* name() const { return command.c_str(); }
+
+private:
+    string command;
+    FILE* stream;
+};
+
+}  // namespace
+
+bool native_video_size(const char* path, int raw_width, int raw_height,
+                       int* width, int* height, int* frames) {
+    if(is_raw(path)) {
+        InputFile file;
+        if(!file.open(path)) return false;
+        *width = raw_width;
+        *height = raw_height;
+        size_t frame_bytes = (size_t)raw_width * raw_height * sizeof(RGBPixel);
+        *frames = (raw_width > 0 && raw_height > 0) ? file.size / frame_bytes : 0;
+        return true;
+    }
+    if(is_y4m(path)) {
+        InputFile file;
+        Y4mFormat format;
+        if(!file.open(path)) return false;
+        // 8-bit 422 and 411 are left to ffprobe and ffmpeg, high bit depths
+        // are rejected
+        if(!parse_y4m(file, format)) {
+            if(format.chroma != Y4mFormat::high_depth) return false;
+            printf("Error: %s has more than 8 bits per sample, only 8-bit Y4M (C420, C444, Cmono) is supported\n", path);
+            exit(EXIT_FAILURE);
+        }
+        *width = format.width;
+        *height = format.height;
+        *frames = count_y4m_frames(file, format);
+        return true;
+    }
+    return false;
+}
+
+FrameSource* open_source(const arguments& args) {
+    if(is_raw(args.input_file)) {
+        RawSource* source = new RawSource(args.width * args.height * sizeof(RGBPixel));
+        if(source->open(args.input_file)) return source;
+        delete source;
+        return nullptr;
+    }
+    // Y4M is decoded here at its own size only; scaling is left to ffmpeg
+    if(is_y4m(args.input_file) && args.width == args.in_width && args.height == args.in_height) {
+        Y4mSource* source = new Y4mSource();
+        if(source->open(args.input_file)) return source;
+        delete source;
+    }
+    FfmpegSource* source = new FfmpegSource(args);
+    if(source->opened()) return source;
+    delete source;
+    return nullptr;
+}
+
+FrameSink* open_sink(const arguments& args) {
+    if(is_raw(args.output_file)) {
+        RawSink* sink = new RawSink();
+        if(sink->open(args.output_file)) return sink;
+        delete sink;
+        return nullptr;
+    }
+    if(is_y4m(args.output_file)) {
+        Y4mSink* sink = new Y4mSink(args.width, args.height, args.gray);
+        if(sink->open(args.output_file)) return sink;
+        delete sink;
+        return nullptr;
+    }
+    FfmpegSink* sink = new FfmpegSink(args);
+    if(sink->opened()) return sink;
+    delete sink;
+    return nullptr;
+}
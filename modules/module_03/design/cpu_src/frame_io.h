@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+
+#include "common.h"
+#include "types.h"
+
+// Frames of the input video as RGBA. The raw and Y4M sources map the file
+// and read frames from the mapping, the ffmpeg source reads them from a pipe.
+class FrameSource {
+public:
+    virtual ~FrameSource() {}
+
+    // Next frame, nullptr at the end of the input or on a read error. The
+    // pixels are either in the file mapping (raw RGBA: no copy) or decoded
+    // into buffer, which holds a frame; they stay valid until the next read.
+    virtual const RGBPixel* read(RGBPixel* buffer) = 0;
+
+    virtual const char* name() const = 0;
+};
+
+// Frames of the output video, RGBA or gray (--gray) like the pipeline
+// produces them
+class FrameSink {
+public:
+    virtual ~FrameSink() {}
+
+    // Writes a frame of bytes, false on a write error
+    virtual bool write(const void* data, size_t bytes) = 0;
+
+    virtual const char* name() const = 0;
+};
+
+// Size and frame count of a raw RGBA (.rgba, .raw) or Y4M (.y4m) input
+// without ffprobe. A raw file has no header: its frame size is the --scale
+// one, raw_width x raw_height. False if path is not one of these formats.
+bool native_video_size(const char* path, int raw_width, int raw_height,
+                       int* width, int* height, int* frames);
+
+// Input of args: the file itself when it is raw RGBA, or Y4M at its own
+// size, an ffmpeg decoder otherwise. nullptr if it cannot be opened.
+FrameSource* open_source(const arguments& args);
+
+// Output of args: written directly for a .rgba, .raw or .y4m file, through
+// an ffmpeg encoder otherwise. nullptr if it cannot be opened.
+FrameSink* open_sink(const arguments& args);
@@ -0,0 +1,136 @@
+#include "frame_pipeline.h"
+
+#include <cstdio>
+
+using std::chrono::duration;
+using std::deque;
+using std::lock_guard;
+using std::mutex;
+using std::thread;
+using std::unique_lock;
+
+FramePipeline::FramePipeline(FrameSource* source, FrameSink* sink, int width, int height, int nframes, int depth)
+    : source(source), sink(sink), nframes(nframes),
+      buffers(depth), read_done(false), compute_done(false), failed(false) {
+    for(FrameBuffer& frame : buffers) {
+        frame.in_buffer.resize(width * height);
+        frame.out.resize(width * height);
+        frame.gray.resize(width * height);
+        free_frames.push_back(&frame);
+    }
+    const char* names[3] = { "read", "compute", "write" };
+    for(int i = 0; i < 3; i++) {
+        stages[i].name = names[i];
+        stages[i].busy = stages[i].waiting = clock::duration::zero();
+        stages[i].frames = 0;
+    }
+    start = clock::now();
+    read_thread = thread(&FramePipeline::reader, this);
+    write_thread = thread(&FramePipeline::writer, this);
+}
+
+FramePipeline::~FramePipeline() {
+    if(read_thread.joinable() || write_thread.joinable()) {
+        {
+            lock_guard<mutex> guard(lock);
+            failed = true;
+        }
+        changed.notify_all();
+        if(read_thread.joinable()) read_thread.join();
+        if(write_thread.joinable()) write_thread.join();
+    }
+}
+
+// Waits for a frame in queue; nullptr once done is set and queue is empty,
+// or on failure
+FrameBuffer* FramePipeline::pop(deque<FrameBuffer*>& queue, const bool& done, Stage& stage) {
+    clock::time_point t = clock::now();
+    unique_lock<mutex> guard(lock);
+    changed.wait(guard, [&]{ return !queue.empty() || done || failed; });
+    stage.waiting += clock::now() - t;
+    if(failed || queue.empty()) return nullptr;
+    FrameBuffer* frame = queue.front();
+    queue.pop_front();
+    return frame;
+}
+
+void FramePipeline::push(deque<FrameBuffer*>& queue, FrameBuffer* frame) {
+    {
+        lock_guard<mutex> guard(lock);
+        queue.push_back(frame);
+    }
+    changed.notify_all();
+}
+
+void FramePipeline::reader() {
+    const bool never = false;
+    for(int frame_count = 0; frame_count < nframes; frame_count++) {
+        FrameBuffer* frame = pop(free_frames, never, stages[0]);
+        if(!frame) break;
+
+        clock::time_point t = clock::now();
+        frame->in = source->read(frame->in_buffer.data());
+        stages[0].busy += clock::now() - t;
+        if(!frame->in) {
+            printf("\nError: could not read frame %d of %d\n", frame_count, nframes);
+            break;
+        }
+        frame->index = frame_count;
+        stages[0].frames++;
+        push(read_frames, frame);
+    }
+    {
+        lock_guard<mutex> guard(lock);
+        read_done = true;
+    }
+    changed.notify_all();
+}
+
+void FramePipeline::writer() {
+    while(FrameBuffer* frame = pop(computed_frames, compute_done, stages[2])) {
+        clock::time_point t = clock::now();
+        bool written = sink->write(frame->data, frame->bytes);
+        stages[2].busy += clock::now() - t;
+        if(!written) {
+            printf("\nError: could not write frame %d\n", frame->index);
+            {
+                lock_guard<mutex> guard(lock);
+                failed = true;
+            }
+            changed.notify_all();
+            return;
+        }
+        stages[2].frames++;
+        push(free_frames, frame);
+    }
+}
+
+FrameBuffer* FramePipeline::acquire() {
+    FrameBuffer* frame = pop(read_frames, read_done, stages[1]);
+    compute_start = clock::now();
+    return frame;
+}
+
+void FramePipeline::submit(FrameBuffer* frame) {
+    stages[1].busy += clock::now() - compute_start;
+    stages[1].frames++;
+    push(computed_frames, frame);
+}
+
+void FramePipeline::finish() {
+    {
+        lock_guard<mutex> guard(lock);
+        compute_done = true;
+    }
+    changed.notify_all();
+    read_thread.join();
+    write_thread.join();
+
+    double elapsed = duration<double>(clock::now() - start).count();
+    printf("\n\nPipeline: %zu frame buffers, %.3f s\n", buffers.size(), elapsed);
+    for(const Stage& stage : stages) {
+        double busy = duration<double>(stage.busy).count();
+        printf("  %-8s %4d frames  busy %8.3f s (%5.1f %%)  waiting %8.3f s\n", stage.name, stage.frames,
+               busy, elapsed > 0 ? 100 * busy / elapsed : 0.0, duration<double>(stage.waiting).count());
+    }
+}
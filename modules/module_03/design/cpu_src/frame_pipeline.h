@@ -0,0 +1,81 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "frame_io.h"
+#include "types.h"
+
+// A frame in flight: the input from the source (in, either in_buffer or the
+// source's file mapping), the convolved output and what the writer sends to
+// the sink (data, bytes)
+struct FrameBuffer {
+    const RGBPixel* in;
+    std::vector<RGBPixel> in_buffer;
+    std::vector<RGBPixel> out;
+    std::vector<GrayPixel> gray;
+    const void* data;
+    size_t bytes;
+    int index;
+};
+
+// Read / compute / write pipeline over a frame source and sink. A
+// reader thread fills free buffers with frames and a writer thread writes
+// the computed ones, so frame N + 1 is read and frame N - 1 written while
+// the caller computes frame N. The depth buffers are allocated up front and
+// go back to the reader once written: when the compute or the writer falls
+// behind, the reader waits for a free buffer.
+class FramePipeline {
+public:
+    FramePipeline(FrameSource* source, FrameSink* sink, int width, int height, int nframes, int depth);
+    ~FramePipeline();
+
+    // Next frame to compute, in order, or nullptr after the last frame or
+    // on a read or write error
+    FrameBuffer* acquire();
+
+    // Hands a computed frame (data, bytes set) to the writer
+    void submit(FrameBuffer* frame);
+
+    // Waits for the writer and prints the busy and waiting time of each stage
+    void finish();
+
+private:
+    typedef std::chrono::steady_clock clock;
+
+    struct Stage {
+        const char* name;
+        clock::duration busy;
+        clock::duration waiting;
+        int frames;
+    };
+
+    void reader();
+    void writer();
+    FrameBuffer* pop(std::deque<FrameBuffer*>& queue, const bool& done, Stage& stage);
+    void push(std::deque<FrameBuffer*>& queue, FrameBuffer* frame);
+
+    FrameSource* source;
+    FrameSink* sink;
+    int nframes;
+
+    std::vector<FrameBuffer> buffers;
+    std::deque<FrameBuffer*> free_frames;
+    std::deque<FrameBuffer*> read_frames;
+    std::deque<FrameBuffer*> computed_frames;
+    bool read_done;
+    bool compute_done;
+    bool failed;
+    std::mutex lock;
+    std::condition_variable changed;
+
+    Stage stages[3];
+    clock::time_point start;
+    clock::time_point compute_start;
+    std::thread read_thread;
+    std::thread write_thread;
+};
@@ -2,8 +2,37 @@
 #include "types.h"
 
 extern "C" {
-  // Convolve RGB video frame with input filter
+  // Convolve RGB video frame with input filter. The frame is split in bands of
+  // lines run on a thread pool, the output does not depend on the thread count.
+  // Rank-1 filters use convolve_cpu_separable, others from 15x15 on
+  // convolve_cpu_fft and smaller ones convolve_cpu_simd.
   void convolve_cpu(const RGBPixel* inFrame, RGBPixel* outFrame, const float* filter, int filter_size, int img_width, int img_height);
+  // Threads of convolve_cpu, 0 for one per hardware thread (default)
+  void convolve_cpu_threads(int num_threads);
+  // Direct 2D convolution, filter_size^2 multiply-adds per pixel and channel
+  void convolve_cpu_2d(const RGBPixel* inFrame, RGBPixel* outFrame, const float* filter, int filter_size, int img_width, int img_height);
+  // Horizontal then vertical pass for rank-1 filters, 2*filter_size multiply-adds,
+  // with the widest SIMD path the CPU supports. Channels are within 1 of convolve_cpu_2d.
+  void convolve_cpu_separable(const RGBPixel* inFrame, RGBPixel* outFrame, const float* filter, int filter_size, int img_width, int img_height);
+  // True when filter is rank-1 and can be run by convolve_cpu_separable
+  bool convolve_is_separable(const float* filter, int filter_size);
+  // convolve_cpu_2d with the widest SIMD path the CPU supports, tiled from
+  // 7x7 filters on, same output
+  void convolve_cpu_simd(const RGBPixel* inFrame, RGBPixel* outFrame, const float* filter, int filter_size, int img_width, int img_height);
+  // FFT convolution on tiles for large filters, channels are within 1 of
+  // convolve_cpu_2d
+  void convolve_cpu_fft(const RGBPixel* inFrame, RGBPixel* outFrame, const float* filter, int filter_size, int img_width, int img_height);
+  // A specific convolve_cpu_2d implementation ("scalar", "avx2", "avx512",
+  // "avx2-tiled", "avx512-tiled"), or NULL if the CPU does not support it.
+  // The tiled ones are cache-blocked for large filters.
+  typedef void (*convolve_fn)(const RGBPixel* inFrame, RGBPixel* outFrame, const float* filter, int filter_size, int img_width, int img_height);
+  convolve_fn convolve_cpu_2d_impl(const char* isa);
+  // Bit-exact model of the ap_fixed<16,9> FPGA kernels (dataflow, multicu):
+  // 16 bit fixed-point coefficients and sums that wrap, to_int() of the sum
+  void convolve_cpu_fixed(const RGBPixel* inFrame, RGBPixel* outFrame, const float* filter, int filter_size, int img_width, int img_height);
+  // A specific convolve_cpu_fixed implementation ("scalar", "avx2", "avx512"),
+  // or NULL if the CPU does not support it
+  convolve_fn convolve_cpu_fixed_impl(const char* isa);
   // Convert RGB video frame to grayscale
   void grayscale_cpu(const RGBPixel* inFrame, GrayPixel* outFrame, int img_width, int img_height);
 
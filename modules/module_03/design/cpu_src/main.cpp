@@ -2,6 +2,8 @@
 #include "common.h"
 #include "constants.h"
 #include "filters.h"
+#include "frame_io.h"
+#include "kernels.h"
 
 #include <chrono>
 #include <cstdio>
@@ -15,10 +17,18 @@ using std::tie;
 int main(int argc, char* argv[]) {
     // Parse command line
     arguments opt = parse_args(argc, argv);
+    convolve_cpu_threads(opt.nthreads);
     int input_size = opt.width * opt.height * sizeof(RGBPixel);
 
-    FILE *streamIn, *streamOut;
-    tie(streamIn, streamOut) = get_streams(opt);
+    FrameSource* source;
+    FrameSink* sink;
+    tie(source, sink) = get_streams(opt);
+    if(!source || !sink) {
+        printf("Error: cannot open %s\n", source ? opt.output_file : opt.input_file);
+        delete source;
+        delete sink;
+        return EXIT_FAILURE;
+    }
 
     float* coefficients = gaussian;
     int coefficient_size = 3;
@@ -26,11 +36,12 @@ int main(int argc, char* argv[]) {
     printf("Processing %d frames of %s ...\n", opt.nframes, opt.input_file);
 
     auto start = system_clock::now();
-    convolve(streamIn, streamOut, coefficients, coefficient_size, opt);
+    convolve(source, sink, coefficients, coefficient_size, opt);
     float elapsed = duration<float>(system_clock::now() - start).count();
 
-    fflush(streamIn);
-    fflush(streamOut);
+    // Closes the files, and waits for ffmpeg to finish the output
+    delete source;
+    delete sink;
 
     double mbps = opt.nframes * input_size / 1024. / 1024. / elapsed;
     printf("\n\nProcessed %2.2f MB in %3.3fs (%3.2f MBps)\n\n",
@@ -0,0 +1,64 @@
+#include "thread_pool.h"
+
+using std::function;
+using std::lock_guard;
+using std::mutex;
+using std::thread;
+using std::unique_lock;
+
+ThreadPool::ThreadPool(unsigned int num_threads)
+    : job(nullptr), num_tasks(0), next(0), remaining(0), stop(false)
+{
+    // The thread calling parallel_for is one of the num_threads
+    for(unsigned int i = 1; i < num_threads; ++i)
+    {
+        threads.push_back(thread(&ThreadPool::worker, this));
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> guard(lock);
+        stop = true;
+    }
+    start.notify_all();
+    for(auto& t : threads) t.join();
+}
+
+void ThreadPool::parallel_for(unsigned int tasks, const function<void(unsigned int)>& fn)
+{
+    unique_lock<mutex> guard(lock);
+    job = &fn;
+    num_tasks = tasks;
+    next = 0;
+    remaining = tasks;
+    start.notify_all();
+
+    while(next < num_tasks)
+    {
+        unsigned int t = next++;
+        guard.unlock();
+        fn(t);
+        guard.lock();
+        remaining--;
+    }
+    done.wait(guard, [this]{ return remaining == 0; });
+    job = nullptr;
+}
+
+void ThreadPool::worker()
+{
+    unique_lock<mutex> guard(lock);
+    while(true)
+    {
+        start.wait(guard, [this]{ return stop || (job && next < num_tasks); });
+        if(stop) return;
+        const function<void(unsigned int)>* fn = job;
+        unsigned int t = next++;
+        guard.unlock();
+        (*fn)(t);
+        guard.lock();
+        if(--remaining == 0) done.notify_all();
+    }
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent worker threads running the tasks of parallel_for. The threads
+// are started once and wait for work between frames.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(unsigned int num_threads);
+    ~ThreadPool();
+
+    // Runs fn(0) .. fn(num_tasks-1) on the workers and the calling thread and
+    // returns when they are all done. Not reentrant.
+    void parallel_for(unsigned int num_tasks, const std::function<void(unsigned int)>& fn);
+
+    unsigned int size() const { return threads.size() + 1; }
+
+private:
+    void worker();
+
+    std::mutex lock;
+    std::condition_variable start;
+    std::condition_variable done;
+    const std::function<void(unsigned int)>* job;
+    unsigned int num_tasks;
+    unsigned int next;
+    unsigned int remaining;
+    bool stop;
+    std::vector<std::thread> threads;
+};
@@ -33,7 +33,8 @@ static struct argp_option options[] = {
     {"quiet", 'q', 0, 0, "Display verbose output"},
     {"nframes", 'n', "NUM", 0, "Number of frames to process"},
     {"kernel_name", 'k', "KERNEL_NAME", 0, "The kernel to launch"},
-    {"ncomputeunits", 'c', "NUM", 0, "Number of compute units"},
+    {"ncomputeunits", 'c', "NUM", 0, "Number of compute units to use (default: all of them in the binary)"},
+    {"inflight", 'f', "NUM", 0, "Frames in flight on the device, 1 for no overlap (default: 4)"},
     {0}};
 
 char default_output[] = "output.mp4";
@@ -91,6 +92,10 @@ parse_opt (int key, char *arg, struct argp_state *state) {
       arguments->ncompute_units = atoi(arg);
       break;
 
+    case 'f':
+      arguments->frames_in_flight = atoi(arg);
+      break;
+
     case ARGP_KEY_ARG:
       if(strstr(arg, "xclbin")) {
         arguments->binary_file = arg;
@@ -131,7 +136,8 @@ arguments parse_args(int argc, char* argv[]) {
     arguments.nframes = -1;
     arguments.binary_file = nullptr;
     arguments.kernel_name = default_kernel_name;
-    arguments.ncompute_units = 1;
+    arguments.ncompute_units = 0;
+    arguments.frames_in_flight = 4;
 
     argp_parse (&argp, argc, argv, 0, 0, &arguments);
 
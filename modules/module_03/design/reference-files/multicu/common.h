@@ -29,9 +29,12 @@ struct arguments {
   // The name of the kernel
   char* kernel_name;
 
-  // The number of compute units on the binary
+  // The number of compute units to use, 0 for all of them on the binary
   int ncompute_units;
 
+  // The number of frames in flight on the device, 1 for no overlap
+  int frames_in_flight;
+
   // The path to the xclbin or awsxcbin file
   char* binary_file;
 
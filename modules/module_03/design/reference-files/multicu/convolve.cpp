@@ -3,11 +3,21 @@
 #include "constants.h"
 #include "kernels.h"
 
-#include <vector>
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
+#include <iostream>
+#include <vector>
 
 #include "xcl2.hpp"
 
+// CL_KERNEL_COMPUTE_UNIT_COUNT, the XRT extension, is declared here
+#if defined(__has_include)
+#if __has_include(<CL/cl_ext_xilinx.h>)
+#include <CL/cl_ext_xilinx.h>
+#endif
+#endif
+
 
 
 using std::vector;
@@ -19,25 +29,77 @@ bool operator==(const RGBPixel& lhs, const RGBPixel& rhs) {
 }
 
 void
-test(vector<RGBPixel>& in, vector<RGBPixel>& out,
+test(const RGBPixel* in, const RGBPixel* out,
      float* coefficients, int coefficient_size,
      int width, int height) {
-    vector<RGBPixel> gold(out.size());
-    convolve_cpu(in.data(), gold.data(), coefficients, coefficient_size, width, height);
-    auto it = mismatch(begin(gold), end(gold), begin(out));
+    vector<RGBPixel> gold(width * height);
+    convolve_cpu_fixed(in, gold.data(), coefficients, coefficient_size, width, height);
+    auto it = mismatch(begin(gold), end(gold), out);
     if(it.first != end(gold)) {
         printf("Incorrect result: \n Expected: (%d %d %d)\nResult:  (%d %d %d)\n ",
                it.first->r, it.first->g, it.first->b, it.second->r, it.second->g, it.second->b);
     }
 }
 
+// A frame in flight: its device buffers, the host frames they are copied
+// from and to, and the events of its write -> kernels -> read chain
+struct FrameSlot {
+    cl::Buffer buffer_input;
+    cl::Buffer buffer_output;
+    vector<RGBPixel, aligned_allocator<RGBPixel>> inFrame;
+    vector<RGBPixel, aligned_allocator<RGBPixel>> outFrame;
+    cl::Event write_event;
+    cl::Event read_event;
+    int frame;
+};
+
+
+// CUs linked by the multicu step of ../../makefile/Makefile (CU_NUM, v++
+// --nk), used when the runtime does not report the count and -c is not given
+static const int default_compute_units = 4;
+
+// Compute units of kernel in the xclbin (v++ --nk), 0 if the runtime does
+// not report it
+static int available_compute_units(const cl::Kernel& kernel) {
+#ifdef CL_KERNEL_COMPUTE_UNIT_COUNT
+    cl_uint count = 0;
+    if(clGetKernelInfo(kernel(), CL_KERNEL_COMPUTE_UNIT_COUNT, sizeof(count), &count, nullptr) == CL_SUCCESS)
+        return count;
+#endif
+    return 0;
+}
+
+// Lines [offset, offset + lines) of the frame, computed by one task
+struct LineBand {
+    int offset;
+    int lines;
+};
+
+// Splits the frame lines into bands for compute_units tasks, the first
+// height % bands one line longer than the others so every line is computed
+// and the CUs finish together. A task reads the coefficient_size / 2 halo
+// lines around its band from the frame, and a band above the last one also
+// reads a few pixels past its lower halo: bands have at least
+// coefficient_size / 2 + 1 lines so that stays in the frame, and a short
+// frame gets fewer bands than CUs.
+static vector<LineBand> split_lines(int height, int compute_units, int coefficient_size) {
+    int min_lines = coefficient_size / 2 + 1;
+    int bands = std::max(1, std::min(compute_units, height / min_lines));
+    vector<LineBand> split(bands);
+    int offset = 0;
+    for(int band = 0; band < bands; band++) {
+        split[band].offset = offset;
+        split[band].lines = height / bands + (band < height % bands ? 1 : 0);
+        offset += split[band].lines;
+    }
+    return split;
+}
+
 void convolve(FILE* streamIn, FILE* streamOut,
               float* coefficients, int coefficient_size,
               arguments args) {
     size_t frame_bytes = args.width * args.height * sizeof(RGBPixel);
     size_t gray_frame_bytes = args.width * args.height * sizeof(GrayPixel);
-    vector<RGBPixel> inFrame(args.width * args.height);
-    vector<RGBPixel> outFrame(args.width * args.height);
     vector<GrayPixel> grayFrame(args.width * args.height);
 
     size_t bytes_read = 0;
@@ -63,91 +125,145 @@ void convolve(FILE* streamIn, FILE* streamOut,
     cl::Kernel convolve_kernel(program, args.kernel_name);
 
 
-    cl::Buffer buffer_input(context, CL_MEM_READ_ONLY, frame_bytes, NULL);
-    cl::Buffer buffer_output(context, CL_MEM_WRITE_ONLY, frame_bytes, NULL);
+    // Frames in flight on the device (-f). Each frame has its own input and
+    // output buffers, so the write of frame N + 1 and the read of frame N - 1
+    // overlap the kernels of frame N; the host only waits when all of them
+    // are busy. With one frame the write, kernels and read run one after the
+    // other, for a measurement without overlap.
+    int frames_in_flight = std::max(args.frames_in_flight, 1);
+    vector<FrameSlot> ring(frames_in_flight);
+    for(FrameSlot& slot : ring) {
+        slot.buffer_input = cl::Buffer(context, CL_MEM_READ_ONLY, frame_bytes, NULL);
+        slot.buffer_output = cl::Buffer(context, CL_MEM_WRITE_ONLY, frame_bytes, NULL);
+        slot.inFrame.resize(args.width * args.height);
+        slot.outFrame.resize(args.width * args.height);
+        slot.frame = -1;
+    }
     cl::Buffer buffer_coefficient(context, CL_MEM_USE_HOST_PTR | CL_MEM_READ_ONLY, coefficient_size_bytes, filter_coeff.data());
 
 
-    convolve_kernel.setArg(0, buffer_input);
-    convolve_kernel.setArg(1, buffer_output);
+    // Arguments 0 and 1 are set per frame, to the buffers of its slot
     convolve_kernel.setArg(2, buffer_coefficient);
     convolve_kernel.setArg(3, coefficient_size);
     convolve_kernel.setArg(4, args.width);
     convolve_kernel.setArg(5, args.height);
 
     q.enqueueMigrateMemObjects({buffer_coefficient}, 0);
-	
-    int compute_units = 4;
-    int lines_per_compute_unit = args.height / compute_units;
-	
-	auto fpga_begin = std::chrono::high_resolution_clock::now();
 
-    for(int frame_count = 0; frame_count < args.nframes; frame_count++) {
-        // Read frame
-        bytes_read = fread(inFrame.data(), 1, frame_bytes, streamIn);
-        if(bytes_read != frame_bytes) {
-        	printf("\nError: partial frame.\nExpected %zu\nActual %zu\n", frame_bytes, bytes_read);
-        	break;
-        }
+    // All the CUs of the binary unless -c asks for fewer; the tasks of a
+    // frame go to whichever CUs are free
+    int available = available_compute_units(convolve_kernel);
+    int compute_units = args.ncompute_units > 0 ? args.ncompute_units : available;
+    if(compute_units <= 0) {
+        printf("Warning: the runtime does not report the compute units of %s, using %d (pass -c NUM to change)\n",
+               args.kernel_name, default_compute_units);
+        compute_units = default_compute_units;
+    }
+    if(available > 0 && compute_units > available) {
+        printf("Warning: %d compute units requested, the binary has %d\n", compute_units, available);
+        compute_units = available;
+    }
+    vector<LineBand> bands = split_lines(args.height, compute_units, coefficient_size);
+    if(args.verbose) {
+        printf("Compute units: %d of %d, %zu bands of %d to %d lines\n", compute_units, available,
+               bands.size(), bands.back().lines, bands.front().lines);
+    }
+
+    int frames_queued = 0;
+    int frames_done = 0;
+    bool failed = false;
+
+    // Waits for the frame of slot and writes it to the output stream
+    auto finish_frame = [&](FrameSlot& slot) {
+        slot.read_event.wait();
+        slot.frame = -1;
+        if(failed) return;
 
-        /*
-        convolve_cpu(inFrame.data(), outFrame.data(),
-                     coefficients, coefficient_size,
-                     args.width, args.height);
-        */
-
-        cl::Event write_event;
-        q.enqueueWriteBuffer(buffer_input, CL_FALSE, 0, frame_bytes, inFrame.data(), nullptr, &write_event);
-				  
-	vector<cl::Event> iteration_events{write_event};
-	vector<cl::Event> task_events;
-        for(int cu = 0; cu < compute_units; cu++) {
-            cl::Event task_event;
-            convolve_kernel.setArg(6, cu * lines_per_compute_unit);
-            convolve_kernel.setArg(7, lines_per_compute_unit);
-            q.enqueueTask(convolve_kernel, &iteration_events, &task_event);
-            task_events.push_back(task_event);
-        }
-        copy(begin(task_events), end(task_events), std::back_inserter(iteration_events));
-		
-        cl::Event read_event;
-        q.enqueueReadBuffer(buffer_output, CL_FALSE, 0, frame_bytes, outFrame.data(), &iteration_events, &read_event);
-        iteration_events.push_back(read_event);
-	read_event.wait();
-		
         if(args.gray) {
-          grayscale_cpu(outFrame.data(), grayFrame.data(), args.width, args.height);
-          bytes_written = fwrite(outFrame.data(), 1, gray_frame_bytes, streamOut);
+          grayscale_cpu(slot.outFrame.data(), grayFrame.data(), args.width, args.height);
+          bytes_written = fwrite(grayFrame.data(), 1, gray_frame_bytes, streamOut);
           fflush(streamOut);
           if (bytes_written != gray_frame_bytes) {
             printf("\nError: partial frame.\nExpected %zu\nActual %zu\n",
                    gray_frame_bytes, bytes_written);
-            break;
+            failed = true;
+            return;
           }
         } else {
-          bytes_written = fwrite(outFrame.data(), 1, frame_bytes, streamOut);
+          bytes_written = fwrite(slot.outFrame.data(), 1, frame_bytes, streamOut);
           fflush(streamOut);
           if (bytes_written != frame_bytes) {
             printf("\nError: partial frame.\nExpected %zu\nActual %zu\n",
                    frame_bytes, bytes_written);
-            break;
+            failed = true;
+            return;
           }
-          // test(inFrame, outFrame, coefficients, coefficient_size, width, height);
+          // test(slot.inFrame.data(), slot.outFrame.data(), coefficients, coefficient_size, args.width, args.height);
+        }
+        frames_done++;
+    };
+
+    auto fpga_begin = std::chrono::high_resolution_clock::now();
+
+    for(int frame_count = 0; frame_count < args.nframes && !failed; frame_count++) {
+        // The slot of frame N was last used by frame N - frames_in_flight,
+        // the oldest one in flight: wait for it only now
+        FrameSlot& slot = ring[frame_count % frames_in_flight];
+        if(slot.frame >= 0) {
+            finish_frame(slot);
+            if(failed) break;
+        }
+
+        // Read frame
+        bytes_read = fread(slot.inFrame.data(), 1, frame_bytes, streamIn);
+        if(bytes_read != frame_bytes) {
+        	printf("\nError: partial frame.\nExpected %zu\nActual %zu\n", frame_bytes, bytes_read);
+        	break;
         }
 
+        q.enqueueWriteBuffer(slot.buffer_input, CL_FALSE, 0, frame_bytes, slot.inFrame.data(), nullptr, &slot.write_event);
+
+        vector<cl::Event> iteration_events{slot.write_event};
+        vector<cl::Event> task_events;
+        convolve_kernel.setArg(0, slot.buffer_input);
+        convolve_kernel.setArg(1, slot.buffer_output);
+        for(const LineBand& band : bands) {
+            cl::Event task_event;
+            convolve_kernel.setArg(6, band.offset);
+            convolve_kernel.setArg(7, band.lines);
+            q.enqueueTask(convolve_kernel, &iteration_events, &task_event);
+            task_events.push_back(task_event);
+        }
+
+        q.enqueueReadBuffer(slot.buffer_output, CL_FALSE, 0, frame_bytes, slot.outFrame.data(), &task_events, &slot.read_event);
+        q.flush();
+        slot.frame = frame_count;
+        frames_queued++;
+
         print_progress(frame_count, args.nframes);
     }
+
+    // Frames still in flight, oldest first
+    for(int frame = frames_queued - frames_in_flight; frame < frames_queued; frame++) {
+        if(frame < 0) continue;
+        FrameSlot& slot = ring[frame % frames_in_flight];
+        if(slot.frame == frame) finish_frame(slot);
+    }
     q.finish();
 
     auto fpga_end = std::chrono::high_resolution_clock::now();
 
-    // Report performance (if not running in emulation mode)
+    // Report performance (if not running in emulation mode). Run with -f 1
+    // for the frame rate without overlap.
     if (getenv("XCL_EMULATION_MODE") == NULL) {
         std::chrono::duration<double> fpga_duration = fpga_end - fpga_begin;
         std::cout << "                 " << std::endl;
         std::cout << "FPGA Time:       " << fpga_duration.count() << " s" << std::endl;
         std::cout << "FPGA Throughput: "
-                  << (1920*1080*4*132) / fpga_duration.count() / (1024.0*1024.0)
+                  << (frame_bytes * frames_done) / fpga_duration.count() / (1024.0*1024.0)
                   << " MB/s" << std::endl;
+        std::cout << "Frames/s:        " << frames_done / fpga_duration.count()
+                  << " with " << frames_in_flight << " frame" << (frames_in_flight > 1 ? "s" : "")
+                  << " in flight" << std::endl;
      }
 }
@@ -4,6 +4,8 @@
 extern "C" {
   // Convolve RGB video frame with input filter
   void convolve_cpu(const RGBPixel* inFrame, RGBPixel* outFrame, const float* filter, int filter_size, int img_width, int img_height);
+  // Bit-exact model of the ap_fixed<16,9> convolve_fpga kernel
+  void convolve_cpu_fixed(const RGBPixel* inFrame, RGBPixel* outFrame, const float* filter, int filter_size, int img_width, int img_height);
   // Convert RGB video frame to grayscale
   void grayscale_cpu(const RGBPixel* inFrame, GrayPixel* outFrame, int img_width, int img_height);
 
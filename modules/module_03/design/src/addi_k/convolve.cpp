@@ -23,7 +23,7 @@ test(vector<RGBPixel>& in, vector<RGBPixel>& out,
      float* coefficients, int coefficient_size,
      int width, int height) {
     vector<RGBPixel> gold(out.size());
-    convolve_cpu(in.data(), gold.data(), coefficients, coefficient_size, width, height);
+    convolve_cpu_fixed(in.data(), gold.data(), coefficients, coefficient_size, width, height);
     auto it = mismatch(begin(gold), end(gold), begin(out));
     if(it.first != end(gold)) {
         printf("Incorrect result: \n Expected: (%d %d %d)\nResult:  (%d %d %d)\n ",
@@ -40,4 +40,39 @@ void convolve_cpu(const RGBPixel* inFrame, RGBPixel* outFrame,
     }
 }
 
+// Golden model of the ap_fixed<16,9> kernel: coefficients truncated to 1/128
+// units, sums wrapping at 16 bits, to_int() of the sum
+void convolve_cpu_fixed(const RGBPixel* inFrame, RGBPixel* outFrame,
+                        const float* coefficient, int coefficient_size,
+                        int img_width, int img_height)
+{
+    int center = coefficient_size / 2;
+    for(int line = 0; line < img_height; ++line)
+    {
+        for(int pixel = 0; pixel < img_width; ++pixel)
+        {
+            short sum_r = 0, sum_g = 0, sum_b = 0;
+            for(int m = 0; m < coefficient_size; ++m)
+            {
+                for(int n = 0; n < coefficient_size; ++n)
+                {
+                    int ii = line + m - center;
+                    int jj = pixel + n - center;
+
+                    if(ii >= 0 && ii < img_height && jj >= 0 && jj < img_width)
+                    {
+                        short coef = (short)(long long)floor((double)coefficient[(m * coefficient_size) + n] * 128);
+                        sum_r = (short)(sum_r + inFrame[(ii * img_width) + jj].r * coef);
+                        sum_g = (short)(sum_g + inFrame[(ii * img_width) + jj].g * coef);
+                        sum_b = (short)(sum_b + inFrame[(ii * img_width) + jj].b * coef);
+                    }
+                }
+            }
+            outFrame[line * img_width + pixel].r = sum_r / 128;
+            outFrame[line * img_width + pixel].g = sum_g / 128;
+            outFrame[line * img_width + pixel].b = sum_b / 128;
+        }
+    }
+}
+
 }